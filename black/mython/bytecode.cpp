@@ -0,0 +1,526 @@
+#include "bytecode.h"
+#include "operations.h"
+#include "profiler.h"
+#include "statement.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// GCC and Clang dispatch by the address of the handler stored in each
+// instruction, other compilers switch on its code
+#if defined(__GNUC__)
+#define MYTHON_THREADED_CODE
+#endif
+
+namespace Bytecode {
+
+namespace {
+
+int
+GetStackDelta(OpCode code)
+{
+  switch (code) {
+    case OpCode::Const:
+    case OpCode::None:
+    case OpCode::Load:
+    case OpCode::PrintEnd:
+    case OpCode::New:
+      return 1;
+    case OpCode::Pop:
+    case OpCode::SetField:
+    case OpCode::PrintArg:
+    case OpCode::Add:
+    case OpCode::Sub:
+    case OpCode::Mult:
+    case OpCode::Div:
+    case OpCode::Compare:
+    case OpCode::JumpIfFalse:
+    case OpCode::JumpIfTrueOrPop:
+    case OpCode::JumpIfFalseOrPop:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+ObjectHolder
+CallMethod(Runtime::ClassInstance& inst, const Runtime::Method& method, const ObjectHolder* args, size_t count)
+{
+  if (method.code) {
+    const Runtime::ProfiledCall profiled(inst.GetClass(), method);
+    return Execute(*method.code, args, count);
+  }
+  return inst.Call(method, vector<ObjectHolder>(args + 1, args + count));
+}
+
+const Runtime::Method*
+FindInit(const Runtime::Class& cls, size_t argument_count)
+{
+  const auto method = cls.GetSpecialMethod(Runtime::SpecialMethod::Init);
+  return method && method->formal_params.size() == argument_count ? method : nullptr;
+}
+
+} // namespace
+
+Compiler::Compiler(size_t frame_size)
+  : function_(make_unique<Function>())
+{
+  function_->frame_size = frame_size;
+}
+
+void
+Compiler::Push(OpCode code, uint32_t arg, int stack_delta)
+{
+  function_->code.push_back({ code, arg, nullptr });
+  stack_depth_ += stack_delta;
+  function_->max_stack = max(function_->max_stack, stack_depth_);
+}
+
+void
+Compiler::AddConstant(ObjectHolder value)
+{
+  function_->constants.push_back(move(value));
+  Push(OpCode::Const, static_cast<uint32_t>(function_->constants.size() - 1), 1);
+}
+
+void
+Compiler::AddNone()
+{
+  Push(OpCode::None, 0, 1);
+}
+
+void
+Compiler::AddLoad(size_t slot)
+{
+  Push(OpCode::Load, static_cast<uint32_t>(slot), 1);
+}
+
+void
+Compiler::AddStore(size_t slot)
+{
+  Push(OpCode::Store, static_cast<uint32_t>(slot), 0);
+}
+
+void
+Compiler::AddPop()
+{
+  Push(OpCode::Pop, 0, -1);
+}
+
+void
+Compiler::AddGetField(Runtime::Symbol symbol, string object_name)
+{
+  function_->fields.push_back({ symbol, move(object_name), {} });
+  Push(OpCode::GetField, static_cast<uint32_t>(function_->fields.size() - 1), 0);
+}
+
+void
+Compiler::AddSetField(Runtime::Symbol symbol, string object_name)
+{
+  function_->fields.push_back({ symbol, move(object_name), {} });
+  Push(OpCode::SetField, static_cast<uint32_t>(function_->fields.size() - 1), -1);
+}
+
+void
+Compiler::AddPrintArg(bool is_last)
+{
+  Push(OpCode::PrintArg, is_last ? 0 : 1, -1);
+}
+
+void
+Compiler::AddPrintEnd()
+{
+  Push(OpCode::PrintEnd, 0, 1);
+}
+
+size_t
+Compiler::AddCheckCall(string method, size_t argument_count)
+{
+  function_->calls.push_back({ move(method), static_cast<uint32_t>(argument_count), {} });
+  const size_t call = function_->calls.size() - 1;
+  Push(OpCode::CheckCall, static_cast<uint32_t>(call), 0);
+  return call;
+}
+
+void
+Compiler::AddCall(size_t call)
+{
+  Push(OpCode::Call, static_cast<uint32_t>(call), -static_cast<int>(function_->calls[call].argument_count));
+}
+
+size_t
+Compiler::AddNew(const Runtime::Class& cls, size_t argument_count)
+{
+  function_->news.push_back({ &cls, static_cast<uint32_t>(argument_count) });
+  const size_t new_site = function_->news.size() - 1;
+  Push(OpCode::New, static_cast<uint32_t>(new_site), 1);
+  return new_site;
+}
+
+void
+Compiler::AddInit(size_t new_site)
+{
+  Push(OpCode::Init, static_cast<uint32_t>(new_site), -static_cast<int>(function_->news[new_site].argument_count));
+}
+
+void
+Compiler::AddOperation(OpCode code)
+{
+  Push(code, 0, GetStackDelta(code));
+}
+
+void
+Compiler::AddCompare(Function::Comparator comparator)
+{
+  function_->comparators.push_back(move(comparator));
+  Push(OpCode::Compare, static_cast<uint32_t>(function_->comparators.size() - 1), -1);
+}
+
+Compiler::Label
+Compiler::AddJump(OpCode code)
+{
+  // the value a jump "or pop" keeps is still there at the target
+  const bool keeps_value = code == OpCode::JumpIfTrueOrPop || code == OpCode::JumpIfFalseOrPop;
+  const size_t stack_depth = stack_depth_;
+  Push(code, 0, GetStackDelta(code));
+  return { function_->code.size() - 1, keeps_value ? stack_depth : stack_depth_ };
+}
+
+void
+Compiler::BindLabel(const Label& label)
+{
+  function_->code[label.jump].arg = static_cast<uint32_t>(function_->code.size());
+  stack_depth_ = label.stack_depth;
+}
+
+void
+Compiler::AddReturn()
+{
+  // the code which follows is not reached, but it is laid out as if the value
+  // was left on the stack
+  Push(OpCode::Return, 0, 0);
+}
+
+void
+Compiler::AddClass(Runtime::Class& cls)
+{
+  for (auto& method : cls.GetMethods()) {
+    if (!method.frame_size) {
+      throw logic_error("Method " + method.name + " of class " + cls.GetName() + " has not been resolved");
+    }
+    Compiler compiler(method.frame_size);
+    method.body->Compile(compiler);
+    compiler.AddReturn();
+    method.code = compiler.Finish();
+  }
+}
+
+unique_ptr<Function>
+Compiler::Finish()
+{
+  return move(function_);
+}
+
+unique_ptr<Function>
+CompileProgram(Ast::Statement& program, size_t frame_size)
+{
+  Compiler compiler(frame_size);
+  program.Compile(compiler);
+  compiler.AddReturn();
+  return compiler.Finish();
+}
+
+ObjectHolder
+Execute(const Function& function, const ObjectHolder* args, size_t count)
+{
+#ifdef MYTHON_THREADED_CODE
+  // in the order of OpCode
+  static const void* const handlers[] = {
+    &&Const,     &&None,      &&Load,  &&Store,   &&Pop,          &&GetField,    &&SetField,
+    &&PrintArg,  &&PrintEnd,  &&CheckCall, &&Call, &&New,         &&Init,        &&Stringify,
+    &&Add,       &&Sub,       &&Mult,  &&Div,     &&Not,          &&Truth,       &&Compare,
+    &&Jump,      &&JumpIfFalse, &&JumpIfTrueOrPop, &&JumpIfFalseOrPop, &&Return,
+  };
+  static_assert(size(handlers) == static_cast<size_t>(OpCode::Return) + 1, "Every instruction needs a handler");
+
+  if (!function.is_threaded) {
+    for (const auto& instruction : function.code) {
+      instruction.handler = handlers[static_cast<size_t>(instruction.code)];
+    }
+    function.is_threaded = true;
+  }
+#define CASE(code) code:
+#define DISPATCH() goto* ip->handler
+#else
+#define CASE(code) case OpCode::code:
+#define DISPATCH() goto dispatch
+#endif
+// a computed goto out of a block does not run the destructors of its locals,
+// so a handler does its work in an inner block which ends before the dispatch
+#define NEXT()                                                                                                         \
+  ++ip;                                                                                                                \
+  DISPATCH()
+#define JUMP()                                                                                                         \
+  ip = code + ip->arg;                                                                                                 \
+  DISPATCH()
+
+  vector<ObjectHolder> frame(function.frame_size + function.max_stack);
+  copy(args, args + count, begin(frame));
+
+  ObjectHolder* const slots = frame.data();
+  // top points past the last operand
+  ObjectHolder* top = slots + function.frame_size;
+  auto pop = [&top] { return std::move(*--top); };
+
+  ostream& output = Ast::Print::GetOutputStream();
+  const Instruction* const code = function.code.data();
+  const Instruction* ip = code;
+
+#ifdef MYTHON_THREADED_CODE
+  DISPATCH();
+#else
+dispatch:
+  switch (ip->code) {
+#endif
+  CASE(Const)
+  {
+    {
+      *top++ = function.constants[ip->arg];
+    }
+    NEXT();
+  }
+  CASE(None)
+  {
+    {
+      *top++ = ObjectHolder::None();
+    }
+    NEXT();
+  }
+  CASE(Load)
+  {
+    {
+      *top++ = slots[ip->arg];
+    }
+    NEXT();
+  }
+  CASE(Store)
+  {
+    {
+      slots[ip->arg] = top[-1];
+    }
+    NEXT();
+  }
+  CASE(Pop)
+  {
+    {
+      pop();
+    }
+    NEXT();
+  }
+  CASE(GetField)
+  {
+    {
+      const auto& field = function.fields[ip->arg];
+      auto inst = top[-1].TryAs<Runtime::ClassInstance>();
+      if (!inst) {
+        throw runtime_error("invalid field at " + field.object_name);
+      }
+      ObjectHolder value = field.cache.Get(inst->Fields(), field.symbol);
+      top[-1] = std::move(value);
+    }
+    NEXT();
+  }
+  CASE(SetField)
+  {
+    {
+      const auto& field = function.fields[ip->arg];
+      ObjectHolder value = pop();
+      auto inst = top[-1].TryAs<Runtime::ClassInstance>();
+      if (!inst) {
+        throw runtime_error("cannot assign a field of non-object " + field.object_name);
+      }
+      field.cache.Get(inst->Fields(), field.symbol) = value;
+      top[-1] = std::move(value);
+    }
+    NEXT();
+  }
+  CASE(PrintArg)
+  {
+    {
+      Runtime::PrintValue(output, pop());
+      if (ip->arg) {
+        output << ' ';
+      }
+    }
+    NEXT();
+  }
+  CASE(PrintEnd)
+  {
+    {
+      output << '\n';
+      *top++ = ObjectHolder::None();
+    }
+    NEXT();
+  }
+  CASE(CheckCall)
+  {
+    {
+      const auto& call = function.calls[ip->arg];
+      auto inst = top[-1].TryAs<Runtime::ClassInstance>();
+      if (!inst) {
+        throw runtime_error("cannot call method on non-object instance");
+      }
+      const auto method = call.cache.Find(inst->GetClass(), call.method);
+      if (!method || method->formal_params.size() != call.argument_count) {
+        throw runtime_error("invalid method name");
+      }
+    }
+    NEXT();
+  }
+  CASE(Call)
+  {
+    {
+      const auto& call = function.calls[ip->arg];
+      ObjectHolder* const object = top - call.argument_count - 1;
+      auto inst = object->TryAs<Runtime::ClassInstance>();
+      const auto method = call.cache.Find(inst->GetClass(), call.method);
+      ObjectHolder result = CallMethod(*inst, *method, object, call.argument_count + 1);
+      while (top != object) {
+        pop();
+      }
+      *top++ = std::move(result);
+    }
+    NEXT();
+  }
+  CASE(New)
+  {
+    {
+      const auto& new_site = function.news[ip->arg];
+      if (new_site.argument_count && !FindInit(*new_site.cls, new_site.argument_count)) {
+        throw runtime_error("invalid number of _init_ parameters");
+      }
+      *top++ = ObjectHolder::Own(Runtime::ClassInstance(*new_site.cls));
+    }
+    NEXT();
+  }
+  CASE(Init)
+  {
+    {
+      const auto& new_site = function.news[ip->arg];
+      ObjectHolder* const object = top - new_site.argument_count - 1;
+      if (const auto init = FindInit(*new_site.cls, new_site.argument_count)) {
+        CallMethod(*object->TryAs<Runtime::ClassInstance>(), *init, object, new_site.argument_count + 1);
+      }
+      while (top != object + 1) {
+        pop();
+      }
+    }
+    NEXT();
+  }
+  CASE(Stringify)
+  {
+    {
+      top[-1] = Runtime::Stringify(std::move(top[-1]));
+    }
+    NEXT();
+  }
+  CASE(Add)
+  {
+    {
+      ObjectHolder rhs = pop();
+      top[-1] = Runtime::Add(std::move(top[-1]), std::move(rhs));
+    }
+    NEXT();
+  }
+  CASE(Sub)
+  {
+    {
+      ObjectHolder rhs = pop();
+      top[-1] = Runtime::Sub(std::move(top[-1]), std::move(rhs));
+    }
+    NEXT();
+  }
+  CASE(Mult)
+  {
+    {
+      ObjectHolder rhs = pop();
+      top[-1] = Runtime::Mult(std::move(top[-1]), std::move(rhs));
+    }
+    NEXT();
+  }
+  CASE(Div)
+  {
+    {
+      ObjectHolder rhs = pop();
+      top[-1] = Runtime::Div(std::move(top[-1]), std::move(rhs));
+    }
+    NEXT();
+  }
+  CASE(Not)
+  {
+    {
+      top[-1] = ObjectHolder::Own(Runtime::Bool(!Runtime::IsTrue(top[-1])));
+    }
+    NEXT();
+  }
+  CASE(Truth)
+  {
+    {
+      top[-1] = ObjectHolder::Own(Runtime::Bool(Runtime::IsTrue(top[-1])));
+    }
+    NEXT();
+  }
+  CASE(Compare)
+  {
+    {
+      const bool result = function.comparators[ip->arg](top[-2], top[-1]);
+      pop();
+      top[-1] = ObjectHolder::Own(Runtime::Bool(result));
+    }
+    NEXT();
+  }
+  CASE(Jump)
+  {
+    JUMP();
+  }
+  CASE(JumpIfFalse)
+  {
+    if (!Runtime::IsTrue(pop())) {
+      JUMP();
+    }
+    NEXT();
+  }
+  CASE(JumpIfTrueOrPop)
+  {
+    if (Runtime::IsTrue(top[-1])) {
+      JUMP();
+    }
+    pop();
+    NEXT();
+  }
+  CASE(JumpIfFalseOrPop)
+  {
+    if (!Runtime::IsTrue(top[-1])) {
+      JUMP();
+    }
+    pop();
+    NEXT();
+  }
+  CASE(Return)
+  {
+    return pop();
+  }
+#ifndef MYTHON_THREADED_CODE
+  }
+  throw logic_error("Unknown instruction");
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+}
+
+} /* namespace Bytecode */
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "object.h"
+#include "object_holder.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Ast {
+struct Statement;
+}
+
+class TestRunner;
+
+namespace Bytecode {
+
+enum class OpCode : uint8_t
+{
+  Const,
+  None,
+  Load,
+  Store,
+  Pop,
+  GetField,
+  SetField,
+  PrintArg,
+  PrintEnd,
+  CheckCall,
+  Call,
+  New,
+  Init,
+  Stringify,
+  Add,
+  Sub,
+  Mult,
+  Div,
+  Not,
+  Truth,
+  Compare,
+  Jump,
+  JumpIfFalse,
+  JumpIfTrueOrPop,
+  JumpIfFalseOrPop,
+  Return
+};
+
+struct Instruction
+{
+  OpCode code;
+  // slot, index in a pool of the function or target of a jump
+  uint32_t arg;
+  // address of the code of the VM which executes the instruction, set when
+  // the function runs first
+  mutable const void* handler;
+};
+
+// Body of a method or a program compiled to code for the stack VM. The VM runs
+// a call on a flat frame of the slots laid out by the resolver followed by the
+// operand stack
+struct Function
+{
+  using Comparator = std::function<bool(const ObjectHolder&, const ObjectHolder&)>;
+
+  struct Field
+  {
+    Runtime::Symbol symbol;
+    // of the object the field is accessed on, for errors
+    std::string object_name;
+    mutable Runtime::FieldCache cache;
+  };
+
+  struct CallSite
+  {
+    std::string method;
+    uint32_t argument_count;
+    mutable Runtime::MethodCache cache;
+  };
+
+  struct NewSite
+  {
+    const Runtime::Class* cls;
+    uint32_t argument_count;
+  };
+
+  std::vector<Instruction> code;
+  std::vector<ObjectHolder> constants;
+  std::vector<Field> fields;
+  std::vector<CallSite> calls;
+  std::vector<NewSite> news;
+  std::vector<Comparator> comparators;
+
+  size_t frame_size = 0;
+  size_t max_stack = 0;
+  mutable bool is_threaded = false;
+};
+
+// Emits the code of a function for the statements of its body, every
+// statement leaves its value on the operand stack
+class Compiler
+{
+public:
+  explicit Compiler(size_t frame_size);
+
+  // Jump to be bound to its target once the target is emitted
+  struct Label
+  {
+    size_t jump;
+    // of the operand stack at the target
+    size_t stack_depth;
+  };
+
+  void AddConstant(ObjectHolder value);
+  void AddNone();
+  void AddLoad(size_t slot);
+  void AddStore(size_t slot);
+  void AddPop();
+  void AddGetField(Runtime::Symbol symbol, std::string object_name);
+  void AddSetField(Runtime::Symbol symbol, std::string object_name);
+  // the separator is printed after the value, so before the next argument is
+  // evaluated
+  void AddPrintArg(bool is_last);
+  void AddPrintEnd();
+  // CheckCall goes after the object, Call of the returned site after the
+  // arguments
+  size_t AddCheckCall(std::string method, size_t argument_count);
+  void AddCall(size_t call);
+  // New creates the instance, Init of the returned site calls __init__ after
+  // the arguments
+  size_t AddNew(const Runtime::Class& cls, size_t argument_count);
+  void AddInit(size_t new_site);
+  void AddOperation(OpCode code);
+  void AddCompare(Function::Comparator comparator);
+  Label AddJump(OpCode code);
+  void BindLabel(const Label& label);
+  void AddReturn();
+
+  // Compiles the resolved methods of the class
+  void AddClass(Runtime::Class& cls);
+
+  std::unique_ptr<Function> Finish();
+
+private:
+  void Push(OpCode code, uint32_t arg, int stack_delta);
+
+  std::unique_ptr<Function> function_;
+  size_t stack_depth_ = 0;
+};
+
+// Compiles the resolved program and the methods of the classes it defines
+std::unique_ptr<Function>
+CompileProgram(Ast::Statement& program, size_t frame_size);
+
+// Runs the function with the first slots of its frame set to the arguments,
+// for a method they are self and its formal parameters
+ObjectHolder
+Execute(const Function& function, const ObjectHolder* args, size_t count);
+
+void
+RunBytecodeTests(TestRunner& tr);
+
+} /* namespace Bytecode */
@@ -0,0 +1,227 @@
+#include "bytecode.h"
+#include "comparators.h"
+#include "lexer.h"
+#include "parse.h"
+#include "resolver.h"
+#include "statement.h"
+
+#include <test_runner.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace Bytecode {
+
+namespace {
+
+unique_ptr<Ast::Statement>
+ParseResolved(const string& program, size_t& frame_size)
+{
+  istringstream is(program);
+  Parse::Lexer lexer(is);
+  auto tree = ParseProgram(lexer);
+  frame_size = Ast::ResolveProgram(*tree);
+  return tree;
+}
+
+string
+RunCompiled(const string& program)
+{
+  size_t frame_size = 0;
+  auto tree = ParseResolved(program, frame_size);
+
+  ostringstream os;
+  Ast::Print::SetOutputStream(os);
+  const auto function = CompileProgram(*tree, frame_size);
+  Execute(*function, nullptr, 0);
+  return os.str();
+}
+
+string
+RunTree(const string& program)
+{
+  size_t frame_size = 0;
+  auto tree = ParseResolved(program, frame_size);
+
+  ostringstream os;
+  Ast::Print::SetOutputStream(os);
+  Runtime::Frame frame(frame_size);
+  tree->Execute(frame);
+  return os.str();
+}
+
+bool
+ThrowsRuntimeError(const string& program)
+{
+  try {
+    RunCompiled(program);
+  } catch (const runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+class Counted : public Runtime::Object
+{
+public:
+  static int instance_count;
+
+  Counted() { ++instance_count; }
+  Counted(const Counted&) { ++instance_count; }
+  ~Counted() override { --instance_count; }
+
+  void Print(ostream&) override {}
+};
+
+int Counted::instance_count = 0;
+
+} // namespace
+
+void
+TestCode()
+{
+  size_t frame_size = 0;
+  auto tree = ParseResolved("x = 1 + 2\nprint x, 'x'\n", frame_size);
+  const auto function = CompileProgram(*tree, frame_size);
+
+  const vector<OpCode> expected = {
+    OpCode::Const,    OpCode::Const,    OpCode::Add, OpCode::Store, OpCode::Pop,  OpCode::Load,
+    OpCode::PrintArg, OpCode::Const,    OpCode::PrintArg, OpCode::PrintEnd, OpCode::Pop, OpCode::None,
+    OpCode::Return,
+  };
+  ASSERT_EQUAL(function->code.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT(function->code[i].code == expected[i]);
+  }
+  ASSERT_EQUAL(function->frame_size, 1u);
+  ASSERT_EQUAL(function->max_stack, 2u);
+}
+
+void
+TestEnginesAgree()
+{
+  const string programs[] = {
+    R"(
+class Counter:
+  def __init__(start):
+    self.value = start
+
+  def add(n):
+    print 'add', n
+    self.value = self.value + n
+    return self
+
+  def __str__():
+    return 'Counter(' + str(self.value) + ')'
+
+  def __add__(other):
+    return self.value + other.value
+
+c = Counter(1)
+d = c.add(2)
+print 'sum', d.add(3), c.value
+print c + Counter(10), str(None), str(c.value)
+)",
+    R"(
+class Abs:
+  def calc(n):
+    if n > 0:
+      return n
+    else:
+      if n == 0:
+        return 'zero'
+    return -n
+
+  def nothing():
+    x = 1
+
+a = Abs()
+print a.calc(5), a.calc(0), a.calc(-7), a.nothing()
+)",
+    R"(
+x = 0
+y = 'text'
+print x or y, x and y, not x, not y, x < 1 and y == 'text' or x.field
+print 1 <= 2, 2 >= 3, 'a' < 'b', True == False, None != None, 4 / 3 * 3
+)",
+    R"(
+class Node:
+  def __init__(value):
+    self.value = value
+    self.next = None
+
+class List:
+  def __init__():
+    self.head = None
+    self.size = 0
+
+  def push(value):
+    node = Node(value)
+    node.next = self.head
+    self.head = node
+    self.size = self.size + 1
+
+  def sum(node):
+    if node:
+      return node.value + self.sum(node.next)
+    return 0
+
+list = List()
+list.push(1)
+list.push(2)
+list.push(3)
+print list.size, list.head.value, list.head.next.next.value, list.sum(list.head)
+)",
+  };
+
+  for (const auto& program : programs) {
+    ASSERT_EQUAL(RunCompiled(program), RunTree(program));
+  }
+}
+
+void
+TestShortCircuit()
+{
+  ASSERT_EQUAL(RunCompiled("x = None\nprint True or x.f(), False and x.f()\n"), "True False\n");
+}
+
+void
+TestErrors()
+{
+  ASSERT(ThrowsRuntimeError("x = 1\nx.f()\n"));
+  ASSERT(ThrowsRuntimeError("class A:\n  def f():\n    return 1\na = A()\na.g()\n"));
+  ASSERT(ThrowsRuntimeError("class A:\n  def f(x):\n    return x\na = A()\na.f()\n"));
+  ASSERT(ThrowsRuntimeError("class A:\n  def f():\n    return 1\na = A(1)\n"));
+  ASSERT(ThrowsRuntimeError("x = 1\nprint x.y.z\n"));
+  ASSERT(ThrowsRuntimeError("print 1 + 'a'\n"));
+}
+
+void
+TestOperandsAreFreed()
+{
+  {
+    Compiler compiler(0);
+    compiler.AddConstant(ObjectHolder::Own(Counted()));
+    compiler.AddConstant(ObjectHolder::Own(Counted()));
+    compiler.AddCompare(Runtime::Equal);
+    compiler.AddReturn();
+    const auto function = compiler.Finish();
+    ASSERT(!Runtime::IsTrue(Execute(*function, nullptr, 0)));
+  }
+  ASSERT_EQUAL(Counted::instance_count, 0);
+}
+
+void
+RunBytecodeTests(TestRunner& tr)
+{
+  RUN_TEST(tr, Bytecode::TestCode);
+  RUN_TEST(tr, Bytecode::TestEnginesAgree);
+  RUN_TEST(tr, Bytecode::TestShortCircuit);
+  RUN_TEST(tr, Bytecode::TestErrors);
+  RUN_TEST(tr, Bytecode::TestOperandsAreFreed);
+}
+
+} /* namespace Bytecode */
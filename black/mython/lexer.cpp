@@ -74,31 +74,15 @@ GetKeywordToken(string_view alnumseq)
   return it->second;
 }
 
-TokenType::Number
-ReadInteger(istream& input)
+string
+ReadAll(istream& input)
 {
-  int number = 0;
-  while (isdigit(input.peek())) {
-    number *= 10;
-    number += input.get() - '0';
+  string buffer;
+  char chunk[1 << 16];
+  while (input.read(chunk, sizeof(chunk)) || input.gcount()) {
+    buffer.append(chunk, static_cast<size_t>(input.gcount()));
   }
-  return TokenType::Number{ number };
-}
-
-TokenType::String
-ReadString(istream& input)
-{
-  char terminator;
-  input >> terminator;
-
-  string str;
-
-  bool escaping = false;
-  for (char nextchar = char(input.get()); escaping || nextchar != terminator; nextchar = char(input.get())) {
-    escaping = !escaping && nextchar == '\\';
-    str.push_back(nextchar);
-  }
-  return TokenType::String{ str };
+  return buffer;
 }
 
 bool
@@ -173,53 +157,90 @@ operator<<(std::ostream& os, const Token& rhs)
 }
 
 Lexer::Lexer(istream& input)
-  : input_(input)
+  : buffer_(ReadAll(input))
+  , source_(buffer_)
+{
+  IndexLines();
+  NextToken();
+}
+
+Lexer::Lexer(string_view source)
+  : source_(source)
 {
+  IndexLines();
   NextToken();
 }
 
+void
+Lexer::IndexLines()
+{
+  for (size_t begin = 0; begin < source_.size();) {
+    size_t text = begin;
+    while (text < source_.size() && source_[text] == ' ') {
+      ++text;
+    }
+    lines_.push_back({ begin, text });
+
+    const size_t end = source_.find('\n', text);
+    begin = end == string_view::npos ? source_.size() : end + 1;
+  }
+}
+
+void
+Lexer::SkipBlankLines()
+{
+  while (line_ + 1 < lines_.size() && lines_[line_ + 1].begin <= pos_) {
+    ++line_;
+  }
+  for (; line_ < lines_.size(); ++line_) {
+    const Line& line = lines_[line_];
+    if (line.begin >= pos_ && line.text < source_.size() && source_[line.text] != '\n') {
+      pos_ = line.text;
+      // the indentation of the first line is not counted
+      if (token_) {
+        current_level_ = static_cast<unsigned>(line.text - line.begin) / 2;
+      }
+      return;
+    }
+  }
+  pos_ = source_.size();
+  current_level_ = 0;
+}
+
 const Token&
 Lexer::CurrentToken() const
 {
-  if (tokens_.empty()) {
+  if (!token_) {
     throw LexerError("No token is read");
   }
-  return *rbegin(tokens_);
+  return *token_;
 }
 
-Token
+const Token&
 Lexer::NextToken()
 {
-  auto token = ReadToken();
-  tokens_.push_back(token);
-  return token;
+  token_ = ReadToken();
+  return *token_;
+}
+
+size_t
+Lexer::CurrentLine() const
+{
+  const auto it =
+    upper_bound(begin(lines_), end(lines_), token_begin_, [](size_t pos, const Line& line) { return pos < line.begin; });
+  return max<size_t>(it - begin(lines_), 1);
 }
 
 Token
 Lexer::ReadToken()
 {
-  auto IsWhiteEol = [this](char c) {
-    return c == '\n' && (tokens_.empty() || CurrentToken().Is<TokenType::Newline>());
-  };
-
-  // skip whitespaces
-  unsigned num_spaces = 0;
-
-  char whitechar = char(input_.peek());
-  while (whitechar == ' ' || IsWhiteEol(whitechar)) {
-    input_.get();
-    if (whitechar == ' ') {
-      ++num_spaces;
-    } else { // white newline
-      num_spaces = 0;
-    }
-    whitechar = char(input_.peek());
+  if (!token_ || token_->Is<TokenType::Newline>()) {
+    SkipBlankLines();
   }
-
-  // check indentation change
-  if (!tokens_.empty() && CurrentToken().Is<TokenType::Newline>()) {
-    current_level_ = num_spaces / 2;
+  while (pos_ < source_.size() && source_[pos_] == ' ') {
+    ++pos_;
   }
+  token_begin_ = pos_;
 
   if (current_level_ > previous_level_) {
     ++previous_level_;
@@ -230,65 +251,67 @@ Lexer::ReadToken()
     return TokenType::Dedent();
   }
 
-  if (input_ && input_.peek() == -1) {
-    input_.get();
-  }
-
-  if (!input_) {
-    if (!tokens_.empty() && !CurrentToken().Is<TokenType::Eof>() && !CurrentToken().Is<TokenType::Newline>() &&
-        !CurrentToken().Is<TokenType::Dedent>()) {
+  if (pos_ == source_.size()) {
+    if (token_ && !token_->Is<TokenType::Eof>() && !token_->Is<TokenType::Newline>() &&
+        !token_->Is<TokenType::Dedent>()) {
       return TokenType::Newline();
     }
     return TokenType::Eof();
   }
 
-  char c = char(input_.get());
+  const char c = source_[pos_++];
+  auto next_is = [this](char next) {
+    if (pos_ < source_.size() && source_[pos_] == next) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  };
 
   // numbers
   if (checkPolicies<Digit>(c)) {
-    input_.putback(c);
-    return ReadInteger(input_);
+    int number = c - '0';
+    while (pos_ < source_.size() && isdigit(source_[pos_])) {
+      number = number * 10 + (source_[pos_++] - '0');
+    }
+    return TokenType::Number{ number };
   }
 
-  // strings
+  // strings, escapes are kept as they are
   if (c == '\'' || c == '"') {
-    input_.putback(c);
-    return ReadString(input_);
+    const size_t begin = pos_;
+    bool escaping = false;
+    for (; pos_ < source_.size() && (escaping || source_[pos_] != c); ++pos_) {
+      escaping = !escaping && source_[pos_] == '\\';
+    }
+    if (pos_ == source_.size()) {
+      throw LexerError("Unterminated string at line " + to_string(CurrentLine()));
+    }
+    return TokenType::String{ source_.substr(begin, pos_++ - begin) };
   }
 
   // symbols:
   switch (c) {
-    case '=': {
-      if (input_.peek() == '=') {
-        input_.get();
+    case '=':
+      if (next_is('=')) {
         return TokenType::Eq();
       }
-    }
-      [[fallthrough]];
-    case '>': {
-      auto next_char = input_.peek();
-      if (next_char == '=') {
-        input_.get();
+      return TokenType::Char{ c };
+    case '>':
+      if (next_is('=')) {
         return TokenType::GreaterOrEq();
       }
-    }
-      [[fallthrough]];
-    case '<': {
-      auto next_char = input_.peek();
-      if (next_char == '=') {
-        input_.get();
+      return TokenType::Char{ c };
+    case '<':
+      if (next_is('=')) {
         return TokenType::LessOrEq();
       }
-    }
-      [[fallthrough]];
-    case '!': {
-      auto next_char = input_.peek();
-      if (next_char == '=') {
-        input_.get();
+      return TokenType::Char{ c };
+    case '!':
+      if (next_is('=')) {
         return TokenType::NotEq();
       }
-    }
-      [[fallthrough]];
+      return TokenType::Char{ c };
     case '.':
       [[fallthrough]];
     case ',':
@@ -317,18 +340,16 @@ Lexer::ReadToken()
 
   // keywords or ids
   if (checkPolicies<Alpha, CharPolicy<'_'>>(c)) {
-    string string_token;
-    string_token.push_back(c);
-    while (checkPolicies<Alpha, Digit, CharPolicy<'_'>>(char(input_.peek()))) {
-      string_token.push_back(char(input_.get()));
+    const size_t begin = pos_ - 1;
+    while (pos_ < source_.size() && checkPolicies<Alpha, Digit, CharPolicy<'_'>>(source_[pos_])) {
+      ++pos_;
     }
 
-    auto keyword_token = GetKeywordToken(string_token);
-    if (keyword_token) {
+    const string_view alnumseq = source_.substr(begin, pos_ - begin);
+    if (auto keyword_token = GetKeywordToken(alnumseq)) {
       return *keyword_token;
-    } else {
-      return TokenType::Id{ move(string_token) };
     }
+    return TokenType::Id{ alnumseq };
   }
 
   return TokenType::Eof();
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -12,6 +13,7 @@ class TestRunner;
 
 namespace Parse {
 
+// Ids and strings are slices of the source the lexer reads
 namespace TokenType {
 struct Number
 {
@@ -20,7 +22,7 @@ struct Number
 
 struct Id
 {
-  std::string value;
+  std::string_view value;
 };
 
 struct Char
@@ -30,7 +32,7 @@ struct Char
 
 struct String
 {
-  std::string value;
+  std::string_view value;
 };
 
 struct Class
@@ -134,13 +136,23 @@ public:
   using std::runtime_error::runtime_error;
 };
 
+// Tokenizes the source from a contiguous buffer. The lines of the source and
+// their indentation are indexed before the first token is read
 class Lexer
 {
 public:
+  // Reads the whole input into the buffer of the lexer
   explicit Lexer(std::istream& input);
+  // Tokenizes the source in place, it must outlive the lexer and its tokens
+  explicit Lexer(std::string_view source);
+
+  Lexer(const Lexer&) = delete;
+  Lexer& operator=(const Lexer&) = delete;
 
   const Token& CurrentToken() const;
-  Token NextToken();
+  const Token& NextToken();
+  // Line of the source the current token is at, from 1
+  size_t CurrentLine() const;
 
   template<typename T>
   const T& Expect() const
@@ -176,10 +188,29 @@ public:
   }
 
 private:
+  struct Line
+  {
+    size_t begin;
+    // of the first character which is not a space
+    size_t text;
+  };
+
+  void IndexLines();
+  // Moves to the text of the next line which is not blank
+  void SkipBlankLines();
   Token ReadToken();
 
-  std::istream& input_;
-  std::vector<Token> tokens_;
+  std::string buffer_;
+  std::string_view source_;
+  size_t pos_ = 0;
+
+  std::vector<Line> lines_;
+  // the line pos_ is at
+  size_t line_ = 0;
+
+  // none before the first token is read
+  std::optional<Token> token_;
+  size_t token_begin_ = 0;
 
   unsigned current_level_ = 0;
   unsigned previous_level_ = 0;
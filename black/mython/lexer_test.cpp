@@ -339,6 +339,46 @@ TestAlwaysEmitsNewlineAtTheEndOfNonemptyLine()
   }
 }
 
+void
+TestLines()
+{
+  const string source = "\n\nclass A:\n  def f():\n\n    return 'a\nb'\n\nx = 1";
+  Lexer lexer(source);
+
+  ASSERT_EQUAL(lexer.CurrentToken(), Token(TokenType::Class{}));
+  ASSERT_EQUAL(lexer.CurrentLine(), 3u);
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Id{ "A" }));
+  ASSERT_EQUAL(lexer.CurrentLine(), 3u);
+  lexer.NextToken();
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Newline{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Indent{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Def{}));
+  ASSERT_EQUAL(lexer.CurrentLine(), 4u);
+  for (int i = 0; i < 6; ++i) {
+    lexer.NextToken();
+  }
+  ASSERT_EQUAL(lexer.CurrentToken(), Token(TokenType::Indent{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Return{}));
+  ASSERT_EQUAL(lexer.CurrentLine(), 6u);
+  // the string is a slice of the source
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::String{ "a\nb" }));
+  ASSERT(lexer.CurrentToken().As<TokenType::String>().value.data() == source.data() + source.find('a', 30));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Newline{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Dedent{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Dedent{}));
+  ASSERT_EQUAL(lexer.NextToken(), Token(TokenType::Id{ "x" }));
+  ASSERT_EQUAL(lexer.CurrentLine(), 9u);
+}
+
+void
+TestUnterminatedString()
+{
+  istringstream is("x = 'abc");
+  Lexer lexer(is);
+  lexer.NextToken();
+  ASSERT_THROWS(lexer.NextToken(), LexerError);
+}
+
 void
 RunLexerTests(TestRunner& tr)
 {
@@ -354,6 +394,8 @@ RunLexerTests(TestRunner& tr)
   RUN_TEST(tr, Parse::TestExpectNext);
   RUN_TEST(tr, Parse::TestMythonProgram);
   RUN_TEST(tr, Parse::TestAlwaysEmitsNewlineAtTheEndOfNonemptyLine);
+  RUN_TEST(tr, Parse::TestLines);
+  RUN_TEST(tr, Parse::TestUnterminatedString);
 }
 
 } /* namespace Parse */
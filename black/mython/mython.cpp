@@ -1,14 +1,19 @@
+#include "bytecode.h"
 #include "lexer.h"
 #include "object.h"
 #include "object_holder.h"
 #include "parse.h"
+#include "profiler.h"
+#include "resolver.h"
 #include "statement.h"
 
+#include <profile.h>
 #include <test_runner.h>
 
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -19,25 +24,69 @@ using namespace std;
 void
 TestAll();
 
+// The tree interpreter is kept as the reference for the bytecode VM
+enum class Engine
+{
+  Tree,
+  Bytecode
+};
+
+// Fills the statistics of the heap of the program if they are asked for, and
+// records the calls of methods in the profiler if one is given
 void
-RunMythonProgram(istream& input, ostream& output)
+RunMythonProgram(istream& input,
+                 ostream& output,
+                 Engine engine = Engine::Bytecode,
+                 Runtime::HeapStats* heap_stats = nullptr,
+                 Runtime::Profiler* profiler = nullptr)
 {
+  // goes first, so it outlives the objects of the program
+  Runtime::Heap heap;
+  optional<Runtime::Profiler::Session> profiler_session;
+  if (profiler) {
+    profiler_session.emplace(*profiler);
+  }
   Ast::Print::SetOutputStream(output);
 
   Parse::Lexer lexer(input);
   auto program = ParseProgram(lexer);
 
-  Runtime::Closure closure;
-  program->Execute(closure);
+  const size_t frame_size = Ast::ResolveProgram(*program);
+  if (engine == Engine::Bytecode) {
+    const auto function = Bytecode::CompileProgram(*program, frame_size);
+    Bytecode::Execute(*function, nullptr, 0);
+  } else {
+    Runtime::Frame frame(frame_size);
+    program->Execute(frame);
+  }
+
+  if (heap_stats) {
+    heap.Collect();
+    *heap_stats = heap.GetStats();
+  }
 }
 
+// --profile writes a report of the methods the program called to stderr,
+// --collapsed-stacks writes their call stacks for flame graphs there instead
 int
-main()
+main(int argc, char* argv[])
 {
 #ifdef LOCAL_TEST
   TestAll();
 #endif
 
+  const string mode = argc > 1 ? argv[1] : "";
+  if (mode == "--profile" || mode == "--collapsed-stacks") {
+    Runtime::Profiler profiler;
+    RunMythonProgram(cin, cout, Engine::Bytecode, nullptr, &profiler);
+    if (mode == "--profile") {
+      profiler.WriteReport(cerr);
+    } else {
+      profiler.WriteCollapsedStacks(cerr);
+    }
+    return 0;
+  }
+
   RunMythonProgram(cin, cout);
 
   return 0;
@@ -129,18 +178,301 @@ print y.value
   ASSERT_EQUAL(output.str(), "2\n3\n");
 }
 
+void
+BenchmarkEngines(const string& name, const string& program, const string& expected)
+{
+  for (const auto engine : { Engine::Tree, Engine::Bytecode }) {
+    istringstream input(program);
+    ostringstream output;
+    {
+      LOG_DURATION("Mython: " + name + (engine == Engine::Tree ? " (tree)" : " (bytecode)"));
+      RunMythonProgram(input, output, engine);
+    }
+    ASSERT_EQUAL(output.str(), expected);
+  }
+}
+
+void
+TestPerformanceMethodCalls()
+{
+  // a million calls, most of which return from a nested statement
+  BenchmarkEngines("method calls", R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(n):
+    self.value = self.value + n
+    return self.value
+
+class Loop:
+  def run(counter, n):
+    if n > 0:
+      counter.add(1)
+      return self.run(counter, n - 1)
+    return counter.value
+
+  def repeat(counter, times, n):
+    if times > 0:
+      self.run(counter, n)
+      return self.repeat(counter, times - 1, n)
+    return counter.value
+
+loop = Loop()
+print loop.repeat(Counter(), 500, 1000)
+)",
+                   "500000\n");
+}
+
+void
+TestPerformanceArithmetic()
+{
+  // loops are recursive calls in Mython
+  BenchmarkEngines("arithmetic", R"(
+class Math:
+  def sum_squares(n, sum):
+    if n == 0:
+      return sum
+    return self.sum_squares(n - 1, sum + n * n - n / 2 * 2 + n - n)
+
+  def fib(n):
+    if n < 2:
+      return n
+    return self.fib(n - 1) + self.fib(n - 2)
+
+  def repeat(times, n):
+    sum = self.sum_squares(n, 0)
+    if times > 1:
+      return self.repeat(times - 1, n)
+    return sum
+
+math = Math()
+print math.repeat(300, 1000), math.fib(22)
+)",
+                   "333333500 17711\n");
+}
+
+void
+TestPerformanceDispatch()
+{
+  // call sites see instances of several classes
+  BenchmarkEngines("method dispatch", R"(
+class Shape:
+  def __init__(size):
+    self.size = size
+
+  def area():
+    return 0
+
+  def scaled(factor):
+    return self.area() * factor
+
+class Square(Shape):
+  def area():
+    return self.size * self.size
+
+class Rect(Square):
+  def __init__(width, height):
+    self.size = width
+    self.height = height
+
+  def area():
+    return self.size * self.height
+
+class Walker:
+  def walk(a, b, c, n, sum):
+    if n > 0:
+      return self.walk(b, c, a, n - 1, sum + a.area() + b.scaled(2))
+    return sum
+
+  def repeat(times, n):
+    sum = self.walk(Shape(1), Square(3), Rect(2, 5), n, 0)
+    if times > 1:
+      return self.repeat(times - 1, n)
+    return sum
+
+walker = Walker()
+print walker.repeat(300, 999)
+)",
+                   "18981\n");
+}
+
+void
+TestPerformanceStrings()
+{
+  BenchmarkEngines("string building", R"(
+class Builder:
+  def build(n, s):
+    if n > 0:
+      return self.build(n - 1, s + str(n) + ",")
+    return s
+
+  def repeat(times, n):
+    s = self.build(n, "")
+    if times > 1:
+      return self.repeat(times - 1, n)
+    return s
+
+builder = Builder()
+long = builder.repeat(200, 500)
+print builder.repeat(2, 9), long == builder.build(500, "")
+)",
+                   "9,8,7,6,5,4,3,2,1, True\n");
+}
+
+void
+TestCyclesAreCollected()
+{
+  const string program = R"(
+class Node:
+  def __init__(parent):
+    self.parent = parent
+    if parent:
+      self.parent.child = self
+
+class Builder:
+  def build(n):
+    if n > 0:
+      node = Node(Node(None))
+      return self.build(n - 1)
+    return n
+
+  def repeat(times, n):
+    self.build(n)
+    if times > 1:
+      return self.repeat(times - 1, n)
+    return times
+
+builder = Builder()
+print builder.repeat(20, 500)
+)";
+
+  for (const auto engine : { Engine::Tree, Engine::Bytecode }) {
+    istringstream input(program);
+    ostringstream output;
+    Runtime::HeapStats stats;
+    RunMythonProgram(input, output, engine, &stats);
+
+    ASSERT_EQUAL(output.str(), "1\n");
+    ASSERT(stats.collections > 1u);
+    ASSERT_EQUAL(stats.collected_objects, 20000u);
+    ASSERT(stats.live_objects < 10u);
+  }
+}
+
+void
+TestProfiler()
+{
+  const string program = R"(
+class Counter:
+  def __init__():
+    self.count = 0
+
+  def add(n):
+    if n > 0:
+      self.count = self.count + 1
+      return self.add(n - 1)
+    return str(self)
+
+  def __str__():
+    return 'Counter(' + str(self.count) + ')'
+
+counter = Counter()
+print counter.add(10)
+)";
+
+  for (const auto engine : { Engine::Tree, Engine::Bytecode }) {
+    istringstream input(program);
+    ostringstream output;
+    Runtime::Profiler profiler;
+    RunMythonProgram(input, output, engine, nullptr, &profiler);
+    ASSERT_EQUAL(output.str(), "Counter(10)\n");
+
+    unordered_map<string, Runtime::MethodProfile> profiles;
+    for (const auto& profile : profiler.GetProfiles()) {
+      profiles[profile.name] = profile;
+    }
+    ASSERT_EQUAL(profiles.size(), 3u);
+    ASSERT_EQUAL(profiles["Counter.__init__"].calls, 1u);
+    ASSERT_EQUAL(profiles["Counter.__init__"].line, 3u);
+    ASSERT_EQUAL(profiles["Counter.add"].calls, 11u);
+    ASSERT_EQUAL(profiles["Counter.add"].line, 6u);
+    ASSERT_EQUAL(profiles["Counter.__str__"].calls, 1u);
+    ASSERT_EQUAL(profiles["Counter.__str__"].line, 12u);
+    // str(self) in the innermost add makes a string besides those of __str__
+    ASSERT(profiles["Counter.__str__"].exclusive_allocations > 0u);
+    ASSERT_EQUAL(profiles["Counter.add"].inclusive_allocations, profiles["Counter.__str__"].inclusive_allocations + 1);
+    ASSERT(profiles["Counter.add"].inclusive_time >= profiles["Counter.__str__"].inclusive_time);
+
+    ostringstream stacks;
+    profiler.WriteCollapsedStacks(stacks);
+    string add_stack = "Counter.add:6";
+    for (int i = 0; i < 10; ++i) {
+      add_stack += ";Counter.add:6";
+    }
+    ASSERT(stacks.str().find("Counter.__init__:3 ") != string::npos);
+    ASSERT(stacks.str().find(add_stack + ";Counter.__str__:12 ") != string::npos);
+  }
+}
+
+void
+TestPerformanceLexer()
+{
+  // a generated program of a few megabytes
+  ostringstream program;
+  for (int i = 0; i < 20000; ++i) {
+    program << "class Generated" << i << ":\n"
+            << "  def __init__(value):\n"
+            << "    self.value = value\n"
+            << "\n"
+            << "  def compute(x, y):\n"
+            << "    if x >= y and not x == " << i << ":\n"
+            << "      return self.value * x + y / 2 - " << i * 7 << "\n"
+            << "    return str(self.value) + 'generated string number " << i << "'\n"
+            << "\n";
+  }
+  const string source = program.str();
+
+  size_t stream_tokens = 0, buffer_tokens = 0;
+  {
+    LOG_DURATION("Mython: lexing " + to_string(source.size() >> 20) + " MB from a stream");
+    istringstream input(source);
+    for (Parse::Lexer lexer(input); !lexer.CurrentToken().Is<Parse::TokenType::Eof>(); lexer.NextToken()) {
+      ++stream_tokens;
+    }
+  }
+  {
+    LOG_DURATION("Mython: lexing " + to_string(source.size() >> 20) + " MB in place");
+    for (Parse::Lexer lexer(source); !lexer.CurrentToken().Is<Parse::TokenType::Eof>(); lexer.NextToken()) {
+      ++buffer_tokens;
+    }
+  }
+  ASSERT_EQUAL(stream_tokens, buffer_tokens);
+  ASSERT(buffer_tokens > 1000000u);
+}
+
 void
 TestAll()
 {
   TestRunner tr;
   Runtime::RunObjectHolderTests(tr);
   Runtime::RunObjectsTests(tr);
+  Runtime::RunProfilerTests(tr);
   Ast::RunUnitTests(tr);
   Parse::RunLexerTests(tr);
   TestParseProgram(tr);
+  Ast::RunResolverTests(tr);
+  Bytecode::RunBytecodeTests(tr);
 
   RUN_TEST(tr, TestSimplePrints);
   RUN_TEST(tr, TestAssignments);
   RUN_TEST(tr, TestArithmetics);
   RUN_TEST(tr, TestVariablesArePointers);
+  RUN_TEST(tr, TestCyclesAreCollected);
+  RUN_TEST(tr, TestProfiler);
+  RUN_TEST(tr, TestPerformanceMethodCalls);
+  RUN_TEST(tr, TestPerformanceArithmetic);
+  RUN_TEST(tr, TestPerformanceDispatch);
+  RUN_TEST(tr, TestPerformanceStrings);
+  RUN_TEST(tr, TestPerformanceLexer);
 }
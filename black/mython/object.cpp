@@ -1,7 +1,12 @@
 #include "object.h"
+#include "bytecode.h"
+#include "profiler.h"
 #include "statement.h"
 
+#include <algorithm>
+#include <iterator>
 #include <sstream>
+#include <stdexcept>
 #include <stack>
 #include <string_view>
 
@@ -12,9 +17,8 @@ namespace Runtime {
 void
 ClassInstance::Print(std::ostream& os)
 {
-  static std::string str_method_name = "__str__";
-  if (HasMethod(str_method_name, 0)) {
-    if (auto str_holder = Call(str_method_name, {})) {
+  if (auto str_method = class_.GetSpecialMethod(SpecialMethod::Str)) {
+    if (auto str_holder = Call(*str_method, {})) {
       str_holder.Get()->Print(os);
     }
   } else {
@@ -22,6 +26,12 @@ ClassInstance::Print(std::ostream& os)
   }
 }
 
+void
+ClassInstance::Traverse(const std::function<void(ObjectHolder&)>& visit)
+{
+  fields_.ForEach(visit);
+}
+
 bool
 ClassInstance::HasMethod(const std::string& method, size_t argument_count) const
 {
@@ -31,22 +41,28 @@ ClassInstance::HasMethod(const std::string& method, size_t argument_count) const
   return false;
 }
 
-const Closure&
+const FieldTable&
 ClassInstance::Fields() const
 {
-  return closure_;
+  return fields_;
 }
 
-Closure&
+FieldTable&
 ClassInstance::Fields()
 {
-  return closure_;
+  return fields_;
 }
 
 ClassInstance::ClassInstance(const Class& cls)
   : class_(cls)
 {}
 
+const Class&
+ClassInstance::GetClass() const
+{
+  return class_;
+}
+
 ObjectHolder
 ClassInstance::Call(const std::string& method, const std::vector<ObjectHolder>& actual_args)
 {
@@ -54,15 +70,43 @@ ClassInstance::Call(const std::string& method, const std::vector<ObjectHolder>&
   if (!method_func || method_func->formal_params.size() != actual_args.size()) {
     return ObjectHolder();
   }
+  return Call(*method_func, actual_args);
+}
+
+ObjectHolder
+ClassInstance::Call(const Method& method, const std::vector<ObjectHolder>& actual_args)
+{
+  const ProfiledCall profiled(class_, method);
+
+  if (method.code) {
+    std::vector<ObjectHolder> args;
+    args.reserve(actual_args.size() + 1);
+    args.push_back(ObjectHolder::Share(*this));
+    args.insert(end(args), begin(actual_args), end(actual_args));
+    return Bytecode::Execute(*method.code, args.data(), args.size());
+  }
+
+  if (method.frame_size) {
+    Frame frame(method.frame_size);
+    frame.slots[0] = ObjectHolder::Share(*this);
+    std::copy(begin(actual_args), end(actual_args), begin(frame.slots) + 1);
+    return method.body->Run(frame).value;
+  }
 
   Closure method_closure;
   method_closure["self"] = ObjectHolder::Share(*this);
   for (unsigned i = 0; i < actual_args.size(); ++i) {
-    method_closure[method_func->formal_params[i]] = actual_args[i];
+    method_closure[method.formal_params[i]] = actual_args[i];
   }
-  return method_func->body->Execute(method_closure);
+  return method.body->Run(method_closure).value;
 }
 
+Method::Method(std::string name, std::vector<std::string> formal_params, std::unique_ptr<Ast::Statement> body)
+  : name(std::move(name))
+  , formal_params(std::move(formal_params))
+  , body(std::move(body))
+{}
+
 Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
   : name_(std::move(name))
   , methods_(std::move(methods))
@@ -80,6 +124,22 @@ Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
       vtable_[method.name] = &method;
     }
   }
+
+  // only the methods with the arguments Mython passes are called
+  static const std::pair<std::string, size_t> special_methods[] = {
+    { "__init__", static_cast<size_t>(-1) },
+    { "__str__", 0 },
+    { "__add__", 1 },
+  };
+  static_assert(std::size(special_methods) == static_cast<size_t>(SpecialMethod::Count));
+  for (size_t i = 0; i < special_methods_.size(); ++i) {
+    const auto& [name, argument_count] = special_methods[i];
+    const Method* method = GetMethod(name);
+    if (method && argument_count != static_cast<size_t>(-1) && method->formal_params.size() != argument_count) {
+      method = nullptr;
+    }
+    special_methods_[i] = method;
+  }
 }
 
 const Method*
@@ -89,6 +149,12 @@ Class::GetMethod(const std::string& name) const
   return it != std::end(vtable_) ? it->second : nullptr;
 }
 
+const Method*
+Class::GetSpecialMethod(SpecialMethod method) const
+{
+  return special_methods_[static_cast<size_t>(method)];
+}
+
 void
 Class::Print(ostream& os)
 {
@@ -101,6 +167,105 @@ Class::GetName() const
   return name_;
 }
 
+std::vector<Method>&
+Class::GetMethods()
+{
+  return methods_;
+}
+
+Symbol
+Intern(std::string_view name)
+{
+  static std::unordered_map<std::string, Symbol> symbols;
+  if (auto it = symbols.find(std::string(name)); it != std::end(symbols)) {
+    return it->second;
+  }
+  const auto symbol = static_cast<Symbol>(symbols.size());
+  symbols.emplace(name, symbol);
+  return symbol;
+}
+
+const Shape&
+Shape::Empty()
+{
+  static const Shape empty;
+  return empty;
+}
+
+uint32_t
+Shape::Find(Symbol symbol) const
+{
+  auto it = offsets_.find(symbol);
+  return it != std::end(offsets_) ? it->second : npos;
+}
+
+const Shape&
+Shape::With(Symbol symbol) const
+{
+  auto& shape = transitions_[symbol];
+  if (!shape) {
+    shape = std::make_unique<Shape>();
+    shape->offsets_ = offsets_;
+    shape->offsets_.emplace(symbol, static_cast<uint32_t>(Size()));
+  }
+  return *shape;
+}
+
+ObjectHolder&
+FieldTable::operator[](Symbol symbol)
+{
+  auto offset = shape_->Find(symbol);
+  if (offset == Shape::npos) {
+    offset = static_cast<uint32_t>(values_.size());
+    Extend(shape_->With(symbol));
+  }
+  return values_[offset];
+}
+
+ObjectHolder*
+FieldTable::Find(std::string_view name)
+{
+  const auto offset = shape_->Find(Intern(name));
+  return offset != Shape::npos ? &values_[offset] : nullptr;
+}
+
+const ObjectHolder*
+FieldTable::Find(std::string_view name) const
+{
+  return const_cast<FieldTable*>(this)->Find(name);
+}
+
+ObjectHolder&
+FieldTable::at(std::string_view name)
+{
+  if (auto field = Find(name)) {
+    return *field;
+  }
+  throw std::out_of_range("no field " + std::string(name));
+}
+
+const ObjectHolder&
+FieldTable::at(std::string_view name) const
+{
+  return const_cast<FieldTable*>(this)->at(name);
+}
+
+void
+FieldTable::Extend(const Shape& shape)
+{
+  shape_ = &shape;
+  values_.resize(shape.Size());
+}
+
+const Method*
+MethodCache::Add(const Class& cls, const std::string& name)
+{
+  const Method* method = cls.GetMethod(name);
+  entries_[next_] = { &cls, method };
+  next_ = (next_ + 1) % entries_.size();
+  return method;
+}
+
 void
 Bool::Print(std::ostream& os)
 {
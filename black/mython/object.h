@@ -2,9 +2,13 @@
 
 #include "object_holder.h"
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -12,48 +16,126 @@ namespace Ast {
 struct Statement;
 }
 
+namespace Bytecode {
+struct Function;
+}
+
 class TestRunner;
 
 namespace Runtime {
 
-class Object
+struct Method
 {
-public:
-  virtual ~Object() = default;
-  virtual void Print(std::ostream& os) = 0;
+  Method() = default;
+  // the members past the body are filled in by the passes over the program
+  Method(std::string name, std::vector<std::string> formal_params, std::unique_ptr<Ast::Statement> body);
+
+  std::string name;
+  std::vector<std::string> formal_params;
+  std::unique_ptr<Ast::Statement> body;
+
+  // slots of the frame of a resolved body: self, formal_params and then the
+  // local variables. The body which has not been resolved is run on a closure
+  size_t frame_size = 0;
+  // the body compiled for the VM, if the program has been
+  std::shared_ptr<const Bytecode::Function> code;
+  // line of the def in the source, from 1, or 0 if the method was not parsed
+  size_t line = 0;
 };
 
-template<typename T>
-class ValueObject : public Object
+// Field names are interned, equal names get the same symbol
+using Symbol = uint32_t;
+
+Symbol
+Intern(std::string_view name);
+
+// Layout of the fields of instances: the offsets of the fields by their
+// symbols. Instances which got the same fields in the same order share a
+// shape, a new field makes the transition to the shape with it appended
+class Shape
 {
 public:
-  ValueObject(T v)
-    : value_(v)
-  {}
+  static constexpr uint32_t npos = static_cast<uint32_t>(-1);
 
-  void Print(std::ostream& os) override { os << value_; }
+  // Shape of instances without fields
+  static const Shape& Empty();
 
-  const T& GetValue() const { return value_; }
+  // Offset of the field or npos
+  uint32_t Find(Symbol symbol) const;
+  // Shape with the field appended, the same for every call
+  const Shape& With(Symbol symbol) const;
+  size_t Size() const { return offsets_.size(); }
 
 private:
-  T value_;
+  std::unordered_map<Symbol, uint32_t> offsets_;
+  mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions_;
 };
 
-using String = ValueObject<std::string>;
-using Number = ValueObject<int>;
+// Fields of an instance, laid out by its shape
+class FieldTable
+{
+public:
+  // Adds a None field if there is no such one yet
+  ObjectHolder& operator[](Symbol symbol);
+
+  // Field by the name or nullptr
+  ObjectHolder* Find(std::string_view name);
+  const ObjectHolder* Find(std::string_view name) const;
+
+  // Throws std::out_of_range if there is no such field
+  ObjectHolder& at(std::string_view name);
+  const ObjectHolder& at(std::string_view name) const;
+
+  const Shape& GetShape() const { return *shape_; }
+  ObjectHolder& AtOffset(uint32_t offset) { return values_[offset]; }
+  // Moves to the shape which extends the current one by None fields
+  void Extend(const Shape& shape);
+
+  template<typename Visitor>
+  void ForEach(Visitor&& visit)
+  {
+    for (auto& value : values_) {
+      visit(value);
+    }
+  }
+
+private:
+  const Shape* shape_ = &Shape::Empty();
+  std::vector<ObjectHolder> values_;
+};
 
-class Bool : public ValueObject<bool>
+// Inline cache of a field access site: the offset of the field in the shape
+// of the last instance, and the shape the instance moves to if the access
+// adds the field
+class FieldCache
 {
 public:
-  using ValueObject<bool>::ValueObject;
-  void Print(std::ostream& os) override;
+  ObjectHolder& Get(FieldTable& fields, Symbol symbol)
+  {
+    if (&fields.GetShape() != from_) {
+      from_ = &fields.GetShape();
+      fields[symbol];
+      to_ = &fields.GetShape();
+      offset_ = to_->Find(symbol);
+    } else if (from_ != to_) {
+      fields.Extend(*to_);
+    }
+    return fields.AtOffset(offset_);
+  }
+
+private:
+  const Shape* from_ = nullptr;
+  const Shape* to_ = nullptr;
+  uint32_t offset_ = 0;
 };
 
-struct Method
+// Methods Mython calls implicitly
+enum class SpecialMethod
 {
-  std::string name;
-  std::vector<std::string> formal_params;
-  std::unique_ptr<Ast::Statement> body;
+  Init,
+  Str,
+  Add,
+  Count
 };
 
 class Class : public Object
@@ -61,7 +143,11 @@ class Class : public Object
 public:
   explicit Class(std::string name, std::vector<Method> methods, const Class* parent);
   const Method* GetMethod(const std::string& name) const;
+  // Resolved once for the class
+  const Method* GetSpecialMethod(SpecialMethod method) const;
   const std::string& GetName() const;
+  // Own methods of the class, without inherited ones
+  std::vector<Method>& GetMethods();
   void Print(std::ostream& os) override;
 
 private:
@@ -69,24 +155,58 @@ private:
   std::vector<Method> methods_;
   const Class* parent_ = nullptr;
   std::unordered_map<std::string, const Method*> vtable_;
+  std::array<const Method*, static_cast<size_t>(SpecialMethod::Count)> special_methods_;
+};
+
+// Inline cache of a call site: the methods the name resolved to in the classes
+// of the last instances the site was called on. A site which sees one class
+// is monomorphic, one which sees more than fit evicts the oldest entries
+class MethodCache
+{
+public:
+  const Method* Find(const Class& cls, const std::string& name)
+  {
+    for (const auto& entry : entries_) {
+      if (entry.cls == &cls) {
+        return entry.method;
+      }
+    }
+    return Add(cls, name);
+  }
+
+private:
+  const Method* Add(const Class& cls, const std::string& name);
+
+  struct Entry
+  {
+    const Class* cls = nullptr;
+    const Method* method = nullptr;
+  };
+
+  std::array<Entry, 4> entries_;
+  size_t next_ = 0;
 };
 
-class ClassInstance : public Object
+class ClassInstance : public Container
 {
 public:
   explicit ClassInstance(const Class& cls);
 
   void Print(std::ostream& os) override;
+  void Traverse(const std::function<void(ObjectHolder&)>& visit) override;
 
   ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args);
+  // The method must be of the class and take as many arguments
+  ObjectHolder Call(const Method& method, const std::vector<ObjectHolder>& actual_args);
   bool HasMethod(const std::string& method, size_t argument_count) const;
+  const Class& GetClass() const;
 
-  Closure& Fields();
-  const Closure& Fields() const;
+  FieldTable& Fields();
+  const FieldTable& Fields() const;
 
 private:
   const Class& class_;
-  Closure closure_;
+  FieldTable fields_;
 };
 
 void
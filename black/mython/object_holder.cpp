@@ -1,70 +1,161 @@
 #include "object_holder.h"
 #include "object.h"
 
+#include <algorithm>
+
 namespace Runtime {
 
 ObjectHolder
 ObjectHolder::Share(Object& object)
 {
-  return ObjectHolder(std::shared_ptr<Object>(&object, [](auto*) { /* do nothing */ }));
+  // aliases an empty owner, so nothing is allocated and nothing is deleted
+  ObjectHolder holder;
+  holder.tag_ = Tag::Object;
+  new (&holder.data_) std::shared_ptr<Object>(std::shared_ptr<Object>(), &object);
+  return holder;
 }
 
 ObjectHolder
-ObjectHolder::None()
+ObjectHolder::Share(Container& container)
 {
-  return ObjectHolder();
+  std::shared_ptr<Object> owner = container.weak_from_this().lock();
+  if (!owner) {
+    return Share(static_cast<Object&>(container));
+  }
+  ObjectHolder holder;
+  new (&holder.data_) std::shared_ptr<Object>(std::move(owner));
+  holder.tag_ = Tag::Object;
+  return holder;
 }
 
-Object& ObjectHolder::operator*()
+ObjectHolder
+ObjectHolder::None()
 {
-  return *Get();
+  return ObjectHolder();
 }
 
-const Object& ObjectHolder::operator*() const
+bool
+IsTrue(ObjectHolder object)
 {
-  return *Get();
+  if (auto condition_bool = object.TryAs<Bool>()) {
+    return condition_bool->GetValue();
+  } else if (auto condition_num = object.TryAs<Number>()) {
+    return condition_num->GetValue() != 0;
+  } else if (auto condition_str = object.TryAs<String>()) {
+    return !condition_str->GetValue().empty();
+  } else if (auto condition_obj = object.TryAs<ClassInstance>()) {
+    return true;
+  }
+  return false;
 }
 
-Object* ObjectHolder::operator->()
+Heap::Heap()
+  : previous_(current_)
 {
-  return Get();
+  current_ = this;
 }
 
-const Object* ObjectHolder::operator->() const
+Heap::~Heap()
 {
-  return Get();
+  Collect();
+  // the objects which are still alive are not in the heap any more
+  for (Container* container : containers_) {
+    container->heap_ = nullptr;
+  }
+  current_ = previous_;
 }
 
-Object*
-ObjectHolder::Get()
+void
+Heap::Track(Container& container)
 {
-  return data_.get();
+  container.heap_ = this;
+  container.heap_index_ = containers_.size();
+  containers_.push_back(&container);
+  if (containers_.size() >= collection_threshold_) {
+    Collect();
+  }
 }
 
-const Object*
-ObjectHolder::Get() const
+void
+Heap::Untrack(Container& container)
 {
-  return data_.get();
+  Container* const last = containers_.back();
+  containers_[container.heap_index_] = last;
+  last->heap_index_ = container.heap_index_;
+  containers_.pop_back();
+  container.heap_ = nullptr;
 }
 
-ObjectHolder::operator bool() const
+size_t
+Heap::Collect()
 {
-  return Get();
+  ++stats_.collections;
+
+  auto find_index = [this](const ObjectHolder& holder) {
+    auto container = holder.TryAs<Container>();
+    return container && container->heap_ == this ? container->heap_index_ : containers_.size();
+  };
+
+  // what is left of the counts after the references of the containers to
+  // each other are taken away are references from the outside: variables,
+  // the stack of the VM and the interpreter itself
+  std::vector<long> external_counts(containers_.size());
+  for (size_t i = 0; i < containers_.size(); ++i) {
+    external_counts[i] = containers_[i]->weak_from_this().use_count();
+  }
+  for (Container* container : containers_) {
+    container->Traverse([&](ObjectHolder& holder) {
+      if (const size_t index = find_index(holder); index < containers_.size() && holder.IsOwner()) {
+        --external_counts[index];
+      }
+    });
+  }
+
+  // containers referenced from the outside are alive, as well as everything
+  // they reach
+  std::vector<bool> is_alive(containers_.size());
+  std::vector<size_t> to_visit;
+  for (size_t i = 0; i < containers_.size(); ++i) {
+    if (external_counts[i] > 0) {
+      is_alive[i] = true;
+      to_visit.push_back(i);
+    }
+  }
+  while (!to_visit.empty()) {
+    const size_t i = to_visit.back();
+    to_visit.pop_back();
+    containers_[i]->Traverse([&](ObjectHolder& holder) {
+      if (const size_t index = find_index(holder); index < containers_.size() && !is_alive[index]) {
+        is_alive[index] = true;
+        to_visit.push_back(index);
+      }
+    });
+  }
+
+  // the rest are cycles, they are kept until all their references are
+  // dropped
+  std::vector<std::shared_ptr<Container>> garbage;
+  for (size_t i = 0; i < containers_.size(); ++i) {
+    if (!is_alive[i]) {
+      garbage.push_back(containers_[i]->shared_from_this());
+    }
+  }
+  for (const auto& container : garbage) {
+    container->Traverse([](ObjectHolder& holder) { holder = ObjectHolder::None(); });
+  }
+  const size_t collected = garbage.size();
+  garbage.clear();
+
+  stats_.collected_objects += collected;
+  collection_threshold_ = std::max(kMinCollectionThreshold, 2 * containers_.size());
+  return collected;
 }
 
-bool
-IsTrue(ObjectHolder object)
+Container::~Container()
 {
-  if (auto condition_bool = object.TryAs<Bool>()) {
-    return condition_bool->GetValue();
-  } else if (auto condition_num = object.TryAs<Number>()) {
-    return condition_num->GetValue() != 0;
-  } else if (auto condition_str = object.TryAs<String>()) {
-    return !condition_str->GetValue().empty();
-  } else if (auto condition_obj = object.TryAs<ClassInstance>()) {
-    return true;
+  if (heap_) {
+    heap_->Untrack(*this);
   }
-  return false;
 }
 
-}
+} /* namespace Runtime */
@@ -1,60 +1,400 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <new>
+#include <ostream>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 class TestRunner;
 
 namespace Runtime {
 
-class Object;
+class Object
+{
+public:
+  virtual ~Object() = default;
+  virtual void Print(std::ostream& os) = 0;
+};
+
+template<typename T>
+class ValueObject : public Object
+{
+public:
+  ValueObject(T v)
+    : value_(v)
+  {}
+
+  void Print(std::ostream& os) override { os << value_; }
+
+  const T& GetValue() const { return value_; }
+
+private:
+  T value_;
+};
+
+using String = ValueObject<std::string>;
+using Number = ValueObject<int>;
+
+class Bool : public ValueObject<bool>
+{
+public:
+  using ValueObject<bool>::ValueObject;
+  void Print(std::ostream& os) override;
+};
+
+class Container;
+class Heap;
 
+// Numbers and bools are kept inline and their types are told by the tag, other
+// objects are held by pointers
 class ObjectHolder
 {
 public:
-  ObjectHolder() = default;
+  ObjectHolder() {}
+  ObjectHolder(const ObjectHolder& other) { CopyFrom(other); }
+  ObjectHolder(ObjectHolder&& other) noexcept { MoveFrom(other); }
+  ~ObjectHolder() { Reset(); }
 
-  template<typename T>
-  static ObjectHolder Own(T&& object)
+  ObjectHolder& operator=(const ObjectHolder& other)
+  {
+    if (this != &other) {
+      Reset();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
+  ObjectHolder& operator=(ObjectHolder&& other) noexcept
   {
-    return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+    if (this != &other) {
+      Reset();
+      MoveFrom(other);
+    }
+    return *this;
   }
 
+  // Objects other than numbers and bools are allocated in the current heap,
+  // if there is one
+  template<typename T>
+  static ObjectHolder Own(T&& object);
+
   static ObjectHolder Share(Object& object);
+  // Shares the ownership of the container if a holder owns it
+  static ObjectHolder Share(Container& container);
   static ObjectHolder None();
 
-  Object& operator*();
-  const Object& operator*() const;
-  Object* operator->();
-  const Object* operator->() const;
+  Object& operator*() { return *Get(); }
+  const Object& operator*() const { return *Get(); }
+  Object* operator->() { return Get(); }
+  const Object* operator->() const { return Get(); }
 
-  Object* Get();
-  const Object* Get() const;
+  Object* Get() { return const_cast<Object*>(std::as_const(*this).Get()); }
+
+  const Object* Get() const
+  {
+    switch (tag_) {
+      case Tag::Number:
+        return &number_;
+      case Tag::Bool:
+        return &bool_;
+      case Tag::Object:
+        return data_.get();
+      default:
+        return nullptr;
+    }
+  }
 
   template<typename T>
   T* TryAs()
   {
-    return dynamic_cast<T*>(this->Get());
+    return const_cast<T*>(std::as_const(*this).template TryAs<T>());
   }
 
   template<typename T>
   const T* TryAs() const
   {
-    return dynamic_cast<const T*>(this->Get());
+    switch (tag_) {
+      case Tag::Number:
+        if constexpr (std::is_base_of_v<T, Number>) {
+          return &number_;
+        }
+        return nullptr;
+      case Tag::Bool:
+        if constexpr (std::is_base_of_v<T, Bool>) {
+          return &bool_;
+        }
+        return nullptr;
+      case Tag::Object:
+        return dynamic_cast<const T*>(data_.get());
+      default:
+        return nullptr;
+    }
   }
 
-  explicit operator bool() const;
+  explicit operator bool() const { return tag_ != Tag::None; }
+
+  // Whether the holder shares the ownership of its heap object, a shared
+  // object is only referenced
+  bool IsOwner() const { return tag_ == Tag::Object && data_.use_count() > 0; }
 
 private:
-  ObjectHolder(std::shared_ptr<Object> data)
-    : data_(std::move(data))
-  {}
+  enum class Tag : uint8_t
+  {
+    None,
+    Number,
+    Bool,
+    Object
+  };
+
+  // Inline values are immutable and their destructors do nothing, so they are
+  // left without being destroyed
+  void Reset()
+  {
+    if (tag_ == Tag::Object) {
+      data_.~shared_ptr();
+    }
+    tag_ = Tag::None;
+  }
+
+  void CopyFrom(const ObjectHolder& other)
+  {
+    switch (other.tag_) {
+      case Tag::Number:
+        new (&number_) Number(other.number_);
+        break;
+      case Tag::Bool:
+        new (&bool_) Bool(other.bool_);
+        break;
+      case Tag::Object:
+        new (&data_) std::shared_ptr<Object>(other.data_);
+        break;
+      default:
+        break;
+    }
+    tag_ = other.tag_;
+  }
+
+  void MoveFrom(ObjectHolder& other)
+  {
+    if (other.tag_ == Tag::Object) {
+      new (&data_) std::shared_ptr<Object>(std::move(other.data_));
+      tag_ = Tag::Object;
+      other.Reset();
+    } else {
+      CopyFrom(other);
+      other.tag_ = Tag::None;
+    }
+  }
 
-  std::shared_ptr<Object> data_;
+  union
+  {
+    Number number_;
+    Bool bool_;
+    std::shared_ptr<Object> data_;
+  };
+  Tag tag_ = Tag::None;
 };
 
 using Closure = std::unordered_map<std::string, ObjectHolder>;
 
+// Variables of a resolved method call or program, laid out in slots by the
+// resolver
+struct Frame
+{
+  explicit Frame(size_t size)
+    : slots(size)
+  {}
+
+  std::vector<ObjectHolder> slots;
+};
+
+// Variables a statement is executed on: the frame if the statement has been
+// resolved, otherwise the closure where variables are looked up by names
+struct Scope
+{
+  Scope(Closure& closure)
+    : closure(&closure)
+  {}
+
+  Scope(Frame& frame)
+    : frame(&frame)
+  {}
+
+  Closure* closure = nullptr;
+  Frame* frame = nullptr;
+};
+
+// Object which keeps other objects. Cycles of containers cannot be freed by
+// reference counting, the heap traverses containers to collect them
+class Container
+  : public Object
+  , public std::enable_shared_from_this<Container>
+{
+public:
+  Container() = default;
+  // the copy is tracked once it is owned in a heap
+  Container(const Container&)
+    : Object()
+    , std::enable_shared_from_this<Container>()
+  {}
+  Container& operator=(const Container&) = delete;
+  ~Container() override;
+
+  // Calls the visitor for every holder the container keeps
+  virtual void Traverse(const std::function<void(ObjectHolder&)>& visit) = 0;
+
+private:
+  friend class Heap;
+
+  Heap* heap_ = nullptr;
+  size_t heap_index_ = 0;
+};
+
+struct HeapStats
+{
+  // objects allocated in the heap and not freed yet, the bytes include their
+  // reference counts
+  size_t live_objects = 0;
+  size_t live_bytes = 0;
+  // objects allocated since the heap was made
+  size_t allocated_objects = 0;
+  size_t collections = 0;
+  // containers freed by the collections
+  size_t collected_objects = 0;
+};
+
+// Heap of the objects an interpreter makes. Objects are freed by reference
+// counting, and once enough containers have been made since the last
+// collection the cycles of them nothing outside refers to are found by trial
+// deletion and freed. The heap is current from its construction to its
+// destruction, and it must outlive the objects made in it
+class Heap
+{
+public:
+  Heap();
+  ~Heap();
+
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  // nullptr if there is no heap
+  static Heap* GetCurrent() { return current_; }
+
+  // Returns the number of containers freed
+  size_t Collect();
+  const HeapStats& GetStats() const { return stats_; }
+
+  void OnAllocate(size_t bytes)
+  {
+    ++stats_.live_objects;
+    ++stats_.allocated_objects;
+    stats_.live_bytes += bytes;
+  }
+
+  void OnDeallocate(size_t bytes)
+  {
+    --stats_.live_objects;
+    stats_.live_bytes -= bytes;
+  }
+
+  // The container must be owned by a holder
+  void Track(Container& container);
+
+private:
+  friend class Container;
+
+  static constexpr size_t kMinCollectionThreshold = 1024;
+
+  void Untrack(Container& container);
+
+  inline static Heap* current_ = nullptr;
+  Heap* const previous_;
+
+  std::vector<Container*> containers_;
+  size_t collection_threshold_ = kMinCollectionThreshold;
+  HeapStats stats_;
+};
+
+// Counts the memory of the objects in the heap
+template<typename T>
+class HeapAllocator
+{
+public:
+  using value_type = T;
+
+  explicit HeapAllocator(Heap& heap)
+    : heap_(&heap)
+  {}
+
+  template<typename U>
+  HeapAllocator(const HeapAllocator<U>& other)
+    : heap_(other.heap_)
+  {}
+
+  T* allocate(size_t n)
+  {
+    T* result = std::allocator<T>().allocate(n);
+    heap_->OnAllocate(n * sizeof(T));
+    return result;
+  }
+
+  void deallocate(T* p, size_t n)
+  {
+    heap_->OnDeallocate(n * sizeof(T));
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template<typename U>
+  bool operator==(const HeapAllocator<U>& other) const
+  {
+    return heap_ == other.heap_;
+  }
+
+  template<typename U>
+  bool operator!=(const HeapAllocator<U>& other) const
+  {
+    return heap_ != other.heap_;
+  }
+
+private:
+  template<typename U>
+  friend class HeapAllocator;
+
+  Heap* heap_;
+};
+
+template<typename T>
+ObjectHolder
+ObjectHolder::Own(T&& object)
+{
+  using Type = std::decay_t<T>;
+  ObjectHolder holder;
+  if constexpr (std::is_same_v<Type, Number>) {
+    new (&holder.number_) Number(object);
+    holder.tag_ = Tag::Number;
+  } else if constexpr (std::is_same_v<Type, Bool>) {
+    new (&holder.bool_) Bool(object);
+    holder.tag_ = Tag::Bool;
+  } else if (Heap* heap = Heap::GetCurrent()) {
+    auto data = std::allocate_shared<Type>(HeapAllocator<Type>(*heap), std::forward<T>(object));
+    if constexpr (std::is_base_of_v<Container, Type>) {
+      heap->Track(*data);
+    }
+    new (&holder.data_) std::shared_ptr<Object>(std::move(data));
+    holder.tag_ = Tag::Object;
+  } else {
+    new (&holder.data_) std::shared_ptr<Object>(std::make_shared<Type>(std::forward<T>(object)));
+    holder.tag_ = Tag::Object;
+  }
+  return holder;
+}
+
 bool
 IsTrue(ObjectHolder object);
 
@@ -1,5 +1,6 @@
 #include "object.h"
 #include "object_holder.h"
+#include "statement.h"
 
 #include <test_runner.h>
 
@@ -118,6 +119,78 @@ TestNullptr()
   ASSERT(!oh.Get());
 }
 
+void
+TestInlineValues()
+{
+  auto number = ObjectHolder::Own(Number(42));
+  ASSERT(number);
+  ASSERT_EQUAL(number.TryAs<Number>()->GetValue(), 42);
+  ASSERT(!number.TryAs<Bool>());
+  ASSERT(!number.TryAs<String>());
+  ASSERT(number.TryAs<Object>() == number.Get());
+
+  auto copy = number;
+  ASSERT_EQUAL(copy.TryAs<Number>()->GetValue(), 42);
+  auto moved = std::move(number);
+  ASSERT_EQUAL(moved.TryAs<Number>()->GetValue(), 42);
+  ASSERT(!number);
+
+  auto flag = ObjectHolder::Own(Bool(true));
+  ASSERT(flag.TryAs<Bool>()->GetValue());
+  ASSERT(flag.TryAs<ValueObject<bool>>()->GetValue());
+  ASSERT(!flag.TryAs<Number>());
+
+  ostringstream os;
+  number = flag;
+  number->Print(os);
+  copy->Print(os);
+  ASSERT_EQUAL(os.str(), "True42");
+
+  Number shared(7);
+  ASSERT(ObjectHolder::Share(shared).TryAs<Number>() == &shared);
+}
+
+void
+TestHeapCollectsCycles()
+{
+  Class cls("Node", {}, nullptr);
+  const Symbol other = Intern("other"), name = Intern("name");
+
+  Heap heap;
+  ObjectHolder root = ObjectHolder::Own(ClassInstance(cls));
+  {
+    auto a = ObjectHolder::Own(ClassInstance(cls));
+    auto b = ObjectHolder::Own(ClassInstance(cls));
+    a.TryAs<ClassInstance>()->Fields()[other] = b;
+    a.TryAs<ClassInstance>()->Fields()[name] = ObjectHolder::Own(String("a"));
+    b.TryAs<ClassInstance>()->Fields()[other] = a;
+    ASSERT(ObjectHolder::Share(*a.TryAs<ClassInstance>()).IsOwner());
+
+    // the cycle is referenced from the outside
+    ASSERT_EQUAL(heap.Collect(), 0u);
+    ASSERT_EQUAL(heap.GetStats().live_objects, 4u);
+
+    auto c = ObjectHolder::Own(ClassInstance(cls));
+    c.TryAs<ClassInstance>()->Fields()[other] = a;
+    root.TryAs<ClassInstance>()->Fields()[other] = c;
+  }
+  // reachable from the root
+  ASSERT_EQUAL(heap.Collect(), 0u);
+  ASSERT_EQUAL(heap.GetStats().live_objects, 5u);
+
+  root.TryAs<ClassInstance>()->Fields()[other] = ObjectHolder::None();
+  // c is freed by reference counting, the cycle is not
+  ASSERT_EQUAL(heap.GetStats().live_objects, 4u);
+  ASSERT_EQUAL(heap.Collect(), 2u);
+  ASSERT_EQUAL(heap.GetStats().live_objects, 1u);
+  ASSERT_EQUAL(heap.GetStats().collected_objects, 2u);
+
+  root = ObjectHolder::None();
+  ASSERT_EQUAL(heap.GetStats().live_objects, 0u);
+  ASSERT_EQUAL(heap.GetStats().live_bytes, 0u);
+  ASSERT_EQUAL(heap.GetStats().collections, 3u);
+}
+
 void
 RunObjectHolderTests(TestRunner& tr)
 {
@@ -125,6 +198,8 @@ RunObjectHolderTests(TestRunner& tr)
   RUN_TEST(tr, Runtime::TestOwning);
   RUN_TEST(tr, Runtime::TestMove);
   RUN_TEST(tr, Runtime::TestNullptr);
+  RUN_TEST(tr, Runtime::TestInlineValues);
+  RUN_TEST(tr, Runtime::TestHeapCollectsCycles);
 }
 
 } /* namespace Runtime */
@@ -132,6 +132,82 @@ TestInheritance()
   ASSERT(!cls.GetMethod("AsStringValue"));
 }
 
+void
+TestShapes()
+{
+  const Symbol x = Intern("x"), y = Intern("y");
+
+  FieldTable first, second;
+  first[x] = ObjectHolder::Own(Number(1));
+  first[y] = ObjectHolder::Own(Number(2));
+  second[x] = ObjectHolder::Own(Number(3));
+  second[y];
+  ASSERT(&first.GetShape() == &second.GetShape());
+  ASSERT_EQUAL(first.GetShape().Size(), 2u);
+  ASSERT_EQUAL(first.GetShape().Find(y), 1u);
+  ASSERT(!second.at("y"));
+
+  FieldTable swapped;
+  swapped[y];
+  swapped[x];
+  ASSERT(&swapped.GetShape() != &first.GetShape());
+  ASSERT_EQUAL(swapped.GetShape().Find(y), 0u);
+  ASSERT(!swapped.Find("z"));
+
+  // the cache reads by the offset and adds the field to instances which
+  // have not got it yet
+  FieldCache cache;
+  ASSERT_EQUAL(cache.Get(first, y).TryAs<Number>()->GetValue(), 2);
+  ASSERT_EQUAL(cache.Get(second, y).Get(), nullptr);
+  FieldTable third;
+  third[x];
+  cache.Get(third, y) = ObjectHolder::Own(Number(4));
+  FieldTable fourth;
+  fourth[x];
+  cache.Get(fourth, y) = ObjectHolder::Own(Number(5));
+  ASSERT(&fourth.GetShape() == &first.GetShape());
+  ASSERT_EQUAL(third.at("y").TryAs<Number>()->GetValue(), 4);
+  ASSERT_EQUAL(fourth.at("y").TryAs<Number>()->GetValue(), 5);
+}
+
+void
+TestMethodCache()
+{
+  vector<Method> methods;
+  methods.push_back({ "area", {}, make_unique<Ast::NumericConst>(1) });
+  methods.push_back({ "__str__", {}, make_unique<Ast::StringConst>("shape"s) });
+  Class base("Shape", std::move(methods), nullptr);
+
+  methods.clear();
+  methods.push_back({ "area", {}, make_unique<Ast::NumericConst>(4) });
+  methods.push_back({ "__str__", { "x" }, make_unique<Ast::StringConst>("square"s) });
+  Class derived("Square", std::move(methods), &base);
+
+  // more classes than the cache keeps, so the site turns megamorphic
+  vector<unique_ptr<Class>> others;
+  for (int i = 0; i < 5; ++i) {
+    others.push_back(make_unique<Class>("Other" + to_string(i), vector<Method>{}, &base));
+  }
+
+  MethodCache cache;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT(cache.Find(base, "area") == base.GetMethod("area"));
+    ASSERT(cache.Find(derived, "area") == derived.GetMethod("area"));
+    ASSERT(cache.Find(derived, "area") != base.GetMethod("area"));
+    for (const auto& other : others) {
+      ASSERT(cache.Find(*other, "area") == base.GetMethod("area"));
+    }
+  }
+  MethodCache missing;
+  ASSERT(!missing.Find(base, "perimeter"));
+  ASSERT(!missing.Find(base, "perimeter"));
+
+  ASSERT(base.GetSpecialMethod(SpecialMethod::Str) == base.GetMethod("__str__"));
+  // __str__ with an argument is not the one print calls
+  ASSERT(!derived.GetSpecialMethod(SpecialMethod::Str));
+  ASSERT(!derived.GetSpecialMethod(SpecialMethod::Init));
+}
+
 void
 RunObjectsTests(TestRunner& tr)
 {
@@ -140,6 +216,8 @@ RunObjectsTests(TestRunner& tr)
   RUN_TEST(tr, Runtime::TestFields);
   RUN_TEST(tr, Runtime::TestBaseClass);
   RUN_TEST(tr, Runtime::TestInheritance);
+  RUN_TEST(tr, Runtime::TestShapes);
+  RUN_TEST(tr, Runtime::TestMethodCache);
 }
 
 } /* namespace Runtime */
@@ -0,0 +1,111 @@
+#include "operations.h"
+#include "object.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+
+template<typename... Args>
+struct ArithmeticOp
+{};
+
+template<typename T, typename... Args>
+struct ArithmeticOp<T, Args...>
+{
+  template<typename Op>
+  static ObjectHolder _(const ObjectHolder& lhs, const ObjectHolder& rhs, Op op)
+  {
+    auto lhs_val = lhs.TryAs<ValueObject<T>>();
+    auto rhs_val = rhs.TryAs<ValueObject<T>>();
+    if (lhs_val && rhs_val) {
+      auto res = op(lhs_val->GetValue(), rhs_val->GetValue());
+      return ObjectHolder::Own(ValueObject<T>(res));
+    }
+    return ArithmeticOp<Args...>::_(lhs, rhs, op);
+  }
+};
+
+template<>
+struct ArithmeticOp<>
+{
+  template<typename Op>
+  static ObjectHolder _(const ObjectHolder&, const ObjectHolder&, Op)
+  {
+    throw runtime_error("invalid binary operation");
+  }
+};
+
+template<typename T>
+struct ArithmeticOp<T>
+{
+  template<typename Op>
+  static ObjectHolder _(const ObjectHolder& lhs, const ObjectHolder& rhs, Op op)
+  {
+    auto lhs_val = lhs.TryAs<ValueObject<T>>();
+    auto rhs_val = rhs.TryAs<ValueObject<T>>();
+    if (!lhs_val || !rhs_val) {
+      throw runtime_error("invalid binary operation");
+    }
+    auto res = op(lhs_val->GetValue(), rhs_val->GetValue());
+    return ObjectHolder::Own(ValueObject<T>(res));
+  }
+};
+
+} // namespace
+
+ObjectHolder
+Add(ObjectHolder lhs, ObjectHolder rhs)
+{
+  if (auto lhs_inst = lhs.TryAs<ClassInstance>()) {
+    if (auto add_method = lhs_inst->GetClass().GetSpecialMethod(SpecialMethod::Add)) {
+      return lhs_inst->Call(*add_method, { rhs });
+    }
+    return ObjectHolder();
+  }
+
+  return ArithmeticOp<int, string>::_(lhs, rhs, [](const auto& lhs, const auto& rhs) { return lhs + rhs; });
+}
+
+ObjectHolder
+Sub(ObjectHolder lhs, ObjectHolder rhs)
+{
+  return ArithmeticOp<int>::_(lhs, rhs, [](auto lhs, auto rhs) { return lhs - rhs; });
+}
+
+ObjectHolder
+Mult(ObjectHolder lhs, ObjectHolder rhs)
+{
+  return ArithmeticOp<int>::_(lhs, rhs, [](auto lhs, auto rhs) { return lhs * rhs; });
+}
+
+ObjectHolder
+Div(ObjectHolder lhs, ObjectHolder rhs)
+{
+  return ArithmeticOp<int>::_(lhs, rhs, [](auto lhs, auto rhs) { return lhs / rhs; });
+}
+
+ObjectHolder
+Stringify(ObjectHolder object)
+{
+  ostringstream output;
+  PrintValue(output, object);
+  return ObjectHolder::Own(String(output.str()));
+}
+
+void
+PrintValue(ostream& os, ObjectHolder object)
+{
+  if (object) {
+    object->Print(os);
+  } else {
+    os << "None";
+  }
+}
+
+} /* namespace Runtime */
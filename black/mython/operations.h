@@ -0,0 +1,30 @@
+#pragma once
+
+#include "object_holder.h"
+
+#include <ostream>
+
+namespace Runtime {
+
+// Operations of Mython expressions, shared by the tree interpreter and the
+// bytecode VM. They throw std::runtime_error on operands of wrong types
+
+// Numbers, strings, or an instance with the __add__ method and any argument
+ObjectHolder
+Add(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder
+Sub(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder
+Mult(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder
+Div(ObjectHolder lhs, ObjectHolder rhs);
+
+// String the object prints
+ObjectHolder
+Stringify(ObjectHolder object);
+
+// Prints the object or None
+void
+PrintValue(std::ostream& os, ObjectHolder object);
+
+} /* namespace Runtime */
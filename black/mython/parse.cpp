@@ -79,13 +79,14 @@ private:
     while (lexer_.CurrentToken().Is<TokenType::Def>()) {
       Runtime::Method m;
 
+      m.line = lexer_.CurrentLine();
       m.name = lexer_.ExpectNext<TokenType::Id>().value;
       lexer_.ExpectNext<TokenType::Char>('(');
 
       if (lexer_.NextToken().Is<TokenType::Id>()) {
-        m.formal_params.push_back(lexer_.Expect<TokenType::Id>().value);
+        m.formal_params.emplace_back(lexer_.Expect<TokenType::Id>().value);
         while (lexer_.NextToken() == ',') {
-          m.formal_params.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+          m.formal_params.emplace_back(lexer_.ExpectNext<TokenType::Id>().value);
         }
       }
 
@@ -103,13 +104,13 @@ private:
   // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
   unique_ptr<Ast::Statement> ParseClassDefinition()
   {
-    string class_name = lexer_.Expect<TokenType::Id>().value;
+    string class_name(lexer_.Expect<TokenType::Id>().value);
 
     lexer_.NextToken();
 
     const Runtime::Class* base_class = nullptr;
     if (lexer_.CurrentToken() == '(') {
-      auto name = lexer_.ExpectNext<TokenType::Id>().value;
+      string name(lexer_.ExpectNext<TokenType::Id>().value);
       lexer_.ExpectNext<TokenType::Char>(')');
       lexer_.NextToken();
 
@@ -141,10 +142,10 @@ private:
 
   vector<string> ParseDottedIds()
   {
-    vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+    vector<string> result(1, string(lexer_.Expect<TokenType::Id>().value));
 
     while (lexer_.NextToken() == '.') {
-      result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+      result.emplace_back(lexer_.ExpectNext<TokenType::Id>().value);
     }
 
     return result;
@@ -248,7 +249,7 @@ private:
       lexer_.NextToken();
       return make_unique<Ast::NumericConst>(result);
     } else if (auto str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
-      string result = str->value;
+      string result(str->value);
       lexer_.NextToken();
       return make_unique<Ast::StringConst>(std::move(result));
     } else if (lexer_.CurrentToken().Is<TokenType::True>()) {
@@ -0,0 +1,153 @@
+#include "profiler.h"
+#include "object.h"
+#include "object_holder.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+
+size_t
+AllocatedObjects()
+{
+  const Heap* heap = Heap::GetCurrent();
+  return heap ? heap->GetStats().allocated_objects : 0;
+}
+
+double
+Milliseconds(chrono::nanoseconds time)
+{
+  return chrono::duration<double, milli>(time).count();
+}
+
+} // namespace
+
+Profiler::Session::Session(Profiler& profiler)
+  : previous_(current_)
+{
+  current_ = &profiler;
+}
+
+Profiler::Session::~Session()
+{
+  current_ = previous_;
+}
+
+void
+Profiler::Enter(const Class& cls, const Method& method)
+{
+  Node& node = GetChild(stack_.empty() ? root_ : *stack_.back().node, cls, method);
+  ++node.entry->profile.calls;
+  ++node.entry->active;
+  stack_.push_back({ &node, Clock::now(), AllocatedObjects() });
+}
+
+void
+Profiler::Leave()
+{
+  const Frame frame = stack_.back();
+  stack_.pop_back();
+
+  const chrono::nanoseconds time = Clock::now() - frame.start;
+  const size_t allocations = AllocatedObjects() - frame.start_allocations;
+
+  frame.node->exclusive_time += time - frame.callee_time;
+  MethodProfile& profile = frame.node->entry->profile;
+  profile.exclusive_time += time - frame.callee_time;
+  profile.exclusive_allocations += allocations - frame.callee_allocations;
+  if (--frame.node->entry->active == 0) {
+    profile.inclusive_time += time;
+    profile.inclusive_allocations += allocations;
+  }
+
+  if (!stack_.empty()) {
+    stack_.back().callee_time += time;
+    stack_.back().callee_allocations += allocations;
+  }
+}
+
+Profiler::Node&
+Profiler::GetChild(Node& parent, const Class& cls, const Method& method)
+{
+  // a method calls few others, so they are looked for one by one
+  for (const auto& child : parent.children) {
+    const Entry& entry = *child->entry;
+    if (entry.method_name == method.name && entry.profile.line == method.line && entry.class_name == cls.GetName()) {
+      return *child;
+    }
+  }
+
+  auto [it, inserted] = entries_.try_emplace({ cls.GetName(), method.name, method.line });
+  Entry& entry = it->second;
+  if (inserted) {
+    entry.class_name = cls.GetName();
+    entry.method_name = method.name;
+    entry.profile.name = cls.GetName() + "." + method.name;
+    entry.profile.line = method.line;
+  }
+
+  auto child = make_unique<Node>();
+  child->entry = &entry;
+  parent.children.push_back(move(child));
+  return *parent.children.back();
+}
+
+vector<MethodProfile>
+Profiler::GetProfiles() const
+{
+  vector<MethodProfile> result;
+  result.reserve(entries_.size());
+  for (const auto& [key, entry] : entries_) {
+    result.push_back(entry.profile);
+  }
+  sort(begin(result), end(result), [](const MethodProfile& lhs, const MethodProfile& rhs) {
+    return lhs.exclusive_time > rhs.exclusive_time;
+  });
+  return result;
+}
+
+void
+Profiler::WriteReport(ostream& out) const
+{
+  out << setw(10) << "calls" << setw(14) << "inclusive ms" << setw(14) << "exclusive ms" << setw(16) << "inclusive new"
+      << setw(16) << "exclusive new"
+      << "  method:line\n";
+  out << fixed << setprecision(3);
+  for (const auto& profile : GetProfiles()) {
+    out << setw(10) << profile.calls << setw(14) << Milliseconds(profile.inclusive_time) << setw(14)
+        << Milliseconds(profile.exclusive_time) << setw(16) << profile.inclusive_allocations << setw(16)
+        << profile.exclusive_allocations << "  " << profile.name << ':' << profile.line << '\n';
+  }
+}
+
+void
+Profiler::WriteCollapsedStacks(ostream& out) const
+{
+  string stack;
+  WriteCollapsedStacks(out, root_, stack);
+}
+
+void
+Profiler::WriteCollapsedStacks(ostream& out, const Node& node, string& stack) const
+{
+  const size_t stack_size = stack.size();
+  for (const auto& child : node.children) {
+    if (!stack.empty()) {
+      stack += ';';
+    }
+    const MethodProfile& profile = child->entry->profile;
+    stack += profile.name;
+    stack += ':';
+    stack += to_string(profile.line);
+
+    out << stack << ' ' << chrono::duration_cast<chrono::microseconds>(child->exclusive_time).count() << '\n';
+    WriteCollapsedStacks(out, *child, stack);
+    stack.resize(stack_size);
+  }
+}
+
+} /* namespace Runtime */
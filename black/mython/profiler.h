@@ -0,0 +1,147 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+class TestRunner;
+
+namespace Runtime {
+
+class Class;
+struct Method;
+
+struct MethodProfile
+{
+  // name of the class of the instance and of the method, Class.method
+  std::string name;
+  // line of the definition of the method in the source, 0 if it is unknown
+  size_t line = 0;
+  size_t calls = 0;
+  // the inclusive values take in the methods the calls make, a recursive call
+  // is only counted in its outermost call
+  std::chrono::nanoseconds inclusive_time{};
+  std::chrono::nanoseconds exclusive_time{};
+  // objects allocated in the current heap
+  size_t inclusive_allocations = 0;
+  size_t exclusive_allocations = 0;
+};
+
+// Instrumenting profiler of the calls of methods, by both engines. The calls
+// are recorded in a tree of the call stacks they are made in, so the
+// profiler reports the methods as well as the stacks for flame graphs. It only
+// sees the calls made while it is current. Methods are told apart by the names
+// of their classes, their names and their lines rather than by their
+// addresses, so a profiler may outlive a program and profile the next ones
+class Profiler
+{
+public:
+  Profiler() = default;
+
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  // nullptr if nothing is profiled
+  static Profiler* GetCurrent() { return current_; }
+
+  // Makes the profiler current while it lives
+  class Session
+  {
+  public:
+    explicit Session(Profiler& profiler);
+    ~Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+  private:
+    Profiler* previous_;
+  };
+
+  void Enter(const Class& cls, const Method& method);
+  void Leave();
+
+  // Sorted by the exclusive time, the longest first
+  std::vector<MethodProfile> GetProfiles() const;
+  // Table of the profiles, the times are in milliseconds
+  void WriteReport(std::ostream& out) const;
+  // A line per call stack: the methods from the outermost one separated by
+  // ';' and the exclusive time of the innermost one in microseconds. This is
+  // the input flamegraph.pl takes
+  void WriteCollapsedStacks(std::ostream& out) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry
+  {
+    std::string class_name;
+    std::string method_name;
+    MethodProfile profile;
+    // calls of the method on the stack
+    size_t active = 0;
+  };
+
+  struct Node
+  {
+    Entry* entry = nullptr;
+    std::chrono::nanoseconds exclusive_time{};
+    std::vector<std::unique_ptr<Node>> children;
+  };
+
+  struct Frame
+  {
+    Node* node;
+    Clock::time_point start;
+    size_t start_allocations;
+    std::chrono::nanoseconds callee_time{};
+    size_t callee_allocations = 0;
+  };
+
+  Node& GetChild(Node& parent, const Class& cls, const Method& method);
+  void WriteCollapsedStacks(std::ostream& out, const Node& node, std::string& stack) const;
+
+  inline static Profiler* current_ = nullptr;
+
+  // by the names of the class and of the method and the line
+  std::map<std::tuple<std::string, std::string, size_t>, Entry> entries_;
+  // calls made outside of any method are the children of the root
+  Node root_;
+  std::vector<Frame> stack_;
+};
+
+// Reports a call of a method to the current profiler, if there is one, while
+// it lives
+class ProfiledCall
+{
+public:
+  ProfiledCall(const Class& cls, const Method& method)
+    : profiler_(Profiler::GetCurrent())
+  {
+    if (profiler_) {
+      profiler_->Enter(cls, method);
+    }
+  }
+
+  ~ProfiledCall()
+  {
+    if (profiler_) {
+      profiler_->Leave();
+    }
+  }
+
+  ProfiledCall(const ProfiledCall&) = delete;
+  ProfiledCall& operator=(const ProfiledCall&) = delete;
+
+private:
+  Profiler* const profiler_;
+};
+
+void
+RunProfilerTests(TestRunner& tr);
+
+} /* namespace Runtime */
@@ -0,0 +1,144 @@
+#include "object.h"
+#include "object_holder.h"
+#include "profiler.h"
+#include "statement.h"
+
+#include <test_runner.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+
+// Collapsed stacks without their times
+vector<string>
+StackNames(const Profiler& profiler)
+{
+  ostringstream os;
+  profiler.WriteCollapsedStacks(os);
+
+  vector<string> result;
+  istringstream is(os.str());
+  for (string line; getline(is, line);) {
+    result.push_back(line.substr(0, line.rfind(' ')));
+  }
+  return result;
+}
+
+} // namespace
+
+void
+TestCallTree()
+{
+  vector<Method> methods;
+  methods.push_back({ "f", {}, {} });
+  methods.back().line = 2;
+  methods.push_back({ "g", {}, {} });
+  methods.back().line = 5;
+  Class cls("A", std::move(methods), nullptr);
+  const Method& f = *cls.GetMethod("f");
+  const Method& g = *cls.GetMethod("g");
+
+  Heap heap;
+  Profiler profiler;
+  {
+    Profiler::Session session(profiler);
+    ProfiledCall outer_f(cls, f);
+    {
+      ProfiledCall first_g(cls, g);
+      ObjectHolder::Own(String("g"));
+    }
+    {
+      ProfiledCall second_g(cls, g);
+      ProfiledCall inner_f(cls, f);
+      ObjectHolder::Own(String("f"));
+    }
+  }
+  ASSERT(!Profiler::GetCurrent());
+
+  const auto profiles = profiler.GetProfiles();
+  ASSERT_EQUAL(profiles.size(), 2u);
+  for (const auto& profile : profiles) {
+    ASSERT(profile.inclusive_time >= profile.exclusive_time);
+    ASSERT_EQUAL(profile.calls, 2u);
+    if (profile.name == "A.f") {
+      ASSERT_EQUAL(profile.line, 2u);
+      // the inner call is in the outer one
+      ASSERT_EQUAL(profile.inclusive_allocations, 2u);
+      ASSERT_EQUAL(profile.exclusive_allocations, 1u);
+    } else {
+      ASSERT_EQUAL(profile.name, "A.g");
+      ASSERT_EQUAL(profile.line, 5u);
+      ASSERT_EQUAL(profile.inclusive_allocations, 2u);
+      ASSERT_EQUAL(profile.exclusive_allocations, 1u);
+    }
+  }
+
+  const vector<string> expected = { "A.f:2", "A.f:2;A.g:5", "A.f:2;A.g:5;A.f:2" };
+  ASSERT_EQUAL(StackNames(profiler), expected);
+}
+
+void
+TestOnlyCurrentProfilerRecords()
+{
+  vector<Method> methods;
+  methods.push_back({ "f", {}, {} });
+  Class cls("A", std::move(methods), nullptr);
+
+  Profiler profiler;
+  {
+    ProfiledCall call(cls, *cls.GetMethod("f"));
+  }
+  ASSERT(profiler.GetProfiles().empty());
+
+  Profiler outer;
+  {
+    Profiler::Session outer_session(outer);
+    {
+      Profiler::Session session(profiler);
+      ProfiledCall call(cls, *cls.GetMethod("f"));
+    }
+    ProfiledCall call(cls, *cls.GetMethod("f"));
+  }
+  ASSERT_EQUAL(profiler.GetProfiles().size(), 1u);
+  ASSERT_EQUAL(outer.GetProfiles().size(), 1u);
+  ASSERT_EQUAL(outer.GetProfiles()[0].calls, 1u);
+}
+
+void
+TestProfilerOutlivesClasses()
+{
+  Profiler profiler;
+  Profiler::Session session(profiler);
+  // the classes of programs run one after another may get the same addresses
+  for (const char* name : { "A", "B", "A" }) {
+    vector<Method> methods;
+    methods.push_back({ "f", {}, {} });
+    methods.back().line = 1;
+    Class cls(name, std::move(methods), nullptr);
+    ProfiledCall call(cls, *cls.GetMethod("f"));
+  }
+
+  const auto profiles = profiler.GetProfiles();
+  ASSERT_EQUAL(profiles.size(), 2u);
+  for (const auto& profile : profiles) {
+    ASSERT_EQUAL(profile.calls, profile.name == "A.f" ? 2u : 1u);
+  }
+  const vector<string> expected = { "A.f:1", "B.f:1" };
+  ASSERT_EQUAL(StackNames(profiler), expected);
+}
+
+void
+RunProfilerTests(TestRunner& tr)
+{
+  RUN_TEST(tr, Runtime::TestCallTree);
+  RUN_TEST(tr, Runtime::TestOnlyCurrentProfilerRecords);
+  RUN_TEST(tr, Runtime::TestProfilerOutlivesClasses);
+}
+
+} /* namespace Runtime */
@@ -0,0 +1,45 @@
+#include "resolver.h"
+#include "statement.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace Ast {
+
+size_t
+Resolver::GetSlot(const string& name)
+{
+  return slots_.emplace(name, slots_.size()).first->second;
+}
+
+size_t
+Resolver::GetFrameSize() const
+{
+  return slots_.size();
+}
+
+size_t
+ResolveProgram(Statement& program)
+{
+  Resolver resolver;
+  program.Resolve(resolver);
+  return resolver.GetFrameSize();
+}
+
+void
+ResolveMethod(Runtime::Method& method)
+{
+  Resolver resolver;
+  resolver.GetSlot("self");
+  // arguments are passed in the slots which follow self
+  for (const auto& param : method.formal_params) {
+    if (resolver.GetSlot(param) != resolver.GetFrameSize() - 1) {
+      throw runtime_error("Duplicate parameter " + param + " of method " + method.name);
+    }
+  }
+  method.body->Resolve(resolver);
+  method.frame_size = resolver.GetFrameSize();
+}
+
+} /* namespace Ast */
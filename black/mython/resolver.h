@@ -0,0 +1,38 @@
+#pragma once
+
+#include "object.h"
+
+#include <string>
+#include <unordered_map>
+
+class TestRunner;
+
+namespace Ast {
+
+struct Statement;
+
+// Lays out the variables of a method body or of a program in the slots of its
+// frame. Mython has no nested scopes, so a variable gets a slot for the whole
+// body where it occurs first
+class Resolver
+{
+public:
+  size_t GetSlot(const std::string& name);
+  size_t GetFrameSize() const;
+
+private:
+  std::unordered_map<std::string, size_t> slots_;
+};
+
+// Resolves the program and the methods of the classes it defines, returns the
+// size of the frame the program has to be executed on
+size_t
+ResolveProgram(Statement& program);
+
+void
+ResolveMethod(Runtime::Method& method);
+
+void
+RunResolverTests(TestRunner& tr);
+
+} /* namespace Ast */
@@ -0,0 +1,123 @@
+#include "lexer.h"
+#include "parse.h"
+#include "resolver.h"
+#include "statement.h"
+
+#include <test_runner.h>
+
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace Ast {
+
+namespace {
+
+string
+RunProgram(const string& program, bool resolve)
+{
+  istringstream is(program);
+  Parse::Lexer lexer(is);
+  auto tree = ParseProgram(lexer);
+
+  ostringstream os;
+  Print::SetOutputStream(os);
+  if (resolve) {
+    Runtime::Frame frame(ResolveProgram(*tree));
+    tree->Execute(frame);
+  } else {
+    Runtime::Closure closure;
+    tree->Execute(closure);
+  }
+  return os.str();
+}
+
+} // namespace
+
+void
+TestProgramFrame()
+{
+  istringstream is(R"(
+x = 1
+y = x + z
+x = y
+)");
+  Parse::Lexer lexer(is);
+  auto tree = ParseProgram(lexer);
+
+  ASSERT_EQUAL(ResolveProgram(*tree), 3u);
+}
+
+void
+TestMethodFrame()
+{
+  vector<Runtime::Method> methods;
+  methods.push_back({ "Set",
+                      { "a", "b" },
+                      make_unique<Compound>(
+                        make_unique<Assignment>("c", make_unique<VariableValue>("a")),
+                        make_unique<FieldAssignment>(VariableValue{ "self" }, "d", make_unique<VariableValue>("c"))) });
+  ResolveMethod(methods.front());
+  ASSERT_EQUAL(methods.front().frame_size, 4u);
+
+  Runtime::Class cls("Box", std::move(methods), nullptr);
+  Runtime::ClassInstance inst(cls);
+  ASSERT(!inst.Call("Set", { ObjectHolder::Own(Runtime::Number(57)), ObjectHolder::None() }));
+
+  auto value = inst.Fields().at("d").TryAs<Runtime::Number>();
+  ASSERT(value && value->GetValue() == 57);
+}
+
+void
+TestDuplicateParameters()
+{
+  Runtime::Method method{ "Set", { "a", "a" }, make_unique<None>() };
+  ASSERT_THROWS(ResolveMethod(method), runtime_error);
+}
+
+void
+TestResolvedProgram()
+{
+  const string program = R"(
+class Node:
+  def __init__(value, next):
+    self.value = value
+    self.next = next
+
+  def sum():
+    if self.next:
+      return self.value + self.next.sum()
+    return self.value
+
+class Fib:
+  def calc(n):
+    if n < 2:
+      return n
+    a = self.calc(n - 1)
+    b = self.calc(n - 2)
+    return a + b
+
+list = Node(1, Node(2, Node(3, None)))
+fib = Fib()
+print list.sum(), list.next.next.value, fib.calc(15)
+x = list.next
+list.next = None
+print list.sum(), x.sum(), undefined
+)";
+
+  const string expected = "6 3 610\n1 5 None\n";
+  ASSERT_EQUAL(RunProgram(program, true), expected);
+  ASSERT_EQUAL(RunProgram(program, false), expected);
+}
+
+void
+RunResolverTests(TestRunner& tr)
+{
+  RUN_TEST(tr, Ast::TestProgramFrame);
+  RUN_TEST(tr, Ast::TestMethodFrame);
+  RUN_TEST(tr, Ast::TestDuplicateParameters);
+  RUN_TEST(tr, Ast::TestResolvedProgram);
+}
+
+} /* namespace Ast */
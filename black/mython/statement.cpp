@@ -1,5 +1,7 @@
 #include "statement.h"
 #include "object.h"
+#include "operations.h"
+#include "resolver.h"
 
 #include <iostream>
 #include <sstream>
@@ -9,13 +11,46 @@ using namespace std;
 namespace Ast {
 
 using Runtime::Closure;
+using Runtime::Scope;
+
+namespace {
+
+ObjectHolder&
+GetVariable(Scope scope, size_t slot, const string& name)
+{
+  return scope.frame ? scope.frame->slots[slot] : (*scope.closure)[name];
+}
+
+template<typename Statements>
+void
+ResolveAll(const Statements& statements, Resolver& resolver)
+{
+  for (const auto& statement : statements) {
+    statement->Resolve(resolver);
+  }
+}
+
+} // namespace
 
 ObjectHolder
-Assignment::Execute(Closure& closure)
+Assignment::Execute(Scope scope)
+{
+  ObjectHolder value = right_value_->Execute(scope);
+  return GetVariable(scope, slot_, var_name_) = std::move(value);
+}
+
+void
+Assignment::Resolve(Resolver& resolver)
 {
-  ObjectHolder& var = closure[var_name_];
-  var = right_value_->Execute(closure);
-  return var;
+  right_value_->Resolve(resolver);
+  slot_ = resolver.GetSlot(var_name_);
+}
+
+void
+Assignment::Compile(Bytecode::Compiler& compiler)
+{
+  right_value_->Compile(compiler);
+  compiler.AddStore(slot_);
 }
 
 Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv)
@@ -24,28 +59,45 @@ Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv)
 {}
 
 VariableValue::VariableValue(std::string var_name)
-{
-  dotted_ids_.push_back(std::move(var_name));
-}
+  : VariableValue(std::vector<std::string>{ std::move(var_name) })
+{}
 
 VariableValue::VariableValue(std::vector<std::string> dotted_ids)
   : dotted_ids_(std::move(dotted_ids))
-{}
+{
+  for (unsigned i = 1; i < dotted_ids_.size(); ++i) {
+    field_symbols_.push_back(Runtime::Intern(dotted_ids_[i]));
+  }
+  field_caches_.resize(field_symbols_.size());
+}
 
 ObjectHolder
-VariableValue::Execute(Closure& closure)
-{
-  Closure* obj_closure = &closure;
-  for (unsigned i = 0; i < dotted_ids_.size() - 1; ++i) {
-    const std::string& id = dotted_ids_[i];
-    ObjectHolder& obj = (*obj_closure)[id];
-    if (auto class_instance_obj = obj.TryAs<Runtime::ClassInstance>()) {
-      obj_closure = &class_instance_obj->Fields();
+VariableValue::Execute(Scope scope)
+{
+  ObjectHolder* obj = &GetVariable(scope, slot_, dotted_ids_.front());
+  for (unsigned i = 0; i < field_symbols_.size(); ++i) {
+    if (auto class_instance_obj = obj->TryAs<Runtime::ClassInstance>()) {
+      obj = &field_caches_[i].Get(class_instance_obj->Fields(), field_symbols_[i]);
     } else {
-      throw std::runtime_error("invalid field at " + id);
+      throw std::runtime_error("invalid field at " + dotted_ids_[i]);
     }
   }
-  return (*obj_closure)[dotted_ids_.back()];
+  return *obj;
+}
+
+void
+VariableValue::Resolve(Resolver& resolver)
+{
+  slot_ = resolver.GetSlot(dotted_ids_.front());
+}
+
+void
+VariableValue::Compile(Bytecode::Compiler& compiler)
+{
+  compiler.AddLoad(slot_);
+  for (unsigned i = 0; i < field_symbols_.size(); ++i) {
+    compiler.AddGetField(field_symbols_[i], dotted_ids_[i]);
+  }
 }
 
 unique_ptr<Print>
@@ -64,23 +116,34 @@ Print::Print(vector<unique_ptr<Statement>> args)
 {}
 
 ObjectHolder
-Print::Execute(Closure& closure)
+Print::Execute(Scope scope)
 {
-  ObjectHolder string_holder;
   for (unsigned i = 0; i < args_.size(); ++i) {
     if (i != 0) {
       (*output_) << ' ';
     }
-    if (auto ex_res = args_[i]->Execute(closure)) {
-      ex_res->Print(*output_);
-    } else {
-      (*output_) << "None";
-    }
+    Runtime::PrintValue(*output_, args_[i]->Execute(scope));
   }
   (*output_) << '\n';
   return ObjectHolder();
 }
 
+void
+Print::Resolve(Resolver& resolver)
+{
+  ResolveAll(args_, resolver);
+}
+
+void
+Print::Compile(Bytecode::Compiler& compiler)
+{
+  for (unsigned i = 0; i < args_.size(); ++i) {
+    args_[i]->Compile(compiler);
+    compiler.AddPrintArg(i + 1 == args_.size());
+  }
+  compiler.AddPrintEnd();
+}
+
 ostream* Print::output_ = &cout;
 
 void
@@ -89,6 +152,12 @@ Print::SetOutputStream(ostream& output_stream)
   output_ = &output_stream;
 }
 
+ostream&
+Print::GetOutputStream()
+{
+  return *output_;
+}
+
 MethodCall::MethodCall(std::unique_ptr<Statement> object,
                        std::string method,
                        std::vector<std::unique_ptr<Statement>> args)
@@ -98,144 +167,190 @@ MethodCall::MethodCall(std::unique_ptr<Statement> object,
 {}
 
 ObjectHolder
-MethodCall::Execute(Closure& closure)
+MethodCall::Execute(Scope scope)
 {
-  auto inst_var = object_->Execute(closure);
+  auto inst_var = object_->Execute(scope);
   auto inst = inst_var.TryAs<Runtime::ClassInstance>();
   if (!inst) {
     throw std::runtime_error("cannot call method on non-object instance");
   }
-  if (!inst->HasMethod(method_, args_.size())) {
+  const Runtime::Method* method = method_cache_.Find(inst->GetClass(), method_);
+  if (!method || method->formal_params.size() != args_.size()) {
     throw std::runtime_error("invalid method name");
   }
 
   std::vector<ObjectHolder> method_args;
   method_args.reserve(args_.size());
   for (const auto& arg : args_) {
-    method_args.push_back(arg->Execute(closure));
+    method_args.push_back(arg->Execute(scope));
   }
-  return inst->Call(method_, method_args);
+  return inst->Call(*method, method_args);
 }
 
-ObjectHolder
-Stringify::Execute(Closure& closure)
+void
+MethodCall::Resolve(Resolver& resolver)
 {
-  std::ostringstream output;
-  argument_->Execute(closure)->Print(output);
-  return ObjectHolder::Own(Runtime::String(output.str()));
+  object_->Resolve(resolver);
+  ResolveAll(args_, resolver);
 }
 
-template<typename... Args>
-struct ArithmeticOp
-{};
-
-template<typename T, typename... Args>
-struct ArithmeticOp<T, Args...>
+void
+MethodCall::Compile(Bytecode::Compiler& compiler)
 {
-  template<typename Op>
-  static ObjectHolder _(const ObjectHolder& lhs, const ObjectHolder& rhs, Op op)
-  {
-    using namespace Runtime;
-    auto lhs_val = lhs.TryAs<ValueObject<T>>();
-    auto rhs_val = rhs.TryAs<ValueObject<T>>();
-    if (lhs_val && rhs_val) {
-      auto res = op(lhs_val->GetValue(), rhs_val->GetValue());
-      return ObjectHolder::Own(ValueObject<T>(res));
-    }
-    return ArithmeticOp<Args...>::_(lhs, rhs, op);
+  object_->Compile(compiler);
+  const size_t call = compiler.AddCheckCall(method_, args_.size());
+  for (const auto& arg : args_) {
+    arg->Compile(compiler);
   }
-};
+  compiler.AddCall(call);
+}
 
-template<>
-struct ArithmeticOp<>
+void
+UnaryOperation::Resolve(Resolver& resolver)
 {
-  template<typename Op>
-  static ObjectHolder _(const ObjectHolder&, const ObjectHolder&, Op)
-  {
-    throw std::runtime_error("invalid binary operation");
-  }
-};
-
-template<typename T>
-struct ArithmeticOp<T>
-{
-  template<typename Op>
-  static ObjectHolder _(const ObjectHolder& lhs, const ObjectHolder& rhs, Op op)
-  {
-    using namespace Runtime;
-    auto lhs_val = lhs.TryAs<ValueObject<T>>();
-    auto rhs_val = rhs.TryAs<ValueObject<T>>();
-    if (!lhs_val || !rhs_val) {
-      throw std::runtime_error("invalid binary operation");
-    }
-    auto res = op(lhs_val->GetValue(), rhs_val->GetValue());
-    return ObjectHolder::Own(ValueObject<T>(res));
-  }
-};
+  argument_->Resolve(resolver);
+}
+
+void
+BinaryOperation::Resolve(Resolver& resolver)
+{
+  lhs_->Resolve(resolver);
+  rhs_->Resolve(resolver);
+}
 
 ObjectHolder
-Add::Execute(Closure& closure)
+Stringify::Execute(Scope scope)
 {
-  ObjectHolder lhs_val = lhs_->Execute(closure);
-  ObjectHolder rhs_val = rhs_->Execute(closure);
+  return Runtime::Stringify(argument_->Execute(scope));
+}
 
-  if (auto lhs_inst = lhs_val.TryAs<Runtime::ClassInstance>()) {
-    static const std::string add_method_name = "__add__";
-    return lhs_inst->Call(add_method_name, {rhs_val});
-  }
+void
+Stringify::Compile(Bytecode::Compiler& compiler)
+{
+  argument_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Stringify);
+}
 
-  return ArithmeticOp<int, std::string>::_(lhs_val, rhs_val, [](const auto& lhs, const auto& rhs) {
-    return lhs + rhs;
-  });
+ObjectHolder
+Add::Execute(Scope scope)
+{
+  ObjectHolder lhs_val = lhs_->Execute(scope);
+  ObjectHolder rhs_val = rhs_->Execute(scope);
+  return Runtime::Add(lhs_val, rhs_val);
+}
+
+void
+Add::Compile(Bytecode::Compiler& compiler)
+{
+  lhs_->Compile(compiler);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Add);
 }
 
 ObjectHolder
-Sub::Execute(Closure& closure)
+Sub::Execute(Scope scope)
 {
-  ObjectHolder lhs_val = lhs_->Execute(closure);
-  ObjectHolder rhs_val = rhs_->Execute(closure);
+  ObjectHolder lhs_val = lhs_->Execute(scope);
+  ObjectHolder rhs_val = rhs_->Execute(scope);
+  return Runtime::Sub(lhs_val, rhs_val);
+}
 
-  return ArithmeticOp<int>::_(lhs_val, rhs_val, [](auto lhs, auto rhs) { return lhs - rhs; });
+void
+Sub::Compile(Bytecode::Compiler& compiler)
+{
+  lhs_->Compile(compiler);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Sub);
 }
 
 ObjectHolder
-Mult::Execute(Runtime::Closure& closure)
+Mult::Execute(Scope scope)
 {
-  ObjectHolder lhs_val = lhs_->Execute(closure);
-  ObjectHolder rhs_val = rhs_->Execute(closure);
+  ObjectHolder lhs_val = lhs_->Execute(scope);
+  ObjectHolder rhs_val = rhs_->Execute(scope);
+  return Runtime::Mult(lhs_val, rhs_val);
+}
 
-  return ArithmeticOp<int>::_(lhs_val, rhs_val, [](auto lhs, auto rhs) { return lhs * rhs; });
+void
+Mult::Compile(Bytecode::Compiler& compiler)
+{
+  lhs_->Compile(compiler);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Mult);
 }
 
 ObjectHolder
-Div::Execute(Runtime::Closure& closure)
+Div::Execute(Scope scope)
 {
-  ObjectHolder lhs_val = lhs_->Execute(closure);
-  ObjectHolder rhs_val = rhs_->Execute(closure);
+  ObjectHolder lhs_val = lhs_->Execute(scope);
+  ObjectHolder rhs_val = rhs_->Execute(scope);
+  return Runtime::Div(lhs_val, rhs_val);
+}
 
-  return ArithmeticOp<int>::_(lhs_val, rhs_val, [](auto lhs, auto rhs) { return lhs / rhs; });
+void
+Div::Compile(Bytecode::Compiler& compiler)
+{
+  lhs_->Compile(compiler);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Div);
 }
 
 ObjectHolder
-Compound::Execute(Closure& closure)
+Compound::Execute(Scope scope)
+{
+  return Run(scope).value;
+}
+
+Completion
+Compound::Run(Scope scope)
 {
   for (const auto& statement : statements_) {
-    ObjectHolder res = statement->Execute(closure);
-    auto returnIt = closure.find("__return__");
-    if (returnIt != std::end(closure)) {
-      return returnIt->second;
+    if (Completion completion = statement->Run(scope); completion.is_return) {
+      return completion;
     }
   }
+  return {};
+}
 
-  return ObjectHolder();
+void
+Compound::Resolve(Resolver& resolver)
+{
+  ResolveAll(statements_, resolver);
+}
+
+void
+Compound::Compile(Bytecode::Compiler& compiler)
+{
+  for (const auto& statement : statements_) {
+    statement->Compile(compiler);
+    compiler.AddPop();
+  }
+  compiler.AddNone();
 }
 
 ObjectHolder
-Return::Execute(Closure& closure)
+Return::Execute(Scope scope)
+{
+  return statement_->Execute(scope);
+}
+
+Completion
+Return::Run(Scope scope)
 {
-  ObjectHolder res = statement_->Execute(closure);
-  closure["__return__"] = res;
-  return res;
+  return { statement_->Execute(scope), true };
+}
+
+void
+Return::Resolve(Resolver& resolver)
+{
+  statement_->Resolve(resolver);
+}
+
+void
+Return::Compile(Bytecode::Compiler& compiler)
+{
+  statement_->Compile(compiler);
+  compiler.AddReturn();
 }
 
 ClassDefinition::ClassDefinition(ObjectHolder cls)
@@ -244,24 +359,56 @@ ClassDefinition::ClassDefinition(ObjectHolder cls)
 {}
 
 ObjectHolder
-ClassDefinition::Execute(Runtime::Closure& closure)
+ClassDefinition::Execute(Scope scope)
 {
   return cls_;
 }
 
+void
+ClassDefinition::Resolve(Resolver&)
+{
+  for (auto& method : cls_.TryAs<Runtime::Class>()->GetMethods()) {
+    ResolveMethod(method);
+  }
+}
+
+void
+ClassDefinition::Compile(Bytecode::Compiler& compiler)
+{
+  compiler.AddClass(*cls_.TryAs<Runtime::Class>());
+  compiler.AddConstant(cls_);
+}
+
 FieldAssignment::FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv)
   : object_(std::move(object))
   , field_name_(std::move(field_name))
+  , field_symbol_(Runtime::Intern(field_name_))
   , right_value_(std::move(rv))
 {}
 
 ObjectHolder
-FieldAssignment::Execute(Runtime::Closure& closure)
+FieldAssignment::Execute(Scope scope)
 {
-  Closure& object_closure = object_.Execute(closure).TryAs<Runtime::ClassInstance>()->Fields();
-  ObjectHolder& field = object_closure[field_name_];
-  field = right_value_->Execute(closure);
-  return field;
+  ObjectHolder object = object_.Execute(scope);
+  // the value may add fields to the instance, so it goes first
+  ObjectHolder value = right_value_->Execute(scope);
+  Runtime::FieldTable& fields = object.TryAs<Runtime::ClassInstance>()->Fields();
+  return field_cache_.Get(fields, field_symbol_) = std::move(value);
+}
+
+void
+FieldAssignment::Resolve(Resolver& resolver)
+{
+  object_.Resolve(resolver);
+  right_value_->Resolve(resolver);
+}
+
+void
+FieldAssignment::Compile(Bytecode::Compiler& compiler)
+{
+  object_.Compile(compiler);
+  right_value_->Compile(compiler);
+  compiler.AddSetField(field_symbol_, object_.dotted_ids_.back());
 }
 
 IfElse::IfElse(std::unique_ptr<Statement> condition,
@@ -273,40 +420,107 @@ IfElse::IfElse(std::unique_ptr<Statement> condition,
 {}
 
 ObjectHolder
-IfElse::Execute(Runtime::Closure& closure)
+IfElse::Execute(Scope scope)
+{
+  return Run(scope).value;
+}
+
+Completion
+IfElse::Run(Scope scope)
 {
   using namespace Runtime;
 
-  ObjectHolder condition_val = condition_->Execute(closure);
+  ObjectHolder condition_val = condition_->Execute(scope);
   if (IsTrue(condition_val)) {
-    return if_body_->Execute(closure);
+    return if_body_->Run(scope);
   } else if (else_body_) {
-    return else_body_->Execute(closure);
+    return else_body_->Run(scope);
   }
-  return ObjectHolder();
+  return {};
+}
+
+void
+IfElse::Resolve(Resolver& resolver)
+{
+  condition_->Resolve(resolver);
+  if_body_->Resolve(resolver);
+  if (else_body_) {
+    else_body_->Resolve(resolver);
+  }
+}
+
+void
+IfElse::Compile(Bytecode::Compiler& compiler)
+{
+  using Bytecode::OpCode;
+
+  condition_->Compile(compiler);
+  const auto to_else = compiler.AddJump(OpCode::JumpIfFalse);
+  if_body_->Compile(compiler);
+  const auto to_end = compiler.AddJump(OpCode::Jump);
+  compiler.BindLabel(to_else);
+  if (else_body_) {
+    else_body_->Compile(compiler);
+  } else {
+    compiler.AddNone();
+  }
+  compiler.BindLabel(to_end);
 }
 
 ObjectHolder
-Or::Execute(Runtime::Closure& closure)
+Or::Execute(Scope scope)
 {
-  const bool res = IsTrue(lhs_->Execute(closure)) || IsTrue(rhs_->Execute(closure));
+  const bool res = IsTrue(lhs_->Execute(scope)) || IsTrue(rhs_->Execute(scope));
   return ObjectHolder::Own(Runtime::Bool(res));
 }
 
+void
+Or::Compile(Bytecode::Compiler& compiler)
+{
+  using Bytecode::OpCode;
+
+  lhs_->Compile(compiler);
+  compiler.AddOperation(OpCode::Truth);
+  const auto to_end = compiler.AddJump(OpCode::JumpIfTrueOrPop);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(OpCode::Truth);
+  compiler.BindLabel(to_end);
+}
+
 ObjectHolder
-And::Execute(Runtime::Closure& closure)
+And::Execute(Scope scope)
 {
-  const bool res = IsTrue(lhs_->Execute(closure)) && IsTrue(rhs_->Execute(closure));
+  const bool res = IsTrue(lhs_->Execute(scope)) && IsTrue(rhs_->Execute(scope));
   return ObjectHolder::Own(Runtime::Bool(res));
 }
 
+void
+And::Compile(Bytecode::Compiler& compiler)
+{
+  using Bytecode::OpCode;
+
+  lhs_->Compile(compiler);
+  compiler.AddOperation(OpCode::Truth);
+  const auto to_end = compiler.AddJump(OpCode::JumpIfFalseOrPop);
+  rhs_->Compile(compiler);
+  compiler.AddOperation(OpCode::Truth);
+  compiler.BindLabel(to_end);
+}
+
 ObjectHolder
-Not::Execute(Runtime::Closure& closure)
+Not::Execute(Scope scope)
 {
-  const bool res = !IsTrue(argument_->Execute(closure));
+  const bool res = !IsTrue(argument_->Execute(scope));
   return ObjectHolder::Own(Runtime::Bool(res));
 }
 
+void
+Not::Compile(Bytecode::Compiler& compiler)
+{
+  argument_->Compile(compiler);
+  compiler.AddOperation(Bytecode::OpCode::Not);
+}
+
 Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs)
   : comparator_(std::move(cmp))
   , left_(std::move(lhs))
@@ -314,12 +528,27 @@ Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Sta
 {}
 
 ObjectHolder
-Comparison::Execute(Runtime::Closure& closure)
+Comparison::Execute(Scope scope)
 {
-  const bool res = comparator_(left_->Execute(closure), right_->Execute(closure));
+  const bool res = comparator_(left_->Execute(scope), right_->Execute(scope));
   return ObjectHolder::Own(Runtime::Bool(res));
 }
 
+void
+Comparison::Resolve(Resolver& resolver)
+{
+  left_->Resolve(resolver);
+  right_->Resolve(resolver);
+}
+
+void
+Comparison::Compile(Bytecode::Compiler& compiler)
+{
+  left_->Compile(compiler);
+  right_->Compile(compiler);
+  compiler.AddCompare(comparator_);
+}
+
 NewInstance::NewInstance(const Runtime::Class& cls, std::vector<std::unique_ptr<Statement>> args)
   : class_(cls)
   , args_(std::move(args))
@@ -330,22 +559,39 @@ NewInstance::NewInstance(const Runtime::Class& cls)
 {}
 
 ObjectHolder
-NewInstance::Execute(Runtime::Closure& closure)
+NewInstance::Execute(Scope scope)
 {
-  static const std::string init_method_name = "__init__";
-
-  Runtime::ClassInstance inst(class_);
-  if (inst.HasMethod(init_method_name, args_.size())) {
+  // self of __init__ is owned as the instance it returns
+  ObjectHolder holder = ObjectHolder::Own(Runtime::ClassInstance(class_));
+  auto& inst = *holder.TryAs<Runtime::ClassInstance>();
+  const Runtime::Method* init = class_.GetSpecialMethod(Runtime::SpecialMethod::Init);
+  if (init && init->formal_params.size() == args_.size()) {
     std::vector<ObjectHolder> init_args;
     init_args.reserve(args_.size());
     for (const auto& arg : args_) {
-      init_args.push_back(arg->Execute(closure));
+      init_args.push_back(arg->Execute(scope));
     }
-    inst.Call(init_method_name, init_args);
+    inst.Call(*init, init_args);
   } else if (!args_.empty()) {
     throw std::runtime_error("invalid number of _init_ parameters");
   }
-  return ObjectHolder::Own(std::move(inst));
+  return holder;
+}
+
+void
+NewInstance::Resolve(Resolver& resolver)
+{
+  ResolveAll(args_, resolver);
+}
+
+void
+NewInstance::Compile(Bytecode::Compiler& compiler)
+{
+  const size_t new_site = compiler.AddNew(class_, args_.size());
+  for (const auto& arg : args_) {
+    arg->Compile(compiler);
+  }
+  compiler.AddInit(new_site);
 }
 
 } /* namespace Ast */
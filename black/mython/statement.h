@@ -1,11 +1,13 @@
 #pragma once
 
+#include "bytecode.h"
 #include "object.h"
 #include "object_holder.h"
 
 #include <functional>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -13,10 +15,27 @@ class TestRunner;
 
 namespace Ast {
 
+class Resolver;
+
+// How a statement of a body has completed: either normally, and the body goes
+// on, or by a return of the value from the method
+struct Completion
+{
+  ObjectHolder value;
+  bool is_return = false;
+};
+
 struct Statement
 {
   virtual ~Statement() = default;
-  virtual ObjectHolder Execute(Runtime::Closure& closure) = 0;
+  virtual ObjectHolder Execute(Runtime::Scope scope) = 0;
+  // Executes the statement as a part of a body
+  virtual Completion Run(Runtime::Scope scope) { return { Execute(scope) }; }
+  // Assigns the variables the statement accesses to the slots of its frame
+  virtual void Resolve(Resolver&) {}
+  // Emits the code which leaves the value of Execute on the stack, the
+  // statement must have been resolved
+  virtual void Compile(Bytecode::Compiler& compiler) = 0;
 };
 
 template<typename T>
@@ -28,7 +47,16 @@ struct ValueStatement : Statement
     : value_(std::move(v))
   {}
 
-  ObjectHolder Execute(Runtime::Closure&) override { return ObjectHolder::Share(value_); }
+  ObjectHolder Execute(Runtime::Scope) override
+  {
+    // numbers and bools are copied inline, the rest is shared
+    if constexpr (std::is_same_v<T, Runtime::Number> || std::is_same_v<T, Runtime::Bool>) {
+      return ObjectHolder::Own(T(value_));
+    } else {
+      return ObjectHolder::Share(value_);
+    }
+  }
+  void Compile(Bytecode::Compiler& compiler) override { compiler.AddConstant(ObjectHolder::Own(T(value_))); }
 };
 
 using NumericConst = ValueStatement<Runtime::Number>;
@@ -38,34 +66,48 @@ using BoolConst = ValueStatement<Runtime::Bool>;
 struct VariableValue : Statement
 {
   std::vector<std::string> dotted_ids_;
+  // symbols of the fields which follow the variable
+  std::vector<Runtime::Symbol> field_symbols_;
+  std::vector<Runtime::FieldCache> field_caches_;
+  size_t slot_ = 0;
 
   explicit VariableValue(std::string var_name);
   explicit VariableValue(std::vector<std::string> dotted_ids);
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 struct Assignment : Statement
 {
   std::string var_name_;
   std::unique_ptr<Statement> right_value_;
+  size_t slot_ = 0;
 
   Assignment(std::string var, std::unique_ptr<Statement> rv);
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 struct FieldAssignment : Statement
 {
   VariableValue object_;
   std::string field_name_;
+  Runtime::Symbol field_symbol_;
+  Runtime::FieldCache field_cache_;
   std::unique_ptr<Statement> right_value_;
 
   FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 struct None : Statement
 {
-  ObjectHolder Execute(Runtime::Closure&) override { return ObjectHolder(); }
+  ObjectHolder Execute(Runtime::Scope) override { return ObjectHolder(); }
+  void Compile(Bytecode::Compiler& compiler) override { compiler.AddNone(); }
 };
 
 class Print : public Statement
@@ -76,9 +118,12 @@ public:
 
   static std::unique_ptr<Print> Variable(std::string name);
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
   static void SetOutputStream(std::ostream& output_stream);
+  static std::ostream& GetOutputStream();
 
 private:
   std::vector<std::unique_ptr<Statement>> args_;
@@ -90,10 +135,13 @@ struct MethodCall : Statement
   std::unique_ptr<Statement> object_;
   std::string method_;
   std::vector<std::unique_ptr<Statement>> args_;
+  Runtime::MethodCache method_cache_;
 
   MethodCall(std::unique_ptr<Statement> object, std::string method, std::vector<std::unique_ptr<Statement>> args);
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 struct NewInstance : Statement
@@ -103,7 +151,9 @@ struct NewInstance : Statement
 
   NewInstance(const Runtime::Class& cls);
   NewInstance(const Runtime::Class& cls, std::vector<std::unique_ptr<Statement>> args);
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class UnaryOperation : public Statement
@@ -113,6 +163,8 @@ public:
     : argument_(std::move(argument))
   {}
 
+  void Resolve(Resolver& resolver) override;
+
 protected:
   std::unique_ptr<Statement> argument_;
 };
@@ -121,7 +173,8 @@ class Stringify : public UnaryOperation
 {
 public:
   using UnaryOperation::UnaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class BinaryOperation : public Statement
@@ -132,6 +185,8 @@ public:
     , rhs_(std::move(rhs))
   {}
 
+  void Resolve(Resolver& resolver) override;
+
 protected:
   std::unique_ptr<Statement> lhs_, rhs_;
 };
@@ -140,49 +195,56 @@ class Add : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Sub : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Mult : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Div : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Or : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class And : public BinaryOperation
 {
 public:
   using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Not : public UnaryOperation
 {
 public:
   using UnaryOperation::UnaryOperation;
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 };
 
 class Compound : public Statement
@@ -196,7 +258,11 @@ public:
 
   void AddStatement(std::unique_ptr<Statement> stmt) { statements_.push_back(std::move(stmt)); }
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  // Value of the return statement, if any
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  Completion Run(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
 private:
   std::vector<std::unique_ptr<Statement>> statements_;
@@ -209,7 +275,10 @@ public:
     : statement_(std::move(statement))
   {}
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  Completion Run(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
 private:
   std::unique_ptr<Statement> statement_;
@@ -220,7 +289,11 @@ class ClassDefinition : public Statement
 public:
   explicit ClassDefinition(ObjectHolder cls);
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  // Resolves and compiles the methods of the class, each into a frame of its
+  // own
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
 private:
   ObjectHolder cls_;
@@ -234,7 +307,10 @@ public:
          std::unique_ptr<Statement> if_body,
          std::unique_ptr<Statement> else_body);
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  Completion Run(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
 private:
   std::unique_ptr<Statement> condition_, if_body_, else_body_;
@@ -247,7 +323,9 @@ public:
 
   Comparison(Comparator cmp, std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs);
 
-  ObjectHolder Execute(Runtime::Closure& closure) override;
+  ObjectHolder Execute(Runtime::Scope scope) override;
+  void Resolve(Resolver& resolver) override;
+  void Compile(Bytecode::Compiler& compiler) override;
 
 private:
   Comparator comparator_;
@@ -115,7 +115,7 @@ TestFieldAssignment()
     ASSERT(o);
     ASSERT_OBJECT_VALUE_EQUAL(o, 57);
   }
-  ASSERT(object.Fields().find("x") != object.Fields().end());
+  ASSERT(object.Fields().Find("x"));
   ASSERT_OBJECT_VALUE_EQUAL(object.Fields().at("x"), 57);
 
   assign_y.Execute(closure);
@@ -128,9 +128,9 @@ TestFieldAssignment()
     ASSERT_OBJECT_VALUE_EQUAL(o, "Hello, world! Hooray! Yes-yes!!!");
   }
 
-  ASSERT(object.Fields().find("y") != object.Fields().end());
+  ASSERT(object.Fields().Find("y"));
   auto subobject = object.Fields().at("y").TryAs<Runtime::ClassInstance>();
-  ASSERT(subobject && subobject->Fields().find("z") != subobject->Fields().end());
+  ASSERT(subobject && subobject->Fields().Find("z"));
   ASSERT_OBJECT_VALUE_EQUAL(subobject->Fields().at("z"), "Hello, world! Hooray! Yes-yes!!!");
 }
 
@@ -274,6 +274,26 @@ TestCompound()
   ASSERT(!result);
 }
 
+void
+TestReturn()
+{
+  Compound cpd{
+    make_unique<Assignment>("x", make_unique<NumericConst>(1)),
+    make_unique<IfElse>(make_unique<VariableValue>("x"),
+                        make_unique<Compound>(make_unique<Return>(make_unique<StringConst>("one"s)),
+                                              make_unique<Assignment>("y", make_unique<NumericConst>(2))),
+                        nullptr),
+    make_unique<Assignment>("z", make_unique<NumericConst>(3)),
+  };
+
+  Closure closure;
+  auto result = cpd.Execute(closure);
+
+  ASSERT_OBJECT_VALUE_EQUAL(result, "one");
+  ASSERT_EQUAL(closure.size(), 1u);
+  ASSERT(closure.count("x"));
+}
+
 void
 RunUnitTests(TestRunner& tr)
 {
@@ -291,6 +311,7 @@ RunUnitTests(TestRunner& tr)
   RUN_TEST(tr, Ast::TestSuccessfullClassInstanceAdd);
   RUN_TEST(tr, Ast::TestClassInstanceAddWithoutMethod);
   RUN_TEST(tr, Ast::TestCompound);
+  RUN_TEST(tr, Ast::TestReturn);
 }
 
 } /* namespace Ast */
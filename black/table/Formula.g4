@@ -9,10 +9,16 @@ expr
     | (ADD | SUB) expr  # UnaryOp
     | expr (MUL | DIV) expr  # BinaryOp
     | expr (ADD | SUB) expr  # BinaryOp
+    | FUNCTION '(' arg (',' arg)* ')'  # Function
     | CELL  # Cell
     | NUMBER  # Literal
     ;
 
+arg
+    : CELL ':' CELL  # RangeArg
+    | expr  # ExprArg
+    ;
+
 
 // number literals cannot be signed, or else 1-2 would be lexed as [1] [-2]
 fragment INT: [-+]? UINT ;
@@ -27,5 +33,6 @@ ADD: '+' ;
 SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
+FUNCTION: 'SUM' | 'MIN' | 'MAX' | 'AVG' | 'COUNT' ;
 CELL: [A-Z]+[0-9]+ ;
 WS: [ \t\n\r]+ -> skip ;
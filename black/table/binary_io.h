@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Appends values to a buffer as they are laid out in memory
+class BinaryWriter
+{
+public:
+  template<typename T>
+  void Write(T value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are written as they are");
+    buffer_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  // Strings are prefixed by their sizes
+  void WriteString(std::string_view str)
+  {
+    Write(static_cast<uint32_t>(str.size()));
+    buffer_.append(str);
+  }
+
+  const std::string& GetBuffer() const { return buffer_; }
+
+private:
+  std::string buffer_;
+};
+
+// Reads values written by BinaryWriter. SnapshotException is thrown when the
+// data ends too early
+class BinaryReader
+{
+public:
+  explicit BinaryReader(std::string_view data)
+    : data_(data)
+  {}
+
+  template<typename T>
+  T Read()
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are read as they are");
+    Require(sizeof(T));
+    T value;
+    std::memcpy(&value, data_.data(), sizeof(T));
+    data_.remove_prefix(sizeof(T));
+    return value;
+  }
+
+  // Points into the data, so it stays valid as long as the data does
+  std::string_view ReadString()
+  {
+    const auto size = Read<uint32_t>();
+    Require(size);
+    const auto str = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return str;
+  }
+
+  // Reads a number of items which take at least item_size bytes each. Counts
+  // which the rest of the data cannot hold are rejected before anything is
+  // allocated for them
+  size_t ReadCount(size_t item_size)
+  {
+    const size_t count = Read<uint32_t>();
+    Require(count * item_size);
+    return count;
+  }
+
+  bool IsEmpty() const { return data_.empty(); }
+
+private:
+  void Require(size_t size) const
+  {
+    if (data_.size() < size) {
+      throw SnapshotException("Unexpected end of snapshot");
+    }
+  }
+
+  std::string_view data_;
+};
@@ -1,19 +1,26 @@
 #include "common.h"
+#include "binary_io.h"
 #include "formula.h"
+#include "slot_pool.h"
+#include "small_vector.h"
 #include "table.h"
+#include "thread_pool.h"
+#include "versions.h"
 
 #include <algorithm>
 #include <charconv>
 #include <deque>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <list>
+#include <numeric>
 #include <set>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
-#include <chrono>
-#include <thread>
-
 using namespace std;
 
 bool
@@ -129,6 +136,12 @@ ParseValue(string_view str)
   return string(str);
 }
 
+bool
+IsFormula(string_view text)
+{
+  return !text.empty() && text.front() == kFormulaSign;
+}
+
 } // namespace
 
 string
@@ -154,6 +167,45 @@ Position::FromString(string_view str)
   return row_num && col_num && str.empty() ? Position{ row_num - 1, col_num - 1 } : Position{ -1, -1 };
 }
 
+bool
+Range::operator==(const Range& other) const
+{
+  return first == other.first && last == other.last;
+}
+
+bool
+Range::operator<(const Range& other) const
+{
+  return tie(first, last) < tie(other.first, other.last);
+}
+
+bool
+Range::IsValid() const
+{
+  return first.IsValid() && last.IsValid() && first.row <= last.row && first.col <= last.col;
+}
+
+bool
+Range::Contains(const Position& pos) const
+{
+  return pos.row >= first.row && pos.row <= last.row && pos.col >= first.col && pos.col <= last.col;
+}
+
+string
+Range::ToString() const
+{
+  if (!IsValid())
+    return {};
+
+  return first.ToString() + ':' + last.ToString();
+}
+
+Range
+Range::FromCorners(const Position& lhs, const Position& rhs)
+{
+  return Range{ { min(lhs.row, rhs.row), min(lhs.col, rhs.col) }, { max(lhs.row, rhs.row), max(lhs.col, rhs.col) } };
+}
+
 bool
 Size::operator==(const Size& other) const
 {
@@ -196,69 +248,156 @@ operator<<(ostream& output, FormulaError fe)
   return output << fe.ToString();
 }
 
-class ICellImpl;
-using ICellImplPtr = shared_ptr<ICellImpl>;
+CircularDependencyException::CircularDependencyException(const string& what, vector<Position> path)
+  : runtime_error(what)
+  , path_(move(path))
+{}
 
-class ICellId : weak_ptr<ICellImpl>
+namespace {
+
+[[noreturn]] void
+ThrowCircularDependency(vector<Position> path)
 {
-public:
-  ICellId() = default;
-  ICellId(ICellImplPtr ptr)
-    : weak_ptr<ICellImpl>(ptr)
-  {}
-
-  ICellImplPtr Get() const { return lock(); }
-  bool operator<(const ICellId& other) const { return owner_before(other); }
-  bool operator==(const ICellId& other) const { return !owner_before(other) && !other.owner_before(*this); }
-};
+  string message = "Circular dependency detected:";
+  for (size_t i = 0; i < path.size(); ++i) {
+    message += (i == 0 ? " " : " -> ") + path[i].ToString();
+  }
+  throw CircularDependencyException(message, move(path));
+}
+
+} // namespace
+
+class ISheetImpl;
+
+// Cells live in a pool of the sheet and refer to each other by handles, which
+// become stale once the referred cell is erased
+using CellHandle = PoolHandle;
+using CellHandles = SmallVector<CellHandle, 2>;
 
 class ICellImpl : public ICell
 {
 public:
-  ~ICellImpl() override;
+  // Cells are kept in a topological order: a cell goes after all the cells it
+  // references. A new cell without references may be put anywhere
+  ICellImpl(ISheetImpl& owner, int64_t order);
 
   Value GetValue() const override;
   string GetText() const override;
   vector<Position> GetReferencedCells() const override;
 
-  static ICellImplPtr Create(ISheet& owner);
+  // Throws CircularDependencyException if references of the formula lead to
+  // a cycle. Otherwise moves the cell after the referenced ones
+  void AssertCircularDependency(const IFormula& formula);
+
+  CellHandle GetHandle() const noexcept { return handle_; }
+  void SetHandle(CellHandle handle) noexcept { handle_ = handle; }
 
-  void AssertCircularDependency(const vector<Position>& positions) const;
+  const Position& GetPosition() const noexcept { return position_; }
+  void SetPosition(const Position& position) noexcept { position_ = position; }
 
-  ICellId GetId() const noexcept { return id_; }
+  // Calls func for every existing cell this one references, directly or
+  // through ranges. A cell may be visited more than once
+  template<typename F>
+  void ForEachReferenced(F func) const;
+
+  // Calls func for every cell referencing this one, directly or through
+  // ranges. A cell may be visited more than once
+  template<typename F>
+  void ForEachDependent(F func) const;
 
   bool IsEmpty() const noexcept { return text_.empty() && !formula_.get(); }
+  bool IsDirty() const noexcept { return !cached_value_; }
+  bool HasDependents() const;
+
+  // Evaluates the cell assuming that its referenced cells are up to date.
+  // Cells may be updated concurrently as long as they do not reference each
+  // other
+  void Update() const { cached_value_ = Compute(); }
 
   void SetText(string text);
 
+  // Same as SetText for an already parsed formula of the text, if any, but
+  // without checking its references for cycles
+  void SetContent(string text, unique_ptr<IFormula> formula);
+
+  // Cells loaded at once are put in order all together
+  void SetOrder(int64_t order) noexcept { order_ = order; }
+
   IFormula* GetFormula() const noexcept;
-  void SetFormulaText(const IFormula& formula);
 
+  // Brings the ranges in line with the formula after its references have
+  // been moved. The text follows on demand
+  void UpdateFormula();
+
+  // Lists the formula in the sheet indices of range dependents and of
+  // referenced lines
+  void SubscribeReferences();
+  void UnsubscribeReferences();
+
+  // Drops cached values of the cell and of all cells depending on it
   void Invalidate(bool referenced);
 
-  void AddDependencyFrom(const ICellId& cell_id);
-  void RemoveDependencyFrom(const ICellId& cell_id);
+  void AddDependencyTo(CellHandle handle);
+  void RemoveDependencyTo(CellHandle handle);
+
+  // Unsubscribes from the referenced cells and invalidates the dependent ones
+  // before the cell is erased
+  void Detach();
+
+  // Lists the cell and the ones depending on it to be copied to the next
+  // published version
+  void MarkUnpublished();
+
+  // Copies the cell to be published, with its value if it is up to date
+  unique_ptr<CellVersion> Publish();
 
-  void AddDependencyTo(const ICellId& cell_id);
-  void RemoveDependencyTo(const ICellId& cell_id);
+  // Writes the cell to a snapshot, referenced cells are written by indices
+  // given by index_of
+  template<typename F>
+  void Save(BinaryWriter& writer, bool with_value, F index_of) const;
+
+  // Restores a new cell written by Save, referenced cells are given by
+  // handle_of. Ranges are subscribed, and the cell subscribes to the
+  // referenced ones
+  template<typename F>
+  void Load(BinaryReader& reader, bool with_value, F handle_of);
 
 private:
-  ICellImpl(ISheet& owner);
-  void SetId(ICellId id) { id_ = id; }
+  // Pearce-Kelly reordering after adding a reference to a cell which goes
+  // after this one
+  void Reorder(ICellImpl* referenced_cell);
+
+  Value Compute() const;
 
   static ICellImpl* GetImpl(ICell* cell) { return static_cast<ICellImpl*>(cell); }
+  static const ICellImpl* GetImpl(const ICell* cell) { return static_cast<const ICellImpl*>(cell); }
 
-  ISheet& owner_;
+  ISheetImpl& owner_;
+  int64_t order_ = 0;
 
-  string text_;
+  // empty for a formula whose text is to be rendered again
+  mutable string text_;
   mutable optional<Value> cached_value_;
 
-  mutable ICellId id_;
+  CellHandle handle_;
+  Position position_;
 
-  set<ICellId> deps_from_;
-  set<ICellId> deps_to_;
+  // referenced cells, sorted, and cells referencing this one, unordered
+  CellHandles deps_from_;
+  CellHandles deps_to_;
 
   unique_ptr<IFormula> formula_;
+
+  // ranges of the formula, cells inside them are not listed in deps_from_
+  vector<Range> ranges_;
+
+  // the last referenced row and column, if any, with the slots of the cell
+  // in the sheet indices of referenced lines
+  Position last_referenced_{ -1, -1 };
+  uint32_t row_slot_ = 0;
+  uint32_t col_slot_ = 0;
+
+  bool is_unpublished_ = false;
 };
 
 class ISheetImpl : public ISheet
@@ -267,6 +406,7 @@ public:
   ISheetImpl();
 
   virtual void SetCell(Position pos, std::string text) override;
+  virtual void LoadCells(std::vector<std::pair<Position, std::string>> cells) override;
   virtual const ICell* GetCell(Position pos) const override;
   virtual ICell* GetCell(Position pos) override;
 
@@ -282,103 +422,429 @@ public:
   virtual void PrintValues(std::ostream& output) const override;
   virtual void PrintTexts(std::ostream& output) const override;
 
+  virtual void SaveSnapshot(std::ostream& output, bool with_values = true) const override;
+
+  // Fills an empty sheet from a snapshot written by SaveSnapshot
+  void LoadSnapshot(BinaryReader& reader);
+
+  virtual void Recalculate() const override;
+
+  virtual void ForEachCell(const Range& range, const std::function<void(const ICell&)>& visitor) const override;
+
+  virtual void PublishVersion() override;
+  virtual void ReadVersion(const std::function<void(const ISheetVersion&)>& reader) const override;
+
+  // Cells are tracked for the next version once one has been published,
+  // unless all of them are going to be copied anyway
+  bool TracksUnpublished() const { return is_versioned_ && !republish_all_; }
+  void AddUnpublished(const Position& pos) { unpublished_.push_back(pos); }
+
+  ICellImpl* GetImpl(CellHandle handle) { return cells_.Get(handle); }
+  const ICellImpl* GetImpl(CellHandle handle) const { return cells_.Get(handle); }
+
+  template<typename F>
+  void ForEachCellIn(const Range& range, F func)
+  {
+    table_.ForEachIn(range.first.row,
+                     range.last.row + 1,
+                     range.first.col,
+                     range.last.col + 1,
+                     [this, &func](int, int, CellHandle handle) { func(GetImpl(handle)); });
+  }
+
+  RangeIndex<CellHandle>& GetRangeDependents() { return range_dependents_; }
+  LineIndex<CellHandle>& GetReferencedRows() { return referenced_rows_; }
+  LineIndex<CellHandle>& GetReferencedCols() { return referenced_cols_; }
+
 private:
   void AssertValidPosition(const Position& pos) const;
-
-  Table2<ICellImplPtr> table_;
+  void UpdatePrintable(const Position& pos, bool was_printable, bool is_printable);
+
+  template<typename F>
+  void Print(ostream& output, F print_cell) const;
+
+  // Moves cells below and to the right of moved_from to their new positions
+  // after a structural change. Formulas referencing lines from first_line on
+  // update their references, the others are not touched
+  template<typename F>
+  void UpdateFormulas(const Position& moved_from,
+                      const LineIndex<CellHandle>& referenced_lines,
+                      int first_line,
+                      F handle_formula);
+
+  CellHandle CreateCell(const Position& pos, int64_t order);
+  void EraseCell(CellHandle handle);
+
+  SlotPool<ICellImpl> cells_;
+  SparseTable<CellHandle> table_;
+  OccupancyIndex printable_rows_;
+  OccupancyIndex printable_cols_;
+
+  // formula cells by the ranges they reference
+  RangeIndex<CellHandle> range_dependents_;
+
+  // formula cells by the last row and the last column they reference
+  LineIndex<CellHandle> referenced_rows_;
+  LineIndex<CellHandle> referenced_cols_;
+
+  // bounds of the cells topological order
+  int64_t lowest_order_ = 0;
+  int64_t highest_order_ = 0;
+
+  SheetVersions versions_;
+  bool is_versioned_ = false;
+  bool republish_all_ = false;
+  // positions of changed and erased cells since the last version, they are
+  // not moved by structural changes which republish all cells
+  vector<Position> unpublished_;
 };
 
-ICellImpl::~ICellImpl()
+template<typename F>
+void
+ICellImpl::ForEachReferenced(F func) const
 {
-  for (auto& dep_to : deps_to_) {
-    if (auto cell = dep_to.Get()) {
-      cell->Invalidate(false);
+  for (auto dep_from : deps_from_) {
+    if (auto cell = owner_.GetImpl(dep_from)) {
+      func(cell);
     }
   }
+  for (const auto& range : ranges_) {
+    owner_.ForEachCellIn(range, func);
+  }
 }
 
-ICellImplPtr
-ICellImpl::Create(ISheet& owner)
+template<typename F>
+void
+ICellImpl::ForEachDependent(F func) const
 {
-  ICellImplPtr res = shared_ptr<ICellImpl>(new ICellImpl(owner));
-  res->SetId(res);
-  return res;
+  for (auto dep_to : deps_to_) {
+    if (auto cell = owner_.GetImpl(dep_to)) {
+      func(cell);
+    }
+  }
+  owner_.GetRangeDependents().ForEachContaining(position_, [this, &func](CellHandle handle) {
+    if (auto cell = owner_.GetImpl(handle)) {
+      func(cell);
+    }
+  });
 }
 
 void
-ICellImpl::AssertCircularDependency(const vector<Position>& positions) const
+ICellImpl::AssertCircularDependency(const IFormula& formula)
 {
-  set<ICellId> cache;
-
-  vector<ICellId> queue;
-  queue.reserve(positions.size());
-  for (const auto& position : positions) {
-    if (auto cell = owner_.GetCell(position)) {
-      queue.push_back(GetImpl(cell)->GetId());
+  auto assert_referenced = [this](ICellImpl* cell) {
+    if (cell == this) {
+      ThrowCircularDependency({ position_, position_ });
+    }
+    if (cell && cell->order_ > order_) {
+      Reorder(cell);
     }
+  };
+
+  for (const auto& position : formula.GetReferencedCells()) {
+    assert_referenced(GetImpl(owner_.GetCell(position)));
+  }
+  for (const auto& range : formula.GetReferencedRanges()) {
+    owner_.ForEachCellIn(range, assert_referenced);
   }
+}
 
-  for (size_t i = 0; i < queue.size(); ++i) {
-    if (queue[i] == id_) {
-      throw CircularDependencyException("Circular dependency detected");
-    }
-    if (cache.insert(queue[i]).second) {
-      if (auto cell = queue[i].Get()) {
-        queue.insert(end(queue), begin(cell->deps_from_), end(cell->deps_from_));
+void
+ICellImpl::Reorder(ICellImpl* referenced_cell)
+{
+  const int64_t lower = order_;
+  const int64_t upper = referenced_cell->order_;
+
+  // cells depending on this one which are not yet after the referenced cell
+  vector<ICellImpl*> forward = { this };
+  unordered_map<const ICellImpl*, const ICellImpl*> parents = { { this, nullptr } };
+  for (size_t i = 0; i < forward.size(); ++i) {
+    forward[i]->ForEachDependent([&](ICellImpl* cell) {
+      if (cell == referenced_cell) {
+        vector<Position> cycle = { position_, referenced_cell->position_ };
+        for (const ICellImpl* parent = forward[i]; parent; parent = parents[parent]) {
+          cycle.push_back(parent->position_);
+        }
+        ThrowCircularDependency(move(cycle));
       }
-    }
+      if (cell->order_ < upper && parents.emplace(cell, forward[i]).second) {
+        forward.push_back(cell);
+      }
+    });
+  }
+
+  // cells the referenced one depends on which are not yet before this one
+  vector<ICellImpl*> backward = { referenced_cell };
+  unordered_set<const ICellImpl*> visited = { referenced_cell };
+  for (size_t i = 0; i < backward.size(); ++i) {
+    backward[i]->ForEachReferenced([&](ICellImpl* cell) {
+      if (cell->order_ > lower && visited.insert(cell).second) {
+        backward.push_back(cell);
+      }
+    });
+  }
+
+  // both sets keep their relative order and take the same positions, the
+  // backward set first
+  auto by_order = [](const ICellImpl* lhs, const ICellImpl* rhs) { return lhs->order_ < rhs->order_; };
+  sort(begin(forward), end(forward), by_order);
+  sort(begin(backward), end(backward), by_order);
+
+  vector<int64_t> orders;
+  orders.reserve(forward.size() + backward.size());
+  for (const auto* cell : backward) {
+    orders.push_back(cell->order_);
+  }
+  for (const auto* cell : forward) {
+    orders.push_back(cell->order_);
+  }
+  sort(begin(orders), end(orders));
+
+  auto order_it = begin(orders);
+  for (auto* cell : backward) {
+    cell->order_ = *order_it++;
+  }
+  for (auto* cell : forward) {
+    cell->order_ = *order_it++;
   }
 }
 
-ICellImpl::ICellImpl(ISheet& owner)
+ICellImpl::ICellImpl(ISheetImpl& owner, int64_t order)
   : owner_(owner)
+  , order_(order)
+  , cached_value_(string())
 {}
 
+bool
+ICellImpl::HasDependents() const
+{
+  return any_of(begin(deps_to_), end(deps_to_), [this](CellHandle dep_to) { return owner_.GetImpl(dep_to); });
+}
+
 void
-ICellImpl::AddDependencyFrom(const ICellId& cell_id)
+ICellImpl::AddDependencyTo(CellHandle handle)
 {
-  deps_from_.insert(cell_id);
+  // callers never subscribe twice, so there is no lookup here
+  deps_to_.push_back(handle);
 }
 
 void
-ICellImpl::RemoveDependencyFrom(const ICellId& cell_id)
+ICellImpl::RemoveDependencyTo(CellHandle handle)
 {
-  auto it = deps_from_.find(cell_id);
-  if (it != end(deps_from_)) {
-    deps_from_.erase(it);
+  auto it = find(begin(deps_to_), end(deps_to_), handle);
+  if (it != end(deps_to_)) {
+    deps_to_.erase_unordered(it);
   }
 }
 
 void
-ICellImpl::AddDependencyTo(const ICellId& cell_id)
+ICellImpl::Detach()
 {
-  deps_to_.insert(cell_id);
+  MarkUnpublished();
+  for (auto dep_from : deps_from_) {
+    if (auto cell = owner_.GetImpl(dep_from)) {
+      cell->RemoveDependencyTo(handle_);
+    }
+  }
+  deps_from_.clear();
+  UnsubscribeReferences();
+  ranges_.clear();
+
+  ForEachDependent([](ICellImpl* cell) { cell->Invalidate(false); });
 }
 
 void
-ICellImpl::RemoveDependencyTo(const ICellId& cell_id)
+ICellImpl::SubscribeReferences()
 {
-  auto it = deps_to_.find(cell_id);
-  if (it != end(deps_to_)) {
-    deps_to_.erase(it);
+  for (const auto& range : ranges_) {
+    owner_.GetRangeDependents().Add(range, handle_);
+    last_referenced_.row = max(last_referenced_.row, range.last.row);
+    last_referenced_.col = max(last_referenced_.col, range.last.col);
+  }
+  if (formula_) {
+    for (const auto& pos : formula_->GetReferencedCells()) {
+      last_referenced_.row = max(last_referenced_.row, pos.row);
+      last_referenced_.col = max(last_referenced_.col, pos.col);
+    }
+  }
+
+  if (last_referenced_.IsValid()) {
+    row_slot_ = static_cast<uint32_t>(owner_.GetReferencedRows().Add(last_referenced_.row, handle_));
+    col_slot_ = static_cast<uint32_t>(owner_.GetReferencedCols().Add(last_referenced_.col, handle_));
+  }
+}
+
+void
+ICellImpl::UnsubscribeReferences()
+{
+  for (const auto& range : ranges_) {
+    owner_.GetRangeDependents().Remove(range, handle_);
+  }
+
+  if (last_referenced_.IsValid()) {
+    if (auto moved = owner_.GetReferencedRows().Remove(last_referenced_.row, row_slot_)) {
+      owner_.GetImpl(*moved)->row_slot_ = row_slot_;
+    }
+    if (auto moved = owner_.GetReferencedCols().Remove(last_referenced_.col, col_slot_)) {
+      owner_.GetImpl(*moved)->col_slot_ = col_slot_;
+    }
+  }
+  last_referenced_ = { -1, -1 };
+}
+
+namespace {
+
+enum class ValueType : uint8_t
+{
+  Dirty,
+  Text,
+  Number,
+  Error
+};
+
+void
+WriteValue(BinaryWriter& writer, const optional<ICell::Value>& value)
+{
+  if (!value) {
+    writer.Write(ValueType::Dirty);
+  } else if (auto text = get_if<string>(&*value)) {
+    writer.Write(ValueType::Text);
+    writer.WriteString(*text);
+  } else if (auto number = get_if<double>(&*value)) {
+    writer.Write(ValueType::Number);
+    writer.Write(*number);
+  } else {
+    writer.Write(ValueType::Error);
+    writer.Write(get<FormulaError>(*value).GetCategory());
+  }
+}
+
+optional<ICell::Value>
+ReadValue(BinaryReader& reader)
+{
+  switch (reader.Read<ValueType>()) {
+    case ValueType::Dirty:
+      return nullopt;
+    case ValueType::Text:
+      return string(reader.ReadString());
+    case ValueType::Number:
+      return reader.Read<double>();
+    case ValueType::Error: {
+      const auto category = reader.Read<FormulaError::Category>();
+      if (category > FormulaError::Category::Div0) {
+        break;
+      }
+      return FormulaError(category);
+    }
+  }
+  throw SnapshotException("Malformed cell value");
+}
+
+} // namespace
+
+template<typename F>
+void
+ICellImpl::Save(BinaryWriter& writer, bool with_value, F index_of) const
+{
+  writer.Write(order_);
+  writer.WriteString(GetText());
+  writer.Write(static_cast<uint8_t>(formula_ != nullptr));
+  if (formula_) {
+    formula_->Save(writer);
+  }
+
+  // handles of erased cells are dropped lazily, they are not written
+  auto is_live = [this](CellHandle dep_from) { return owner_.GetImpl(dep_from) != nullptr; };
+  writer.Write(static_cast<uint32_t>(count_if(begin(deps_from_), end(deps_from_), is_live)));
+  for (auto dep_from : deps_from_) {
+    if (is_live(dep_from)) {
+      writer.Write(index_of(dep_from));
+    }
+  }
+
+  if (with_value) {
+    WriteValue(writer, cached_value_);
   }
 }
 
+template<typename F>
+void
+ICellImpl::Load(BinaryReader& reader, bool with_value, F handle_of)
+{
+  order_ = reader.Read<int64_t>();
+  text_ = reader.ReadString();
+  if (reader.Read<uint8_t>() != 0) {
+    formula_ = LoadFormula(reader);
+    ranges_ = formula_->GetReferencedRanges();
+    SubscribeReferences();
+  }
+
+  const size_t deps_count = reader.ReadCount(sizeof(uint32_t));
+  for (size_t i = 0; i < deps_count; ++i) {
+    const auto handle = handle_of(reader.Read<uint32_t>());
+    deps_from_.push_back(handle);
+    owner_.GetImpl(handle)->AddDependencyTo(handle_);
+  }
+  sort(begin(deps_from_), end(deps_from_));
+
+  // cells are linked by the stored references, which have to be those of the
+  // formula
+  vector<Position> referenced_positions;
+  referenced_positions.reserve(deps_from_.size());
+  for (auto dep_from : deps_from_) {
+    referenced_positions.push_back(owner_.GetImpl(dep_from)->GetPosition());
+  }
+  sort(begin(referenced_positions), end(referenced_positions));
+  if (referenced_positions != GetReferencedCells()) {
+    throw SnapshotException("Cell references do not match the formula");
+  }
+
+  cached_value_ = with_value ? ReadValue(reader) : nullopt;
+}
+
 ICell::Value
 ICellImpl::GetValue() const
 {
-  auto set_cached_val = [this](const auto& val) { cached_value_ = val; };
-  if (!cached_value_) {
-    if (auto formula = GetFormula()) {
-      auto formula_val = formula->Evaluate(owner_);
-      visit(set_cached_val, formula_val);
-    } else {
-      visit(set_cached_val, ParseValue(text_));
+  if (cached_value_) {
+    return *cached_value_;
+  }
+
+  // Referenced cells are evaluated first, in topological order, so formulas
+  // only read cached values and deep chains do not recurse
+  vector<const ICellImpl*> stack = { this };
+  while (!stack.empty()) {
+    const ICellImpl* cell = stack.back();
+    if (cell->cached_value_) {
+      stack.pop_back();
+      continue;
+    }
+
+    bool ready = true;
+    cell->ForEachReferenced([&](const ICellImpl* referenced_cell) {
+      if (!referenced_cell->cached_value_) {
+        stack.push_back(referenced_cell);
+        ready = false;
+      }
+    });
+
+    if (ready) {
+      cell->Update();
+      stack.pop_back();
     }
   }
   return *cached_value_;
 }
 
+ICell::Value
+ICellImpl::Compute() const
+{
+  auto to_value = [](const auto& val) { return Value(val); };
+  if (auto formula = GetFormula()) {
+    return visit(to_value, formula->Evaluate(owner_));
+  }
+  return visit(to_value, ParseValue(text_));
+}
+
 vector<Position>
 ICellImpl::GetReferencedCells() const
 {
@@ -388,58 +854,72 @@ ICellImpl::GetReferencedCells() const
 void
 ICellImpl::SetText(string text)
 {
-  if (text == text_) {
+  if (text == GetText()) {
     return;
   }
 
-  if (!text.empty() && text.front() == kFormulaSign) {
+  if (IsFormula(text)) {
     auto formula = ParseFormula(string(next(begin(text)), end(text)));
-    auto referenced_positions = formula->GetReferencedCells();
+    AssertCircularDependency(*formula);
+    SetContent(move(text), move(formula));
+  } else {
+    SetContent(move(text), nullptr);
+  }
+}
 
-    AssertCircularDependency(referenced_positions);
+void
+ICellImpl::SetContent(string text, unique_ptr<IFormula> formula)
+{
+  MarkUnpublished();
+  if (formula) {
+    auto referenced_positions = formula->GetReferencedCells();
 
     Invalidate(false);
 
+    UnsubscribeReferences();
+    ranges_ = formula->GetReferencedRanges();
     formula_ = move(formula);
     text_ = move(text);
+    SubscribeReferences();
 
-    set<ICellId> new_deps_from;
+    // referenced positions are unique, and so are the cells
+    CellHandles new_deps_from;
     for (auto referenced_pos : referenced_positions) {
       auto referenced_cell = owner_.GetCell(referenced_pos);
       if (!referenced_cell) {
         owner_.SetCell(referenced_pos, "");
         referenced_cell = owner_.GetCell(referenced_pos);
       }
-      new_deps_from.insert(GetImpl(referenced_cell)->GetId());
+      new_deps_from.push_back(GetImpl(referenced_cell)->GetHandle());
     }
+    sort(begin(new_deps_from), end(new_deps_from));
 
     {
-      set<ICellId> deps_from_to_unsubscribe;
-      set_difference(begin(new_deps_from),
-                     end(new_deps_from),
-                     begin(deps_from_),
+      vector<CellHandle> deps_from_to_unsubscribe;
+      set_difference(begin(deps_from_),
                      end(deps_from_),
-                     inserter(deps_from_to_unsubscribe, begin(deps_from_to_unsubscribe)));
+                     begin(new_deps_from),
+                     end(new_deps_from),
+                     back_inserter(deps_from_to_unsubscribe));
 
-      for (const auto& dep_id_to_unsubscribe : deps_from_to_unsubscribe) {
-        if (auto cell = dep_id_to_unsubscribe.Get()) {
-          GetImpl(cell.get())->RemoveDependencyTo(GetId());
+      for (auto dep_to_unsubscribe : deps_from_to_unsubscribe) {
+        if (auto cell = owner_.GetImpl(dep_to_unsubscribe)) {
+          cell->RemoveDependencyTo(handle_);
         }
       }
     }
 
     {
-      set<ICellId> deps_from_to_subscribe;
+      vector<CellHandle> deps_from_to_subscribe;
       set_difference(begin(new_deps_from),
                      end(new_deps_from),
                      begin(deps_from_),
                      end(deps_from_),
-                     inserter(deps_from_to_subscribe, begin(deps_from_to_subscribe)));
+                     back_inserter(deps_from_to_subscribe));
 
-      for (const auto& dep_id_to_subscribe : deps_from_to_subscribe) {
-        if (auto cell = dep_id_to_subscribe.Get()) {
-          GetImpl(cell.get())->AddDependencyTo(GetId());
-          AddDependencyFrom(GetImpl(cell.get())->GetId());
+      for (auto dep_to_subscribe : deps_from_to_subscribe) {
+        if (auto cell = owner_.GetImpl(dep_to_subscribe)) {
+          cell->AddDependencyTo(handle_);
         }
       }
     }
@@ -448,10 +928,12 @@ ICellImpl::SetText(string text)
 
   } else {
     Invalidate(false);
+    UnsubscribeReferences();
     formula_.reset();
-    for (const auto& dep_from : deps_from_) {
-      if (auto cell = dep_from.Get()) {
-        GetImpl(cell.get())->RemoveDependencyFrom(GetId());
+    ranges_.clear();
+    for (auto dep_from : deps_from_) {
+      if (auto cell = owner_.GetImpl(dep_from)) {
+        cell->RemoveDependencyTo(handle_);
       }
     }
     deps_from_.clear();
@@ -466,36 +948,77 @@ ICellImpl::GetFormula() const noexcept
 }
 
 void
-ICellImpl::SetFormulaText(const IFormula& formula)
+ICellImpl::UpdateFormula()
 {
-  text_ = "="s + formula.GetExpression();
+  text_.clear();
+  ranges_ = formula_->GetReferencedRanges();
 }
 
 void
 ICellImpl::Invalidate(bool referenced)
 {
   if (referenced) {
-    for (auto dep_from_it = begin(deps_from_); dep_from_it != end(deps_from_);) {
-      if (dep_from_it->Get()) {
-        ++dep_from_it;
-      } else {
-        dep_from_it = deps_from_.erase(dep_from_it);
-      }
-    }
+    auto is_stale = [this](CellHandle dep_from) { return !owner_.GetImpl(dep_from); };
+    deps_from_.erase(remove_if(begin(deps_from_), end(deps_from_), is_stale), end(deps_from_));
   }
 
-  for (auto& dep_to : deps_to_) {
-    if (auto pointing_cell = dep_to.Get()) {
-      pointing_cell->Invalidate(false);
-    }
+  // Dependents of a dirty cell are dirty as well, so the walk stops at cells
+  // which have no cached value
+  if (!cached_value_) {
+    return;
   }
 
   cached_value_.reset();
+  vector<ICellImpl*> queue = { this };
+  for (size_t i = 0; i < queue.size(); ++i) {
+    queue[i]->ForEachDependent([&queue](ICellImpl* pointing_cell) {
+      if (pointing_cell->cached_value_) {
+        pointing_cell->cached_value_.reset();
+        queue.push_back(pointing_cell);
+      }
+    });
+  }
+}
+
+void
+ICellImpl::MarkUnpublished()
+{
+  // Dependents of an unpublished cell are unpublished as well, so the walk
+  // stops at such cells
+  if (is_unpublished_ || !owner_.TracksUnpublished()) {
+    return;
+  }
+
+  is_unpublished_ = true;
+  vector<ICellImpl*> queue = { this };
+  for (size_t i = 0; i < queue.size(); ++i) {
+    owner_.AddUnpublished(queue[i]->position_);
+    queue[i]->ForEachDependent([&queue](ICellImpl* pointing_cell) {
+      if (!pointing_cell->is_unpublished_) {
+        pointing_cell->is_unpublished_ = true;
+        queue.push_back(pointing_cell);
+      }
+    });
+  }
+}
+
+unique_ptr<CellVersion>
+ICellImpl::Publish()
+{
+  is_unpublished_ = false;
+  auto version = make_unique<CellVersion>(GetText(), formula_ ? formula_->Clone() : nullptr);
+  if (!formula_ || cached_value_) {
+    version->SetValue(GetValue());
+  }
+  return version;
 }
 
 string
 ICellImpl::GetText() const
 {
+  if (text_.empty() && formula_) {
+    text_ = kFormulaSign + formula_->GetExpression();
+  }
   return text_;
 }
 
@@ -505,19 +1028,205 @@ void
 ISheetImpl::SetCell(Position pos, string text)
 {
   AssertValidPosition(pos);
-  auto& existing_cell = table_(pos);
-  if (!existing_cell) {
-    existing_cell = ICellImpl::Create(*this);
+  auto& handle = table_(pos);
+  if (!handle) {
+    // A cell without references precedes all the others. A formula cell goes
+    // after them unless some range referencing it is there already
+    bool is_referenced = false;
+    range_dependents_.ForEachContaining(pos, [&is_referenced](CellHandle) { is_referenced = true; });
+    const bool is_formula = IsFormula(text);
+    handle = CreateCell(pos, is_formula && !is_referenced ? ++highest_order_ : --lowest_order_);
+  }
+
+  // the table slot may move while referenced cells are being created, the
+  // cell itself stays in place
+  auto cell = GetImpl(handle);
+  const bool was_printable = !cell->IsEmpty();
+  cell->SetText(move(text));
+  UpdatePrintable(pos, was_printable, !cell->IsEmpty());
+}
+
+namespace {
+
+// Orders formulas, sorted by their positions, so that every formula goes after
+// the ones it references. Throws CircularDependencyException if there is a
+// cycle
+vector<size_t>
+SortFormulas(const vector<pair<Position, const IFormula*>>& formulas)
+{
+  auto lower_bound_at = [&formulas](auto first, const Position& pos) {
+    return lower_bound(first, end(formulas), pos, [](const auto& formula, const Position& pos) {
+      return formula.first < pos;
+    });
+  };
+
+  // edges go from referenced formulas to referencing ones
+  vector<pair<size_t, size_t>> edges;
+  for (size_t i = 0; i < formulas.size(); ++i) {
+    for (const auto& pos : formulas[i].second->GetReferencedCells()) {
+      if (auto it = lower_bound_at(begin(formulas), pos); it != end(formulas) && it->first == pos) {
+        edges.emplace_back(it - begin(formulas), i);
+      }
+    }
+    // rows and columns of a range without formulas are skipped by searches
+    for (const auto& range : formulas[i].second->GetReferencedRanges()) {
+      auto it = lower_bound_at(begin(formulas), range.first);
+      while (it != end(formulas) && it->first.row <= range.last.row) {
+        if (it->first.col < range.first.col) {
+          it = lower_bound_at(it, Position{ it->first.row, range.first.col });
+        } else if (it->first.col > range.last.col) {
+          it = lower_bound_at(it, Position{ it->first.row + 1, range.first.col });
+        } else {
+          edges.emplace_back(it - begin(formulas), i);
+          ++it;
+        }
+      }
+    }
+  }
+
+  // dependents of the i-th formula are [offsets[i], offsets[i + 1])
+  vector<size_t> offsets(formulas.size() + 1);
+  vector<size_t> pending(formulas.size());
+  for (auto [from, to] : edges) {
+    ++offsets[from + 1];
+    ++pending[to];
+  }
+  partial_sum(begin(offsets), end(offsets), begin(offsets));
+  vector<size_t> dependents(edges.size());
+  {
+    vector<size_t> cursors(begin(offsets), prev(end(offsets)));
+    for (auto [from, to] : edges) {
+      dependents[cursors[from]++] = to;
+    }
+  }
+
+  // Kahn's algorithm
+  vector<size_t> order;
+  order.reserve(formulas.size());
+  for (size_t i = 0; i < formulas.size(); ++i) {
+    if (pending[i] == 0) {
+      order.push_back(i);
+    }
+  }
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (size_t j = offsets[order[i]]; j < offsets[order[i] + 1]; ++j) {
+      if (--pending[dependents[j]] == 0) {
+        order.push_back(dependents[j]);
+      }
+    }
+  }
+  if (order.size() == formulas.size()) {
+    return order;
+  }
+
+  // Every formula left references another one left, so following such
+  // references leads to a cycle
+  constexpr size_t kNone = numeric_limits<size_t>::max();
+  vector<size_t> referenced(formulas.size(), kNone);
+  for (auto [from, to] : edges) {
+    if (pending[from] != 0 && pending[to] != 0) {
+      referenced[to] = from;
+    }
+  }
+  size_t current = find_if(begin(pending), end(pending), [](size_t count) { return count != 0; }) - begin(pending);
+  vector<size_t> steps(formulas.size(), kNone);
+  vector<Position> path;
+  for (; steps[current] == kNone; current = referenced[current]) {
+    steps[current] = path.size();
+    path.push_back(formulas[current].first);
+  }
+  path.erase(begin(path), begin(path) + steps[current]);
+  path.push_back(formulas[current].first);
+  ThrowCircularDependency(move(path));
+}
+
+} // namespace
+
+void
+ISheetImpl::LoadCells(vector<pair<Position, string>> cells)
+{
+  for (const auto& [pos, text] : cells) {
+    AssertValidPosition(pos);
+  }
+
+  // the last text of a position wins
+  auto by_position = [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; };
+  if (!is_sorted(begin(cells), end(cells), by_position)) {
+    stable_sort(begin(cells), end(cells), by_position);
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (i + 1 == cells.size() || !(cells[i].first == cells[i + 1].first)) {
+      if (count != i) {
+        cells[count] = move(cells[i]);
+      }
+      ++count;
+    }
+  }
+  cells.resize(count);
+
+  vector<unique_ptr<IFormula>> formulas(cells.size());
+  ThreadPool::GetDefault().ParallelFor(cells.size(), [&cells, &formulas](size_t i) {
+    if (const auto& text = cells[i].second; IsFormula(text)) {
+      formulas[i] = ParseFormula(text.substr(1));
+    }
+  });
+
+  auto is_loaded = [&cells](const Position& pos) {
+    auto it = lower_bound(
+      begin(cells), end(cells), pos, [](const auto& cell, const Position& pos) { return cell.first < pos; });
+    return it != end(cells) && it->first == pos;
+  };
+
+  // formulas of the table as it is going to be
+  vector<pair<Position, const IFormula*>> all_formulas;
+  table_.ForEach([&](int i, int j, CellHandle handle) {
+    if (auto formula = GetImpl(handle)->GetFormula(); formula && !is_loaded({ i, j })) {
+      all_formulas.emplace_back(Position{ i, j }, formula);
+    }
+  });
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (formulas[i]) {
+      all_formulas.emplace_back(cells[i].first, formulas[i].get());
+    }
+  }
+  sort(begin(all_formulas), end(all_formulas), by_position);
+  const auto order = SortFormulas(all_formulas);
+
+  // cells are created before the texts are set, so references between loaded
+  // cells do not create empty ones
+  vector<CellHandle> handles;
+  handles.reserve(cells.size());
+  for (const auto& [pos, text] : cells) {
+    auto& handle = table_(pos);
+    if (!handle) {
+      handle = CreateCell(pos, --lowest_order_);
+    }
+    handles.push_back(handle);
+  }
+
+  for (size_t i = 0; i < cells.size(); ++i) {
+    auto& [pos, text] = cells[i];
+    auto cell = GetImpl(handles[i]);
+    if (text != cell->GetText()) {
+      const bool was_printable = !cell->IsEmpty();
+      cell->SetContent(move(text), move(formulas[i]));
+      UpdatePrintable(pos, was_printable, !cell->IsEmpty());
+    }
+  }
+
+  // formula cells go after all the others, in the sorted order
+  for (size_t index : order) {
+    GetImpl(*table_.GetAt(all_formulas[index].first))->SetOrder(++highest_order_);
   }
-  existing_cell->SetText(move(text));
 }
 
 const ICell*
 ISheetImpl::GetCell(Position pos) const
 {
   AssertValidPosition(pos);
-  if (auto res = table_.GetAt(pos)) {
-    return res->get();
+  if (auto handle = table_.GetAt(pos)) {
+    return GetImpl(*handle);
   }
   return nullptr;
 }
@@ -526,8 +1235,8 @@ ICell*
 ISheetImpl::GetCell(Position pos)
 {
   AssertValidPosition(pos);
-  if (auto res = table_.GetAt(pos)) {
-    return res->get();
+  if (auto handle = table_.GetAt(pos)) {
+    return GetImpl(*handle);
   }
   return nullptr;
 }
@@ -536,164 +1245,411 @@ void
 ISheetImpl::ClearCell(Position pos)
 {
   AssertValidPosition(pos);
-  if (table_.GetAt(pos)) {
-    table_(pos).reset();
+  if (auto handle = table_.GetAt(pos)) {
+    auto cell = GetImpl(*handle);
+    UpdatePrintable(pos, !cell->IsEmpty(), false);
+    // referenced cells stay as empty ones to keep track of their dependents
+    if (cell->HasDependents()) {
+      cell->SetText("");
+    } else {
+      EraseCell(*handle);
+      table_.Erase(pos);
+    }
+  }
+}
+
+template<typename F>
+void
+ISheetImpl::UpdateFormulas(const Position& moved_from,
+                           const LineIndex<CellHandle>& referenced_lines,
+                           int first_line,
+                           F handle_formula)
+{
+  table_.ForEachIn(moved_from.row,
+                   Position::kMaxRows,
+                   moved_from.col,
+                   Position::kMaxCols,
+                   [this](int i, int j, CellHandle handle) { GetImpl(handle)->SetPosition({ i, j }); });
+
+  // the index changes while the formulas are handled
+  vector<ICellImpl*> referencing_cells;
+  referenced_lines.ForEachFrom(first_line, [&](CellHandle handle) { referencing_cells.push_back(GetImpl(handle)); });
+
+  // cells are invalidated once all the positions and the indices are up to
+  // date
+  vector<ICellImpl*> changed_cells;
+  for (auto cell : referencing_cells) {
+    cell->UnsubscribeReferences();
+    switch (handle_formula(*cell->GetFormula())) {
+      case IFormula::HandlingResult::ReferencesChanged:
+        changed_cells.push_back(cell);
+        [[fallthrough]];
+      case IFormula::HandlingResult::ReferencesRenamedOnly:
+        cell->UpdateFormula();
+        break;
+      default:
+        break;
+    }
+    cell->SubscribeReferences();
+  }
+
+  for (auto cell : changed_cells) {
+    cell->Invalidate(true);
   }
 }
 
 void
 ISheetImpl::InsertRows(int before, int count)
 {
+  republish_all_ = is_versioned_;
   table_.InsertRows(before, count);
-  table_.ForEach([before, count](auto, auto, const ICellImplPtr* ptr_cell) {
-    if (!ptr_cell) {
-      return;
-    }
-
-    auto cell = *ptr_cell;
-    if (cell && cell->GetFormula()) {
-      auto formula = cell->GetFormula();
-      switch (formula->HandleInsertedRows(before, count)) {
-        case IFormula::HandlingResult::ReferencesChanged:
-          cell->Invalidate(true);
-          [[fallthrough]];
-        case IFormula::HandlingResult::ReferencesRenamedOnly:
-          cell->SetFormulaText(*formula);
-          break;
-        default:
-          break;
-      }
-    }
+  printable_rows_.Insert(before, count);
+  UpdateFormulas({ before + count, 0 }, referenced_rows_, before, [before, count](IFormula& formula) {
+    return formula.HandleInsertedRows(before, count);
   });
 }
 
 void
 ISheetImpl::InsertCols(int before, int count)
 {
+  republish_all_ = is_versioned_;
   table_.InsertCols(before, count);
-  table_.ForEach([before, count](auto, auto, const ICellImplPtr* ptr_cell) {
-    if (!ptr_cell) {
-      return;
-    }
-
-    auto cell = *ptr_cell;
-    if (cell && cell->GetFormula()) {
-      auto formula = cell->GetFormula();
-      switch (formula->HandleInsertedCols(before, count)) {
-        case IFormula::HandlingResult::ReferencesChanged:
-          cell->Invalidate(true);
-          [[fallthrough]];
-        case IFormula::HandlingResult::ReferencesRenamedOnly:
-          cell->SetFormulaText(*formula);
-          break;
-        default:
-          break;
-      }
-    }
+  printable_cols_.Insert(before, count);
+  UpdateFormulas({ 0, before + count }, referenced_cols_, before, [before, count](IFormula& formula) {
+    return formula.HandleInsertedCols(before, count);
   });
 }
 
 void
 ISheetImpl::DeleteRows(int first, int count)
 {
-  table_.DeleteRows(first, count);
-  table_.ForEach([first, count](auto, auto, const ICellImplPtr* ptr_cell) {
-    if (!ptr_cell) {
-      return;
-    }
-
-    auto cell = *ptr_cell;
-    if (cell && cell->GetFormula()) {
-      auto formula = cell->GetFormula();
-      switch (formula->HandleDeletedRows(first, count)) {
-        case IFormula::HandlingResult::ReferencesChanged:
-          cell->Invalidate(true);
-          [[fallthrough]];
-        case IFormula::HandlingResult::ReferencesRenamedOnly:
-          cell->SetFormulaText(*formula);
-          break;
-        default:
-          break;
-      }
+  republish_all_ = is_versioned_;
+  vector<int> cleared_cols;
+  vector<CellHandle> erased_cells;
+  auto collect_cols = [&](auto, auto j, CellHandle handle) {
+    if (!GetImpl(handle)->IsEmpty()) {
+      cleared_cols.push_back(j);
     }
+    erased_cells.push_back(handle);
+  };
+  table_.ForEachIn(first, first + count, 0, Position::kMaxCols, collect_cols);
+
+  table_.DeleteRows(first, count);
+  for (auto handle : erased_cells) {
+    EraseCell(handle);
+  }
+  printable_rows_.Erase(first, count);
+  for (int col : cleared_cols) {
+    printable_cols_.Remove(col);
+  }
+  UpdateFormulas({ first, 0 }, referenced_rows_, first, [first, count](IFormula& formula) {
+    return formula.HandleDeletedRows(first, count);
   });
 }
 
 void
 ISheetImpl::DeleteCols(int first, int count)
 {
-  table_.DeleteCols(first, count);
-  table_.ForEach([first, count](auto, auto, const ICellImplPtr* ptr_cell) {
-    if (!ptr_cell) {
-      return;
-    }
-
-    auto cell = *ptr_cell;
-    if (cell && cell->GetFormula()) {
-      auto formula = cell->GetFormula();
-      switch (formula->HandleDeletedCols(first, count)) {
-        case IFormula::HandlingResult::ReferencesChanged:
-          cell->Invalidate(true);
-          [[fallthrough]];
-        case IFormula::HandlingResult::ReferencesRenamedOnly:
-          cell->SetFormulaText(*formula);
-          break;
-        default:
-          break;
-      }
+  republish_all_ = is_versioned_;
+  vector<int> cleared_rows;
+  vector<CellHandle> erased_cells;
+  auto collect_rows = [&](auto i, auto, CellHandle handle) {
+    if (!GetImpl(handle)->IsEmpty()) {
+      cleared_rows.push_back(i);
     }
+    erased_cells.push_back(handle);
+  };
+  table_.ForEachIn(0, Position::kMaxRows, first, first + count, collect_rows);
+
+  table_.DeleteCols(first, count);
+  for (auto handle : erased_cells) {
+    EraseCell(handle);
+  }
+  printable_cols_.Erase(first, count);
+  for (int row : cleared_rows) {
+    printable_rows_.Remove(row);
+  }
+  UpdateFormulas({ 0, first }, referenced_cols_, first, [first, count](IFormula& formula) {
+    return formula.HandleDeletedCols(first, count);
   });
 }
 
 Size
 ISheetImpl::GetPrintableSize() const
 {
-  int rows = 0;
-  int cols = 0;
-  table_.ForEach([&rows, &cols](auto i, auto j, const ICellImplPtr* cell_ptr) {
-    const int multiplier = cell_ptr && *cell_ptr && !(*cell_ptr)->IsEmpty();
-    rows = max(rows, (i + 1) * multiplier);
-    cols = max(cols, (j + 1) * multiplier);
-  });
-
-  return Size{ rows, cols };
+  return Size{ printable_rows_.GetExtent(), printable_cols_.GetExtent() };
 }
 
+template<typename F>
 void
-ISheetImpl::PrintValues(ostream& output) const
+ISheetImpl::Print(ostream& output, F print_cell) const
 {
   const auto size = GetPrintableSize();
-  for (int i = 0; i < size.rows; ++i) {
-    for (int j = 0; j < size.cols; ++j) {
-      if (j != 0) {
-        output << '\t';
-      }
-      if (const ICellImplPtr* cell_ptr = table_.GetAt(i, j)) {
-        if (cell_ptr->get()) {
-          visit([&output](const auto& val) { output << val; }, (*cell_ptr)->GetValue());
+
+  // cursor is the next cell to be printed
+  int row = 0;
+  int col = 0;
+  auto advance_to = [&](int target_row, int target_col) {
+    for (; row < target_row; ++row, col = 0) {
+      for (; col < size.cols; ++col) {
+        if (col != 0) {
+          output << '\t';
         }
       }
+      output << '\n';
     }
-    output << '\n';
-  }
+    for (; col < target_col; ++col) {
+      if (col != 0) {
+        output << '\t';
+      }
+    }
+  };
+
+  table_.ForEachIn(0, size.rows, 0, size.cols, [&](int i, int j, CellHandle handle) {
+    advance_to(i, j);
+    if (col != 0) {
+      output << '\t';
+    }
+    print_cell(*GetImpl(handle));
+    ++col;
+  });
+  advance_to(size.rows, 0);
+}
+
+void
+ISheetImpl::PrintValues(ostream& output) const
+{
+  Recalculate();
+  Print(output, [&output](const ICellImpl& cell) {
+    visit([&output](const auto& val) { output << val; }, cell.GetValue());
+  });
 }
 
 void
 ISheetImpl::PrintTexts(ostream& output) const
 {
-  const auto size = GetPrintableSize();
-  for (int i = 0; i < size.rows; ++i) {
-    for (int j = 0; j < size.cols; ++j) {
-      if (j != 0) {
-        output << '\t';
+  Print(output, [&output](const ICellImpl& cell) { output << cell.GetText(); });
+}
+
+namespace {
+
+constexpr uint32_t kSnapshotMagic = 0x54454853; // "SHET" in little-endian
+constexpr uint32_t kSnapshotVersion = 1;
+
+} // namespace
+
+void
+ISheetImpl::SaveSnapshot(ostream& output, bool with_values) const
+{
+  // Cells are written in row-major order and refer to each other by their
+  // indices in it. Positions go first, so that all cells can be created
+  // before they are linked
+  vector<const ICellImpl*> cells;
+  vector<uint32_t> indices(cells_.GetCapacity());
+  table_.ForEach([&](auto, auto, CellHandle handle) {
+    indices[handle.index] = static_cast<uint32_t>(cells.size());
+    cells.push_back(GetImpl(handle));
+  });
+
+  BinaryWriter writer;
+  writer.Write(kSnapshotMagic);
+  writer.Write(kSnapshotVersion);
+  writer.Write(static_cast<uint8_t>(with_values));
+  writer.Write(lowest_order_);
+  writer.Write(highest_order_);
+
+  writer.Write(static_cast<uint32_t>(cells.size()));
+  for (auto cell : cells) {
+    writer.Write(cell->GetPosition());
+  }
+  for (auto cell : cells) {
+    cell->Save(writer, with_values, [&indices](CellHandle handle) { return indices[handle.index]; });
+  }
+
+  const auto& buffer = writer.GetBuffer();
+  output.write(buffer.data(), buffer.size());
+}
+
+void
+ISheetImpl::LoadSnapshot(BinaryReader& reader)
+{
+  if (reader.Read<uint32_t>() != kSnapshotMagic) {
+    throw SnapshotException("Not a snapshot of a table");
+  }
+  if (reader.Read<uint32_t>() != kSnapshotVersion) {
+    throw SnapshotException("Unsupported snapshot version");
+  }
+  const bool with_values = reader.Read<uint8_t>() != 0;
+  lowest_order_ = reader.Read<int64_t>();
+  highest_order_ = reader.Read<int64_t>();
+
+  vector<CellHandle> handles(reader.ReadCount(sizeof(Position)));
+  for (auto& handle : handles) {
+    const auto pos = reader.Read<Position>();
+    if (!pos.IsValid() || table_.GetAt(pos)) {
+      throw SnapshotException("Malformed cell position");
+    }
+    handle = table_(pos) = CreateCell(pos, 0);
+  }
+
+  auto handle_of = [&handles](uint32_t index) {
+    if (index >= handles.size()) {
+      throw SnapshotException("Malformed cell reference");
+    }
+    return handles[index];
+  };
+  for (auto handle : handles) {
+    auto cell = GetImpl(handle);
+    cell->Load(reader, with_values, handle_of);
+    UpdatePrintable(cell->GetPosition(), false, !cell->IsEmpty());
+  }
+
+  if (!reader.IsEmpty()) {
+    throw SnapshotException("Unexpected data at the end of snapshot");
+  }
+
+  // values are computed on demand by following references, which must not
+  // lead back to the cell
+  vector<pair<Position, const IFormula*>> formulas;
+  for (auto handle : handles) {
+    if (auto cell = GetImpl(handle); auto formula = cell->GetFormula()) {
+      formulas.emplace_back(cell->GetPosition(), formula);
+    }
+  }
+  auto by_position = [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; };
+  if (!is_sorted(begin(formulas), end(formulas), by_position)) {
+    sort(begin(formulas), end(formulas), by_position);
+  }
+  try {
+    SortFormulas(formulas);
+  } catch (const CircularDependencyException&) {
+    throw SnapshotException("Circular reference in snapshot");
+  }
+}
+
+void
+ISheetImpl::Recalculate() const
+{
+  // Dirty cells are leveled by the longest path from clean ones (Kahn's
+  // algorithm), cells of a level only reference cells of previous levels
+  constexpr size_t kClean = numeric_limits<size_t>::max();
+  vector<const ICellImpl*> dirty_cells;
+  vector<size_t> dirty_indices(cells_.GetCapacity(), kClean);
+  table_.ForEach([&](auto, auto, CellHandle handle) {
+    auto cell = GetImpl(handle);
+    if (cell->IsDirty()) {
+      dirty_indices[handle.index] = dirty_cells.size();
+      dirty_cells.push_back(cell);
+    }
+  });
+
+  vector<size_t> pending(dirty_cells.size());
+  vector<vector<size_t>> dependents(dirty_cells.size());
+  for (size_t i = 0; i < dirty_cells.size(); ++i) {
+    dirty_cells[i]->ForEachReferenced([&, i](const ICellImpl* cell) {
+      if (size_t index = dirty_indices[cell->GetHandle().index]; index != kClean) {
+        dependents[index].push_back(i);
+        ++pending[i];
       }
-      if (const ICellImplPtr* cell_ptr = table_.GetAt(i, j)) {
-        if (cell_ptr->get()) {
-          output << (*cell_ptr)->GetText();
+    });
+  }
+
+  vector<size_t> level;
+  for (size_t i = 0; i < dirty_cells.size(); ++i) {
+    if (pending[i] == 0) {
+      level.push_back(i);
+    }
+  }
+
+  auto& pool = ThreadPool::GetDefault();
+  vector<size_t> next_level;
+  while (!level.empty()) {
+    pool.ParallelFor(level.size(), [&](size_t i) { dirty_cells[level[i]]->Update(); });
+
+    next_level.clear();
+    for (size_t i : level) {
+      for (size_t dependent : dependents[i]) {
+        if (--pending[dependent] == 0) {
+          next_level.push_back(dependent);
         }
       }
     }
-    output << '\n';
+    swap(level, next_level);
+  }
+}
+
+void
+ISheetImpl::ForEachCell(const Range& range, const std::function<void(const ICell&)>& visitor) const
+{
+  table_.ForEachIn(range.first.row,
+                   range.last.row + 1,
+                   range.first.col,
+                   range.last.col + 1,
+                   [this, &visitor](int, int, CellHandle handle) { visitor(*GetImpl(handle)); });
+}
+
+void
+ISheetImpl::PublishVersion()
+{
+  // The first version and the ones after structural changes are made of all
+  // the cells, the others only of the unpublished ones
+  const bool from_scratch = !is_versioned_ || republish_all_;
+  vector<pair<Position, unique_ptr<CellVersion>>> cells;
+  if (from_scratch) {
+    table_.ForEach([&](int i, int j, CellHandle handle) {
+      cells.emplace_back(Position{ i, j }, GetImpl(handle)->Publish());
+    });
+  } else {
+    sort(begin(unpublished_), end(unpublished_));
+    unpublished_.erase(unique(begin(unpublished_), end(unpublished_)), end(unpublished_));
+    for (const auto& pos : unpublished_) {
+      auto handle = table_.GetAt(pos);
+      cells.emplace_back(pos, handle ? GetImpl(*handle)->Publish() : nullptr);
+    }
+  }
+  unpublished_.clear();
+  is_versioned_ = true;
+  republish_all_ = false;
+
+  versions_.Publish(move(cells), GetPrintableSize(), from_scratch);
+}
+
+void
+ISheetImpl::ReadVersion(const std::function<void(const ISheetVersion&)>& reader) const
+{
+  versions_.Read(reader);
+}
+
+CellHandle
+ISheetImpl::CreateCell(const Position& pos, int64_t order)
+{
+  auto handle = cells_.Emplace(*this, order);
+  auto cell = cells_.Get(handle);
+  cell->SetHandle(handle);
+  cell->SetPosition(pos);
+  return handle;
+}
+
+void
+ISheetImpl::EraseCell(CellHandle handle)
+{
+  GetImpl(handle)->Detach();
+  cells_.Erase(handle);
+}
+
+void
+ISheetImpl::UpdatePrintable(const Position& pos, bool was_printable, bool is_printable)
+{
+  if (was_printable == is_printable) {
+    return;
+  }
+
+  if (is_printable) {
+    printable_rows_.Add(pos.row);
+    printable_cols_.Add(pos.col);
+  } else {
+    printable_rows_.Remove(pos.row);
+    printable_cols_.Remove(pos.col);
   }
 }
 
@@ -710,3 +1666,56 @@ CreateSheet()
 {
   return make_unique<ISheetImpl>();
 }
+
+std::unique_ptr<ISheet>
+LoadSnapshot(std::istream& input)
+{
+  ostringstream buffer;
+  buffer << input.rdbuf();
+  const string data = buffer.str();
+  BinaryReader reader(data);
+  auto sheet = make_unique<ISheetImpl>();
+  sheet->LoadSnapshot(reader);
+  return sheet;
+}
+
+void
+LoadDelimited(ISheet& sheet, istream& input, char delimiter)
+{
+  const string data{ istreambuf_iterator<char>(input), istreambuf_iterator<char>() };
+
+  vector<pair<Position, string>> cells;
+  Position pos{ 0, 0 };
+  for (size_t i = 0; i < data.size(); ++i) {
+    string field;
+    if (data[i] == '"') {
+      for (++i; i < data.size(); ++i) {
+        if (data[i] != '"') {
+          field += data[i];
+        } else if (i + 1 < data.size() && data[i + 1] == '"') {
+          field += data[++i];
+        } else {
+          ++i;
+          break;
+        }
+      }
+    }
+    for (; i < data.size() && data[i] != delimiter && data[i] != '\n'; ++i) {
+      field += data[i];
+    }
+    if (!field.empty() && field.back() == '\r' && (i == data.size() || data[i] == '\n')) {
+      field.pop_back();
+    }
+
+    if (!field.empty()) {
+      cells.emplace_back(pos, move(field));
+    }
+    if (i < data.size() && data[i] == '\n') {
+      pos = { pos.row + 1, 0 };
+    } else {
+      ++pos.col;
+    }
+  }
+
+  sheet.LoadCells(move(cells));
+}
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <functional>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -26,6 +28,23 @@ struct Position
   static const int kMaxCols = 16384;
 };
 
+// Rectangle of cells, both corners are included
+struct Range
+{
+  Position first;
+  Position last;
+
+  bool operator==(const Range& rhs) const;
+  bool operator<(const Range& rhs) const;
+
+  bool IsValid() const;
+  bool Contains(const Position& pos) const;
+  std::string ToString() const;
+
+  // Builds a range from any two opposite corners
+  static Range FromCorners(const Position& lhs, const Position& rhs);
+};
+
 struct Size
 {
   int rows = 0;
@@ -77,6 +96,21 @@ public:
 // Cyclic dependency in a formula
 class CircularDependencyException : public std::runtime_error
 {
+public:
+  using std::runtime_error::runtime_error;
+  CircularDependencyException(const std::string& what, std::vector<Position> path);
+
+  // Cells of the cycle in the order of references, the first cell is repeated
+  // at the end: A1 -> B1 -> A1 for A1 = B1 and B1 = A1. May be empty
+  const std::vector<Position>& GetPath() const { return path_; }
+
+private:
+  std::vector<Position> path_;
+};
+
+// Snapshot of a table is malformed or of an unsupported version
+class SnapshotException : public std::runtime_error
+{
 public:
   using std::runtime_error::runtime_error;
 };
@@ -112,6 +146,23 @@ public:
   virtual std::vector<Position> GetReferencedCells() const = 0;
 };
 
+// State of a table as it has been published by ISheet::PublishVersion.
+// Versions never change, so they may be read by any threads at once while the
+// table is being edited
+class ISheetVersion
+{
+public:
+  virtual ~ISheetVersion() = default;
+
+  // Value and text of a cell as ICell would return them, those of an empty
+  // cell if there is none. Values are evaluated on demand and cached without
+  // locks
+  virtual ICell::Value GetValue(Position pos) const = 0;
+  virtual std::string GetText(Position pos) const = 0;
+
+  virtual Size GetPrintableSize() const = 0;
+};
+
 inline constexpr char kFormulaSign = '=';
 inline constexpr char kEscapeSign = '\'';
 
@@ -132,6 +183,13 @@ public:
   //   be interpreted as a formula
   virtual void SetCell(Position pos, std::string text) = 0;
 
+  // Sets contents of many cells at once, as SetCell would do one by one, the
+  // last text wins if a position is repeated. Formulas are parsed in parallel
+  // and circular dependencies are checked once for the resulting table, so
+  // intermediate states do not matter. Values are evaluated lazily. If any
+  // exception is thrown the table is not changed
+  virtual void LoadCells(std::vector<std::pair<Position, std::string>> cells) = 0;
+
   // Returns a pointer to cell or nullptr if a cell does not exist
   virtual const ICell* GetCell(Position pos) const = 0;
   virtual ICell* GetCell(Position pos) = 0;
@@ -160,8 +218,46 @@ public:
   // by tabulation sign. After every row a EOL is printed.
   virtual void PrintValues(std::ostream& output) const = 0;
   virtual void PrintTexts(std::ostream& output) const = 0;
+
+  // Writes the table to a versioned binary snapshot: texts, compiled formulas,
+  // references between cells and, if asked, evaluated values
+  virtual void SaveSnapshot(std::ostream& output, bool with_values = true) const = 0;
+
+  // Calls visitor for every existing cell of the range, row by row
+  virtual void ForEachCell(const Range& range, const std::function<void(const ICell&)>& visitor) const = 0;
+
+  // Evaluates all cells whose values are out of date. Cells which do not
+  // depend on each other are evaluated in parallel. PrintValues does it
+  // before printing, otherwise cells are evaluated lazily by GetValue.
+  virtual void Recalculate() const = 0;
+
+  // Publishes the current state of the table for ReadVersion. The first call
+  // starts tracking of changed cells, so that every next version only copies
+  // cells which have changed or depend on changed ones since the previous
+  // version and shares the rest with it. Structural changes copy all cells.
+  // The table is edited and published by one thread
+  virtual void PublishVersion() = 0;
+
+  // Calls reader with the last published version, or an empty one. However
+  // many versions are published meanwhile, the version stays alive until the
+  // call returns. Any threads may read at once, concurrently with the writer
+  virtual void ReadVersion(const std::function<void(const ISheetVersion&)>& reader) const = 0;
 };
 
 // Create an empty table
 std::unique_ptr<ISheet>
 CreateSheet();
+
+// Restores a table from a snapshot written by ISheet::SaveSnapshot without
+// parsing formulas again. References are only checked to match the formulas
+// and to have no cycles, in a single pass. SnapshotException is thrown if the
+// snapshot is malformed
+std::unique_ptr<ISheet>
+LoadSnapshot(std::istream& input);
+
+// Loads cells from a delimited text, such as CSV or TSV, by ISheet::LoadCells.
+// Lines are rows and fields are cells starting from A1, empty fields are
+// skipped. A field in double quotes may contain delimiters and line breaks,
+// double quotes inside it are doubled
+void
+LoadDelimited(ISheet& sheet, std::istream& input, char delimiter);
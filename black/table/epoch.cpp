@@ -0,0 +1,63 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+using namespace std;
+
+EpochManager::~EpochManager()
+{
+  for (const auto& retired : retired_) {
+    retired.destroy(retired.object);
+  }
+}
+
+EpochManager::Guard::Guard(const EpochManager& manager)
+  : slot_(manager.Pin())
+{}
+
+EpochManager::Guard::~Guard()
+{
+  slot_.store(0, memory_order_release);
+}
+
+atomic<uint64_t>&
+EpochManager::Pin() const
+{
+  // Threads start looking from different slots to contend less. An epoch may
+  // advance between its load and the store to the slot, which is fine: the
+  // writer which has missed the slot has published before the reader looks
+  const size_t start = hash<thread::id>()(this_thread::get_id());
+  for (;;) {
+    for (size_t i = 0; i < kMaxReaders; ++i) {
+      auto& slot = slots_[(start + i) % kMaxReaders];
+      uint64_t free = 0;
+      if (slot.load(memory_order_relaxed) == 0 && slot.compare_exchange_strong(free, epoch_.load())) {
+        return slot;
+      }
+    }
+    this_thread::yield();
+  }
+}
+
+void
+EpochManager::Reclaim()
+{
+  // readers pinned from now on only see what has been published by now
+  uint64_t oldest = epoch_.fetch_add(1) + 1;
+  for (const auto& slot : slots_) {
+    if (const uint64_t pinned = slot.load(); pinned != 0) {
+      oldest = min(oldest, pinned);
+    }
+  }
+
+  // an object retired in an epoch may be reached by readers pinned in it
+  auto it = find_if(begin(retired_), end(retired_), [oldest](const Retired& retired) {
+    return retired.epoch >= oldest;
+  });
+  for (auto reclaimed = begin(retired_); reclaimed != it; ++reclaimed) {
+    reclaimed->destroy(reclaimed->object);
+  }
+  retired_.erase(begin(retired_), it);
+}
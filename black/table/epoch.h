@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Epoch-based reclamation of objects which a single writer shares with many
+// readers. A reader pins the current epoch while it accesses the objects. The
+// writer retires the objects it has unlinked and deletes them once no reader
+// pinned before that is left
+class EpochManager
+{
+public:
+  // readers beyond this number wait for a free slot
+  static constexpr size_t kMaxReaders = 64;
+
+  EpochManager() = default;
+  // Deletes all retired objects, no reader may be active
+  ~EpochManager();
+
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+
+  // Keeps an epoch pinned while it lives. Shared objects must be reached after
+  // the guard is created
+  class Guard
+  {
+  public:
+    explicit Guard(const EpochManager& manager);
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+  private:
+    std::atomic<uint64_t>& slot_;
+  };
+
+  // The object may still be in use by readers, but the ones which come after
+  // the call must not be able to reach it
+  template<typename T>
+  void Retire(const T* object)
+  {
+    retired_.push_back({ object, [](const void* object) { delete static_cast<const T*>(object); }, epoch_.load() });
+  }
+
+  // Starts a new epoch and deletes the retired objects no reader can access
+  void Reclaim();
+
+private:
+  struct Retired
+  {
+    const void* object;
+    void (*destroy)(const void*);
+    uint64_t epoch;
+  };
+
+  std::atomic<uint64_t>& Pin() const;
+
+  // epochs pinned by readers, 0 for a free slot
+  mutable std::array<std::atomic<uint64_t>, kMaxReaders> slots_{};
+  std::atomic<uint64_t> epoch_ = 1;
+
+  // in the order of retirement, and so of epochs
+  std::vector<Retired> retired_;
+};
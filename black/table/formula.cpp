@@ -1,330 +1,1007 @@
 #include "formula.h"
 
+#include "binary_io.h"
 #include "utils.h"
 
+#ifdef FORMULA_ANTLR
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
+#endif
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
-class FormulaNode;
-using FormulaNodePtr = unique_ptr<FormulaNode>;
-class FormulaNode
+// Formula compiled to postfix bytecode. Operands are pushed to a value stack,
+// operators pop their arguments and push the result back. A function call
+// keeps an accumulator of two values on the stack, its arguments are folded
+// into the accumulator one by one
+class FormulaProgram
 {
 public:
-  enum class Type
+  enum class OpCode : uint8_t
   {
-    Unary,
+    Number,
+    Cell,
+    Plus,
+    Minus,
     Add,
     Sub,
     Mul,
     Div,
-    Addr,
-    Num
+    CallBegin,
+    ValueArgument,
+    RangeArgument,
+    CallEnd
   };
 
-  FormulaNode(Type type)
-    : type_(type)
-  {}
+  enum class Function : uint8_t
+  {
+    Sum,
+    Min,
+    Max,
+    Avg,
+    Count
+  };
 
-  virtual ~FormulaNode() = default;
-  virtual IFormula::Value Evaluate(const ISheet& sheet) const = 0;
-  void Out(ostream& os, bool pars) const
+  struct Instruction
   {
-    if (pars) {
-      os << '(';
-    }
-    Out(os);
-    if (pars) {
-      os << ')';
+    OpCode code;
+    Function function; // of the call an argument belongs to
+    union
+    {
+      double number;
+      uint32_t slot;
+    };
+  };
+
+  void AddNumber(double number)
+  {
+    Instruction instruction{ OpCode::Number, {}, {} };
+    instruction.number = number;
+    Push(instruction, 1);
+  }
+
+  void AddCell(string_view strpos)
+  {
+    const auto position = Position::FromString(strpos);
+    if (!position.IsValid()) {
+      throw FormulaException("Trying to create a reference to invalid cell");
     }
+
+    Instruction instruction{ OpCode::Cell, {}, {} };
+    instruction.slot = static_cast<uint32_t>(cells_.size());
+    cells_.push_back(position);
+    Push(instruction, 1);
   }
 
-  virtual void Out(ostream& os) const = 0;
+  void AddUnaryOp(char op) { Push(Instruction{ op == '-' ? OpCode::Minus : OpCode::Plus, {}, {} }, 0); }
 
-  Type GetType() const { return type_; }
+  void AddBinaryOp(char op)
+  {
+    switch (op) {
+      case '+':
+        Push(Instruction{ OpCode::Add, {}, {} }, -1);
+        break;
+      case '-':
+        Push(Instruction{ OpCode::Sub, {}, {} }, -1);
+        break;
+      case '*':
+        Push(Instruction{ OpCode::Mul, {}, {} }, -1);
+        break;
+      case '/':
+        Push(Instruction{ OpCode::Div, {}, {} }, -1);
+        break;
+    }
+  }
 
-private:
-  Type type_;
-};
+  void AddCallBegin(string_view name)
+  {
+    const auto function = ToFunction(name);
+    calls_.push_back(function);
+    Push(Instruction{ OpCode::CallBegin, function, {} }, 2);
+  }
 
-class UnaryOpNode : public FormulaNode
-{
-public:
-  UnaryOpNode(FormulaNodePtr operand, int sign)
-    : FormulaNode(Type::Unary)
-    , operand_(move(operand))
-    , sign_(sign)
-  {}
+  void AddValueArgument() { Push(Instruction{ OpCode::ValueArgument, calls_.back(), {} }, -1); }
 
-  IFormula::Value Evaluate(const ISheet& sheet) const override
+  void AddRangeArgument(string_view first, string_view last)
   {
-    auto res = operand_->Evaluate(sheet);
-    if (holds_alternative<FormulaError>(res)) {
-      return get<FormulaError>(res);
-    } else {
-      return sign_ * get<double>(res);
+    const auto first_position = Position::FromString(first);
+    const auto last_position = Position::FromString(last);
+    if (!first_position.IsValid() || !last_position.IsValid()) {
+      throw FormulaException("Trying to create a reference to invalid range");
     }
+
+    Instruction instruction{ OpCode::RangeArgument, calls_.back(), {} };
+    instruction.slot = static_cast<uint32_t>(ranges_.size());
+    ranges_.push_back(Range::FromCorners(first_position, last_position));
+    Push(instruction, 0);
   }
 
-  void Out(ostream& os) const override
+  void AddCallEnd()
+  {
+    Push(Instruction{ OpCode::CallEnd, calls_.back(), {} }, -1);
+    calls_.pop_back();
+  }
+
+  // Program must leave exactly one value on the stack
+  bool IsComplete() const { return !code_.empty() && depth_ == 1 && calls_.empty(); }
+
+  IFormula::Value Evaluate(const ISheet& sheet) const
   {
-    os << (sign_ < 0 ? '-' : '+');
-    operand_->Out(os, IsAny(operand_->GetType(), Type::Add, Type::Sub));
+    if (max_depth_ <= kFixedStackSize) {
+      double stack[kFixedStackSize];
+      return Run(sheet, stack);
+    }
+
+    vector<double> stack(max_depth_);
+    return Run(sheet, stack.data());
   }
 
+  void Out(ostream& os) const;
+
+  // Instructions are written with their operands only
+  void Save(BinaryWriter& writer) const;
+
+  // Restores a program written by Save. It is checked as the builder checks
+  // a parsed one, so running it never goes beyond its stack and slots
+  static FormulaProgram Load(BinaryReader& reader);
+
+  vector<Position>& GetCells() { return cells_; }
+  const vector<Position>& GetCells() const { return cells_; }
+
+  vector<Range>& GetRanges() { return ranges_; }
+  const vector<Range>& GetRanges() const { return ranges_; }
+
 private:
-  FormulaNodePtr operand_;
-  int sign_ = 1;
-};
+  static constexpr int kFixedStackSize = 32;
 
-class BinaryOpNode : public FormulaNode
-{
-public:
-  BinaryOpNode(FormulaNodePtr lhs, FormulaNodePtr rhs, Type type)
-    : FormulaNode(type)
-    , lhs_(move(lhs))
-    , rhs_(move(rhs))
-  {}
+  // Range values are reduced in blocks of this size
+  static constexpr size_t kBlockSize = 64;
 
-  virtual IFormula::Value ApplyOp(double lhs, double rhs) const = 0;
-  IFormula::Value Evaluate(const ISheet& sheet) const override final
+  void Push(Instruction instruction, int depth_change)
   {
-    const auto lhs_res = lhs_->Evaluate(sheet);
-    const auto rhs_res = rhs_->Evaluate(sheet);
-    if (holds_alternative<FormulaError>(lhs_res)) {
-      return lhs_res;
+    if (depth_ + depth_change <= 0) {
+      throw FormulaException("Missing operand");
     }
-    if (holds_alternative<FormulaError>(rhs_res)) {
-      return rhs_res;
+    code_.push_back(instruction);
+    depth_ += depth_change;
+    max_depth_ = max(max_depth_, depth_);
+  }
+
+  static Function ToFunction(string_view name);
+  static string_view GetName(Function function);
+
+  static IFormula::Value EvaluateCell(const ISheet& sheet, const Position& position);
+  IFormula::Value Run(const ISheet& sheet, double* stack) const;
+
+  // Accumulator of a call is its running value and the number of arguments
+  static double GetIdentity(Function function);
+  static void Fold(Function function, double* accumulator, const double* values, size_t count);
+  static optional<FormulaError> FoldRange(const ISheet& sheet,
+                                          const Range& range,
+                                          Function function,
+                                          double* accumulator);
+  static IFormula::Value Finish(Function function, const double* accumulator);
+
+  vector<Instruction> code_;
+  vector<Position> cells_;
+  vector<Range> ranges_;
+  int depth_ = 0;
+  int max_depth_ = 0;
+
+  // functions of the calls being built
+  vector<Function> calls_;
+};
+
+FormulaProgram::Function
+FormulaProgram::ToFunction(string_view name)
+{
+  for (auto function : { Function::Sum, Function::Min, Function::Max, Function::Avg, Function::Count }) {
+    if (GetName(function) == name) {
+      return function;
     }
-    const double res = get<double>(ApplyOp(get<double>(lhs_res), get<double>(rhs_res)));
-    return isfinite(res) ? IFormula::Value(res) : IFormula::Value(FormulaError::Category::Div0);
   }
+  throw FormulaException("Unknown function " + string(name));
+}
 
-  const FormulaNode* Left() const { return lhs_.get(); }
-  const FormulaNode* Right() const { return rhs_.get(); }
+string_view
+FormulaProgram::GetName(Function function)
+{
+  switch (function) {
+    case Function::Sum:
+      return "SUM";
+    case Function::Min:
+      return "MIN";
+    case Function::Max:
+      return "MAX";
+    case Function::Avg:
+      return "AVG";
+    case Function::Count:
+      return "COUNT";
+  }
+  return {};
+}
 
-private:
-  FormulaNodePtr lhs_;
-  FormulaNodePtr rhs_;
-};
+double
+FormulaProgram::GetIdentity(Function function)
+{
+  switch (function) {
+    case Function::Min:
+      return numeric_limits<double>::infinity();
+    case Function::Max:
+      return -numeric_limits<double>::infinity();
+    default:
+      return 0.;
+  }
+}
 
-class AddOpNode : public BinaryOpNode
+namespace {
+
+// Reduces values with a few independent accumulators, they break the
+// dependency between iterations and let the compiler use vector registers
+template<typename Op>
+double
+Reduce(const double* values, size_t count, double init, Op op)
 {
-public:
-  AddOpNode(FormulaNodePtr lhs, FormulaNodePtr rhs)
-    : BinaryOpNode(move(lhs), move(rhs), Type::Add)
-  {}
+  double lanes[4] = { init, init, init, init };
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    for (size_t lane = 0; lane < 4; ++lane) {
+      lanes[lane] = op(lanes[lane], values[i + lane]);
+    }
+  }
+  for (; i < count; ++i) {
+    lanes[0] = op(lanes[0], values[i]);
+  }
+  return op(op(lanes[0], lanes[1]), op(lanes[2], lanes[3]));
+}
 
-  IFormula::Value ApplyOp(double lhs, double rhs) const override { return lhs + rhs; }
-  void Out(ostream& os) const override
-  {
-    Left()->Out(os, false);
-    os << '+';
-    Right()->Out(os, false);
+} // namespace
+
+void
+FormulaProgram::Fold(Function function, double* accumulator, const double* values, size_t count)
+{
+  switch (function) {
+    case Function::Sum:
+    case Function::Avg:
+      accumulator[0] += Reduce(values, count, 0., [](double lhs, double rhs) { return lhs + rhs; });
+      break;
+    case Function::Min:
+      accumulator[0] = Reduce(values, count, accumulator[0], [](double lhs, double rhs) { return min(lhs, rhs); });
+      break;
+    case Function::Max:
+      accumulator[0] = Reduce(values, count, accumulator[0], [](double lhs, double rhs) { return max(lhs, rhs); });
+      break;
+    case Function::Count:
+      break;
   }
-};
+  accumulator[1] += static_cast<double>(count);
+}
 
-class SubOpNode : public BinaryOpNode
+optional<FormulaError>
+FormulaProgram::FoldRange(const ISheet& sheet, const Range& range, Function function, double* accumulator)
 {
-public:
-  SubOpNode(FormulaNodePtr lhs, FormulaNodePtr rhs)
-    : BinaryOpNode(move(lhs), move(rhs), Type::Sub)
-  {}
+  if (!range.IsValid()) {
+    return FormulaError::Category::Ref;
+  }
 
-  IFormula::Value ApplyOp(double lhs, double rhs) const override { return lhs - rhs; }
-  void Out(ostream& os) const override
-  {
-    Left()->Out(os, false);
-    os << '-';
-    Right()->Out(os, IsAny(Right()->GetType(), Type::Add, Type::Sub));
+  // numbers of a row go to a contiguous block which is reduced at once
+  optional<FormulaError> error;
+  double block[kBlockSize];
+  size_t block_size = 0;
+  sheet.ForEachCell(range, [&](const ICell& cell) {
+    if (error) {
+      return;
+    }
+    const auto value = cell.GetValue();
+    if (const auto number = get_if<double>(&value)) {
+      block[block_size++] = *number;
+      if (block_size == kBlockSize) {
+        Fold(function, accumulator, block, block_size);
+        block_size = 0;
+      }
+    } else if (const auto text = get_if<string>(&value)) {
+      // empty cells are skipped
+      if (!text->empty()) {
+        error = FormulaError::Category::Value;
+      }
+    } else {
+      error = get<FormulaError>(value);
+    }
+  });
+
+  if (!error) {
+    Fold(function, accumulator, block, block_size);
   }
-};
+  return error;
+}
 
-class MulOpNode : public BinaryOpNode
+IFormula::Value
+FormulaProgram::Finish(Function function, const double* accumulator)
 {
-public:
-  MulOpNode(FormulaNodePtr lhs, FormulaNodePtr rhs)
-    : BinaryOpNode(move(lhs), move(rhs), Type::Mul)
-  {}
+  const double count = accumulator[1];
+  switch (function) {
+    case Function::Sum:
+      return accumulator[0];
+    case Function::Min:
+    case Function::Max:
+      return count != 0. ? accumulator[0] : 0.;
+    case Function::Avg:
+      return count != 0. ? IFormula::Value(accumulator[0] / count) : FormulaError::Category::Div0;
+    case Function::Count:
+      return count;
+  }
+  return 0.;
+}
 
-  IFormula::Value ApplyOp(double lhs, double rhs) const override { return lhs * rhs; }
-  void Out(ostream& os) const override
-  {
-    Left()->Out(os, IsAny(Left()->GetType(), Type::Add, Type::Sub));
-    os << '*';
-    Right()->Out(os, IsAny(Right()->GetType(), Type::Add, Type::Sub));
+IFormula::Value
+FormulaProgram::EvaluateCell(const ISheet& sheet, const Position& position)
+{
+  if (!position.IsValid()) {
+    return FormulaError::Category::Ref;
   }
-};
 
-class DivOpNode : public BinaryOpNode
+  const auto cell = sheet.GetCell(position);
+  if (!cell) {
+    return 0.;
+  }
+
+  return visit(
+    [](const auto& value) -> IFormula::Value {
+      using T = remove_cv_t<remove_reference_t<decltype(value)>>;
+      if constexpr (is_same<string, T>::value) {
+        return value.empty() ? IFormula::Value(0.) : IFormula::Value(FormulaError::Category::Value);
+      } else {
+        return value;
+      }
+    },
+    cell->GetValue());
+}
+
+IFormula::Value
+FormulaProgram::Run(const ISheet& sheet, double* stack) const
 {
-public:
-  DivOpNode(FormulaNodePtr lhs, FormulaNodePtr rhs)
-    : BinaryOpNode(move(lhs), move(rhs), Type::Div)
-  {}
+  // top points past the last pushed value
+  double* top = stack;
+  for (const auto& instruction : code_) {
+    switch (instruction.code) {
+      case OpCode::Number:
+        *top++ = instruction.number;
+        break;
+      case OpCode::Cell: {
+        const auto value = EvaluateCell(sheet, cells_[instruction.slot]);
+        if (holds_alternative<FormulaError>(value)) {
+          return value;
+        }
+        *top++ = get<double>(value);
+        break;
+      }
+      case OpCode::Plus:
+        break;
+      case OpCode::Minus:
+        top[-1] = -top[-1];
+        break;
+      case OpCode::Add:
+        --top;
+        top[-1] += *top;
+        break;
+      case OpCode::Sub:
+        --top;
+        top[-1] -= *top;
+        break;
+      case OpCode::Mul:
+        --top;
+        top[-1] *= *top;
+        break;
+      case OpCode::Div:
+        --top;
+        top[-1] /= *top;
+        break;
+      case OpCode::CallBegin:
+        top[0] = GetIdentity(instruction.function);
+        top[1] = 0.;
+        top += 2;
+        // accumulators may hold infinities until the call ends
+        continue;
+      case OpCode::ValueArgument:
+        --top;
+        Fold(instruction.function, top - 2, top, 1);
+        continue;
+      case OpCode::RangeArgument:
+        if (auto error = FoldRange(sheet, ranges_[instruction.slot], instruction.function, top - 2)) {
+          return *error;
+        }
+        continue;
+      case OpCode::CallEnd: {
+        const auto result = Finish(instruction.function, top - 2);
+        if (holds_alternative<FormulaError>(result)) {
+          return result;
+        }
+        --top;
+        top[-1] = get<double>(result);
+        break;
+      }
+    }
+    if (!isfinite(top[-1])) {
+      return FormulaError::Category::Div0;
+    }
+  }
+  return stack[0];
+}
 
-  IFormula::Value ApplyOp(double lhs, double rhs) const override { return lhs / rhs; }
-  void Out(ostream& os) const override
+void
+FormulaProgram::Out(ostream& os) const
+{
+  // Restores the infix notation keeping only the parentheses required by
+  // operator precedence and associativity
+  struct Operand
   {
-    Left()->Out(os, IsAny(Left()->GetType(), Type::Add, Type::Sub));
-    os << '/';
-    Right()->Out(os, IsAny(Right()->GetType(), Type::Add, Type::Sub, Type::Mul, Type::Div));
+    string text;
+    OpCode code;
+  };
+
+  auto wrap = [](const Operand& operand, bool pars) { return pars ? "(" + operand.text + ")" : operand.text; };
+  auto is_additive = [](OpCode code) { return IsAny(code, OpCode::Add, OpCode::Sub); };
+
+  vector<Operand> operands;
+  auto append_argument = [&operands](const string& argument) {
+    auto& call = operands.back().text;
+    if (call.back() != '(') {
+      call += ',';
+    }
+    call += argument;
+  };
+  for (const auto& instruction : code_) {
+    switch (instruction.code) {
+      case OpCode::Number: {
+        ostringstream number;
+        number << instruction.number;
+        operands.push_back({ number.str(), instruction.code });
+        break;
+      }
+      case OpCode::Cell: {
+        const auto& position = cells_[instruction.slot];
+        operands.push_back({ position.IsValid() ? position.ToString()
+                                                : string(FormulaError(FormulaError::Category::Ref).ToString()),
+                             instruction.code });
+        break;
+      }
+      case OpCode::CallBegin:
+        operands.push_back({ string(GetName(instruction.function)) + '(', instruction.code });
+        break;
+      case OpCode::ValueArgument: {
+        auto argument = move(operands.back());
+        operands.pop_back();
+        append_argument(argument.text);
+        break;
+      }
+      case OpCode::RangeArgument: {
+        const auto& range = ranges_[instruction.slot];
+        append_argument(range.IsValid() ? range.ToString()
+                                        : string(FormulaError(FormulaError::Category::Ref).ToString()));
+        break;
+      }
+      case OpCode::CallEnd:
+        operands.back().text += ')';
+        operands.back().code = instruction.code;
+        break;
+      case OpCode::Plus:
+      case OpCode::Minus: {
+        auto& operand = operands.back();
+        operand.text = (instruction.code == OpCode::Minus ? "-" : "+") + wrap(operand, is_additive(operand.code));
+        operand.code = instruction.code;
+        break;
+      }
+      default: {
+        auto rhs = move(operands.back());
+        operands.pop_back();
+        auto& lhs = operands.back();
+
+        bool lhs_pars = false;
+        bool rhs_pars = false;
+        char op = '+';
+        switch (instruction.code) {
+          case OpCode::Sub:
+            op = '-';
+            rhs_pars = is_additive(rhs.code);
+            break;
+          case OpCode::Mul:
+            op = '*';
+            lhs_pars = is_additive(lhs.code);
+            rhs_pars = is_additive(rhs.code);
+            break;
+          case OpCode::Div:
+            op = '/';
+            lhs_pars = is_additive(lhs.code);
+            rhs_pars = IsAny(rhs.code, OpCode::Add, OpCode::Sub, OpCode::Mul, OpCode::Div);
+            break;
+          default:
+            break;
+        }
+        lhs.text = wrap(lhs, lhs_pars) + op + wrap(rhs, rhs_pars);
+        lhs.code = instruction.code;
+        break;
+      }
+    }
   }
-};
 
-class AddrNode : public FormulaNode
+  if (!operands.empty()) {
+    os << operands.back().text;
+  }
+}
+
+void
+FormulaProgram::Save(BinaryWriter& writer) const
+{
+  writer.Write(static_cast<uint32_t>(cells_.size()));
+  for (const auto& position : cells_) {
+    writer.Write(position);
+  }
+  writer.Write(static_cast<uint32_t>(ranges_.size()));
+  for (const auto& range : ranges_) {
+    writer.Write(range);
+  }
+
+  writer.Write(static_cast<uint32_t>(code_.size()));
+  for (const auto& instruction : code_) {
+    writer.Write(instruction.code);
+    writer.Write(instruction.function);
+    if (instruction.code == OpCode::Number) {
+      writer.Write(instruction.number);
+    } else if (IsAny(instruction.code, OpCode::Cell, OpCode::RangeArgument)) {
+      writer.Write(instruction.slot);
+    }
+  }
+}
+
+FormulaProgram
+FormulaProgram::Load(BinaryReader& reader)
+{
+  auto malformed = [] { return SnapshotException("Malformed formula"); };
+
+  // references deleted by structural edits are kept as #REF!: cells at
+  // (-1, -1) and ranges with a corner moved just before the other one, so
+  // only their coordinates are bounded
+  auto is_bounded = [](const Position& position) {
+    return position.row >= -1 && position.col >= -1 && position.row < Position::kMaxRows &&
+           position.col < Position::kMaxCols;
+  };
+
+  FormulaProgram program;
+  program.cells_.resize(reader.ReadCount(sizeof(Position)));
+  for (auto& position : program.cells_) {
+    position = reader.Read<Position>();
+    if (!position.IsValid() && !(position.row == -1 && position.col == -1)) {
+      throw malformed();
+    }
+  }
+  program.ranges_.resize(reader.ReadCount(sizeof(Range)));
+  for (auto& range : program.ranges_) {
+    range = reader.Read<Range>();
+    if (!range.IsValid() && !(is_bounded(range.first) && is_bounded(range.last))) {
+      throw malformed();
+    }
+  }
+
+  auto read_slot = [&reader, &malformed](size_t slots_count) {
+    const auto slot = reader.Read<uint32_t>();
+    if (slot >= slots_count) {
+      throw malformed();
+    }
+    return slot;
+  };
+
+  // depths of the stack right after the accumulators of the calls
+  vector<int> call_depths;
+  const size_t code_size = reader.ReadCount(sizeof(OpCode) + sizeof(Function));
+  program.code_.reserve(code_size);
+  for (size_t i = 0; i < code_size; ++i) {
+    Instruction instruction{ reader.Read<OpCode>(), reader.Read<Function>(), {} };
+    if (instruction.code > OpCode::CallEnd || instruction.function > Function::Count) {
+      throw malformed();
+    }
+
+    const bool is_argument = IsAny(instruction.code, OpCode::ValueArgument, OpCode::RangeArgument, OpCode::CallEnd);
+    if (is_argument) {
+      const int argument_depth = instruction.code == OpCode::ValueArgument ? 1 : 0;
+      if (call_depths.empty() || program.calls_.back() != instruction.function ||
+          program.depth_ != call_depths.back() + argument_depth) {
+        throw malformed();
+      }
+    }
+
+    // the builder would throw a FormulaException for a missing operand
+    int depth_change = -1;
+    switch (instruction.code) {
+      case OpCode::Number:
+        instruction.number = reader.Read<double>();
+        depth_change = 1;
+        break;
+      case OpCode::Cell:
+        instruction.slot = read_slot(program.cells_.size());
+        depth_change = 1;
+        break;
+      case OpCode::Plus:
+      case OpCode::Minus:
+        depth_change = 0;
+        break;
+      case OpCode::CallBegin:
+        depth_change = 2;
+        break;
+      case OpCode::RangeArgument:
+        instruction.slot = read_slot(program.ranges_.size());
+        depth_change = 0;
+        break;
+      default:
+        break;
+    }
+    if (program.depth_ + depth_change <= 0) {
+      throw malformed();
+    }
+    program.Push(instruction, depth_change);
+
+    if (instruction.code == OpCode::CallBegin) {
+      program.calls_.push_back(instruction.function);
+      call_depths.push_back(program.depth_);
+    } else if (instruction.code == OpCode::CallEnd) {
+      program.calls_.pop_back();
+      call_depths.pop_back();
+    }
+  }
+
+  if (!program.IsComplete()) {
+    throw malformed();
+  }
+  return program;
+}
+
+// Splits an expression into tokens of Formula.g4. Longest match wins, as in
+// the ANTLR lexer, so "A2B" is a cell followed by an invalid character and
+// "SUM" without digits is a function name
+class Tokenizer
 {
 public:
-  AddrNode(string_view strpos)
-    : FormulaNode(Type::Addr)
-    , position_(Position::FromString(strpos))
+  enum class TokenType
   {
-    if (!position_.IsValid()) {
-      throw FormulaException("Trying to create a reference to invalid cell");
-    }
+    Number,
+    Cell,
+    Function,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    LeftPar,
+    RightPar,
+    Colon,
+    Comma,
+    End
+  };
+
+  struct Token
+  {
+    TokenType type;
+    string_view text;
+  };
+
+  explicit Tokenizer(string_view input)
+    : input_(input)
+  {
+    Next();
   }
 
-  IFormula::Value Evaluate(const ISheet& sheet) const override
+  const Token& Current() const { return current_; }
+
+  void Next()
   {
-    if (!position_.IsValid()) {
-      return FormulaError::Category::Ref;
+    while (!input_.empty() && IsAny(input_.front(), ' ', '\t', '\n', '\r')) {
+      input_.remove_prefix(1);
+    }
+    if (input_.empty()) {
+      current_ = { TokenType::End, {} };
+      return;
     }
 
-    const auto cell = sheet.GetCell(position_);
-    if (!cell) {
-      return 0.;
+    const char c = input_.front();
+    if (IsUpper(c)) {
+      const size_t letters = CountWhile(0, IsUpper);
+      const size_t length = CountWhile(letters, IsDigit);
+      Consume(length == letters ? TokenType::Function : TokenType::Cell, length);
+    } else if (IsDigit(c) || c == '.') {
+      Consume(TokenType::Number, NumberLength());
+    } else {
+      switch (c) {
+        case '+':
+          Consume(TokenType::Add, 1);
+          break;
+        case '-':
+          Consume(TokenType::Sub, 1);
+          break;
+        case '*':
+          Consume(TokenType::Mul, 1);
+          break;
+        case '/':
+          Consume(TokenType::Div, 1);
+          break;
+        case '(':
+          Consume(TokenType::LeftPar, 1);
+          break;
+        case ')':
+          Consume(TokenType::RightPar, 1);
+          break;
+        case ':':
+          Consume(TokenType::Colon, 1);
+          break;
+        case ',':
+          Consume(TokenType::Comma, 1);
+          break;
+        default:
+          throw FormulaException("Error when lexing: unexpected character '"s + c + "'");
+      }
     }
+  }
 
-    return visit(
-      [](const auto& value) -> IFormula::Value {
-        using T = remove_cv_t<remove_reference_t<decltype(value)>>;
-        if constexpr (is_same<string, T>::value) {
-          return value.empty() ? IFormula::Value(0) : IFormula::Value(FormulaError::Category::Value);
-        } else {
-          return value;
-        }
-      },
-      cell->GetValue());
+private:
+  static bool IsUpper(char c) { return c >= 'A' && c <= 'Z'; }
+  static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+  template<typename Pred>
+  size_t CountWhile(size_t from, Pred pred) const
+  {
+    while (from < input_.size() && pred(input_[from])) {
+      ++from;
+    }
+    return from;
   }
 
-  void Out(ostream& os) const override
+  // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+  size_t NumberLength() const
   {
-    if (position_.IsValid()) {
-      os << position_.ToString();
-    } else {
-      os << FormulaError(FormulaError::Category::Ref);
+    size_t length = CountWhile(0, IsDigit);
+    if (length < input_.size() && input_[length] == '.') {
+      const size_t fraction = CountWhile(length + 1, IsDigit);
+      if (fraction == length + 1) {
+        throw FormulaException("Error when lexing: number without fractional digits");
+      }
+      length = fraction;
     }
+    if (length < input_.size() && IsAny(input_[length], 'e', 'E')) {
+      size_t exponent = length + 1;
+      if (exponent < input_.size() && IsAny(input_[exponent], '+', '-')) {
+        ++exponent;
+      }
+      const size_t end = CountWhile(exponent, IsDigit);
+      if (end != exponent) {
+        length = end;
+      }
+    }
+    return length;
   }
 
-  const Position& GetPosition() const { return position_; }
-  void SetPosition(Position position) { position_ = position; }
+  void Consume(TokenType type, size_t length)
+  {
+    current_ = { type, input_.substr(0, length) };
+    input_.remove_prefix(length);
+  }
 
-private:
-  Position position_;
+  string_view input_;
+  Token current_;
 };
 
-class NumberNode : public FormulaNode
+// Precedence climbing parser for Formula.g4. Unary operators bind tighter than
+// binary ones, binary operators are left associative
+class ExpressionParser
 {
 public:
-  NumberNode(double val)
-    : FormulaNode(Type::Num)
-    , val_(val)
+  ExpressionParser(string_view input, FormulaProgram& program)
+    : tokenizer_(input)
+    , program_(program)
   {}
 
-  IFormula::Value Evaluate(const ISheet&) const override { return val_; }
-  void Out(ostream& os) const override { os << val_; }
+  void ParseMain()
+  {
+    ParseExpression(0);
+    if (tokenizer_.Current().type != TokenType::End) {
+      throw FormulaException("Unexpected token after the end of expression");
+    }
+  }
 
 private:
-  double val_ = 0.;
-};
+  using TokenType = Tokenizer::TokenType;
 
-struct AddrNodePtrLess
-{
-  bool operator()(const AddrNode* lhs, const AddrNode* rhs) const { return lhs->GetPosition() < rhs->GetPosition(); }
-};
+  static constexpr int kUnaryPower = 3;
 
-struct AddrNodePtrEqual
-{
-  bool operator()(const AddrNode* lhs, const AddrNode* rhs) const { return lhs->GetPosition() == rhs->GetPosition(); }
-};
+  static int GetBinaryPower(TokenType type)
+  {
+    switch (type) {
+      case TokenType::Add:
+      case TokenType::Sub:
+        return 1;
+      case TokenType::Mul:
+      case TokenType::Div:
+        return 2;
+      default:
+        return 0;
+    }
+  }
 
-class ANTLRFormulaListener : public FormulaBaseListener
-{
-public:
-  FormulaNodePtr GetTree() { return FormulaNodePtr(move(ast_)); }
-  vector<AddrNode*> GetAddrNodes()
+  static char GetOperator(TokenType type)
   {
-    sort(begin(addr_nodes_), end(addr_nodes_), AddrNodePtrLess());
-    return move(addr_nodes_);
+    switch (type) {
+      case TokenType::Add:
+        return '+';
+      case TokenType::Sub:
+        return '-';
+      case TokenType::Mul:
+        return '*';
+      default:
+        return '/';
+    }
   }
 
-  void enterMain(FormulaParser::MainContext*) override
+  void ParseExpression(int min_power)
   {
-    ast_.reset();
-    children_.clear();
+    ParseOperand();
+    for (;;) {
+      const auto type = tokenizer_.Current().type;
+      const int power = GetBinaryPower(type);
+      if (power <= min_power) {
+        return;
+      }
+      tokenizer_.Next();
+      ParseExpression(power);
+      program_.AddBinaryOp(GetOperator(type));
+    }
   }
 
-  void exitMain(FormulaParser::MainContext*) override
+  void ParseOperand()
   {
-    if (children_.size() != 1) {
-      throw FormulaException("Wrong number of root tokens");
+    const auto token = tokenizer_.Current();
+    tokenizer_.Next();
+    switch (token.type) {
+      case TokenType::Number:
+        program_.AddNumber(ToNumber(token.text));
+        break;
+      case TokenType::Cell:
+        program_.AddCell(token.text);
+        break;
+      case TokenType::Add:
+      case TokenType::Sub:
+        ParseExpression(kUnaryPower);
+        program_.AddUnaryOp(GetOperator(token.type));
+        break;
+      case TokenType::Function:
+        ParseCall(token.text);
+        break;
+      case TokenType::LeftPar:
+        ParseExpression(0);
+        if (tokenizer_.Current().type != TokenType::RightPar) {
+          throw FormulaException("Missing closing parenthesis");
+        }
+        tokenizer_.Next();
+        break;
+      default:
+        throw FormulaException("Operand expected");
+    }
+  }
+
+  void ParseCall(string_view name)
+  {
+    program_.AddCallBegin(name);
+    if (tokenizer_.Current().type != TokenType::LeftPar) {
+      throw FormulaException("Missing arguments of " + string(name));
     }
+    do {
+      tokenizer_.Next();
+      ParseArgument();
+    } while (tokenizer_.Current().type == TokenType::Comma);
 
-    ast_ = move(children_.back());
-    children_.clear();
+    if (tokenizer_.Current().type != TokenType::RightPar) {
+      throw FormulaException("Missing closing parenthesis");
+    }
+    tokenizer_.Next();
+    program_.AddCallEnd();
   }
 
-  void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override
+  void ParseArgument()
   {
-    FormulaNodePtr operand = move(children_.back());
-    children_.pop_back();
+    // a range starts as a cell, one more token tells them apart
+    if (tokenizer_.Current().type == TokenType::Cell) {
+      auto lookahead = tokenizer_;
+      lookahead.Next();
+      if (lookahead.Current().type == TokenType::Colon) {
+        const auto first = tokenizer_.Current().text;
+        lookahead.Next();
+        if (lookahead.Current().type != TokenType::Cell) {
+          throw FormulaException("Range end expected");
+        }
+        program_.AddRangeArgument(first, lookahead.Current().text);
+        lookahead.Next();
+        tokenizer_ = lookahead;
+        return;
+      }
+    }
 
-    int sign = ctx->ADD() ? 1 : -1;
-    children_.push_back(make_unique<UnaryOpNode>(move(operand), sign));
+    ParseExpression(0);
+    program_.AddValueArgument();
   }
 
-  void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override
+  static double ToNumber(string_view text)
+  {
+    double number = 0.;
+    const auto [ptr, ec] = from_chars(text.data(), text.data() + text.size(), number);
+    if (ec != errc() || ptr != text.data() + text.size()) {
+      throw FormulaException("Invalid number " + string(text));
+    }
+    return number;
+  }
+
+  Tokenizer tokenizer_;
+  FormulaProgram& program_;
+};
+
+#ifdef FORMULA_ANTLR
+class ANTLRFormulaListener : public FormulaBaseListener
+{
+public:
+  FormulaProgram GetProgram() { return move(program_); }
+
+  void enterMain(FormulaParser::MainContext*) override { program_ = FormulaProgram(); }
+
+  void exitMain(FormulaParser::MainContext*) override
   {
-    FormulaNodePtr rhs = move(children_.back());
-    children_.pop_back();
-    FormulaNodePtr lhs = move(children_.back());
-    children_.pop_back();
+    if (!program_.IsComplete()) {
+      throw FormulaException("Wrong number of root tokens");
+    }
+  }
 
-    FormulaNodePtr binary_node;
+  void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override { program_.AddUnaryOp(ctx->ADD() ? '+' : '-'); }
+
+  void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override
+  {
     if (ctx->ADD()) {
-      binary_node = make_unique<AddOpNode>(move(lhs), move(rhs));
+      program_.AddBinaryOp('+');
     } else if (ctx->SUB()) {
-      binary_node = make_unique<SubOpNode>(move(lhs), move(rhs));
+      program_.AddBinaryOp('-');
     } else if (ctx->MUL()) {
-      binary_node = make_unique<MulOpNode>(move(lhs), move(rhs));
+      program_.AddBinaryOp('*');
     } else if (ctx->DIV()) {
-      binary_node = make_unique<DivOpNode>(move(lhs), move(rhs));
+      program_.AddBinaryOp('/');
     }
-    children_.push_back(move(binary_node));
   }
 
-  virtual void enterCell(FormulaParser::CellContext* ctx) override
+  virtual void enterCell(FormulaParser::CellContext* ctx) override { program_.AddCell(ctx->CELL()->getText()); }
+
+  void enterFunction(FormulaParser::FunctionContext* ctx) override
   {
-    auto addr_node = make_unique<AddrNode>(ctx->CELL()->getText());
-    addr_nodes_.push_back(addr_node.get());
-    children_.push_back(move(addr_node));
+    program_.AddCallBegin(ctx->FUNCTION()->getText());
   }
 
+  void exitFunction(FormulaParser::FunctionContext*) override { program_.AddCallEnd(); }
+
+  void enterRangeArg(FormulaParser::RangeArgContext* ctx) override
+  {
+    program_.AddRangeArgument(ctx->CELL(0)->getText(), ctx->CELL(1)->getText());
+  }
+
+  void exitExprArg(FormulaParser::ExprArgContext*) override { program_.AddValueArgument(); }
+
   virtual void exitLiteral(FormulaParser::LiteralContext* ctx) override
   {
-    children_.push_back(make_unique<NumberNode>(stod(ctx->NUMBER()->getText())));
+    program_.AddNumber(stod(ctx->NUMBER()->getText()));
   }
 
 private:
-  FormulaNodePtr ast_;
-  deque<FormulaNodePtr> children_;
-  vector<AddrNode*> addr_nodes_;
+  FormulaProgram program_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener
@@ -341,17 +1018,19 @@ public:
     throw FormulaException("Error when lexing: " + msg);
   }
 };
+#endif
 
 class IFormulaImpl : public IFormula
 {
 public:
-  IFormulaImpl(FormulaNodePtr ast, vector<AddrNode*> addr_nodes);
+  IFormulaImpl(FormulaProgram program);
 
   Value Evaluate(const ISheet& sheet) const override;
 
   string GetExpression() const override;
 
   vector<Position> GetReferencedCells() const override;
+  vector<Range> GetReferencedRanges() const override;
 
   HandlingResult HandleInsertedRows(int before, int count = 1) override;
   HandlingResult HandleInsertedCols(int before, int count = 1) override;
@@ -359,19 +1038,38 @@ public:
   HandlingResult HandleDeletedRows(int first, int count = 1) override;
   HandlingResult HandleDeletedCols(int first, int count = 1) override;
 
+  void Save(BinaryWriter& writer) const override;
+
+  unique_ptr<IFormula> Clone() const override;
+
   void UpdateReferencedCells();
 
 private:
-  FormulaNodePtr ast_;
-  string expression_;
-  vector<AddrNode*> addr_nodes_;
+  FormulaProgram program_;
+  // rendered on demand, formulas loaded or parsed in bulk rarely need it
+  mutable optional<string> expression_;
   vector<Position> referenced_cells_;
+  vector<Range> referenced_ranges_;
 };
 
 std::unique_ptr<IFormula>
 ParseFormula(std::string expression)
 {
-  ostringstream stdinput;
+  FormulaProgram program;
+  ExpressionParser(expression, program).ParseMain();
+  return make_unique<IFormulaImpl>(move(program));
+}
+
+std::unique_ptr<IFormula>
+LoadFormula(BinaryReader& reader)
+{
+  return make_unique<IFormulaImpl>(FormulaProgram::Load(reader));
+}
+
+#ifdef FORMULA_ANTLR
+std::unique_ptr<IFormula>
+ParseFormulaANTLR(std::string expression)
+{
   antlr4::ANTLRInputStream input(expression);
   FormulaLexer lexer(&input);
 
@@ -387,26 +1085,20 @@ ParseFormula(std::string expression)
   parser.removeErrorListeners();
 
   ANTLRFormulaListener listener;
-  FormulaNodePtr ast;
   try {
     antlr4::tree::ParseTree* tree = parser.main();
     antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
-
-    ast = listener.GetTree();
-    if (!ast) {
-      throw FormulaException("Could not build AST tree");
-    }
   } catch (const FormulaException&) {
     throw;
   } catch (...) {
-    throw FormulaException("Could not build AST tree");
+    throw FormulaException("Could not compile formula");
   }
-  return make_unique<IFormulaImpl>(move(ast), listener.GetAddrNodes());
+  return make_unique<IFormulaImpl>(listener.GetProgram());
 }
+#endif
 
-IFormulaImpl::IFormulaImpl(FormulaNodePtr ast, vector<AddrNode*> addr_nodes)
-  : ast_(move(ast))
-  , addr_nodes_(move(addr_nodes))
+IFormulaImpl::IFormulaImpl(FormulaProgram program)
+  : program_(move(program))
 {
   UpdateReferencedCells();
 }
@@ -414,13 +1106,18 @@ IFormulaImpl::IFormulaImpl(FormulaNodePtr ast, vector<AddrNode*> addr_nodes)
 IFormula::Value
 IFormulaImpl::Evaluate(const ISheet& sheet) const
 {
-  return ast_->Evaluate(sheet);
+  return program_.Evaluate(sheet);
 }
 
 string
 IFormulaImpl::GetExpression() const
 {
-  return expression_;
+  if (!expression_) {
+    ostringstream os;
+    program_.Out(os);
+    expression_ = os.str();
+  }
+  return *expression_;
 }
 
 vector<Position>
@@ -429,18 +1126,95 @@ IFormulaImpl::GetReferencedCells() const
   return referenced_cells_;
 }
 
+vector<Range>
+IFormulaImpl::GetReferencedRanges() const
+{
+  return referenced_ranges_;
+}
+
+void
+IFormulaImpl::Save(BinaryWriter& writer) const
+{
+  program_.Save(writer);
+}
+
+unique_ptr<IFormula>
+IFormulaImpl::Clone() const
+{
+  return make_unique<IFormulaImpl>(*this);
+}
+
+namespace {
+
+IFormula::HandlingResult
+Merge(IFormula::HandlingResult lhs, IFormula::HandlingResult rhs)
+{
+  return max(lhs, rhs);
+}
+
+// Updates bounds of a range along one axis for inserted lines. Lines inserted
+// inside a range extend it, lines pushed beyond the table are cut off
+IFormula::HandlingResult
+InsertLines(int& first, int& last, int before, int count, int max_lines)
+{
+  if (last < before) {
+    return IFormula::HandlingResult::NothingChanged;
+  }
+  if (first >= before) {
+    first += count;
+  }
+  last = min(last + count, max_lines - 1);
+  return first <= last ? IFormula::HandlingResult::ReferencesRenamedOnly : IFormula::HandlingResult::ReferencesChanged;
+}
+
+// Updates bounds of a range along one axis for deleted lines, the range shrinks
+// if some of its lines are deleted
+IFormula::HandlingResult
+DeleteLines(int& first, int& last, int first_deleted, int count)
+{
+  if (last < first_deleted) {
+    return IFormula::HandlingResult::NothingChanged;
+  }
+  const int end_deleted = first_deleted + count;
+  const bool deleted = first < end_deleted;
+  first = first < first_deleted ? first : max(first_deleted, first - count);
+  last = last >= end_deleted ? last - count : first_deleted - 1;
+  return deleted ? IFormula::HandlingResult::ReferencesChanged : IFormula::HandlingResult::ReferencesRenamedOnly;
+}
+
+// Ranges which lose all their cells turn into #REF!
+template<typename F>
+IFormula::HandlingResult
+HandleRanges(vector<Range>& ranges, F handle)
+{
+  auto res = IFormula::HandlingResult::NothingChanged;
+  for (auto& range : ranges) {
+    if (!range.IsValid()) {
+      continue;
+    }
+    res = Merge(res, handle(range));
+    if (range.first.row > range.last.row || range.first.col > range.last.col) {
+      range = Range{ { -1, -1 }, { -1, -1 } };
+    }
+  }
+  return res;
+}
+
+} // namespace
+
 IFormula::HandlingResult
 IFormulaImpl::HandleInsertedRows(int before, int count)
 {
   auto res = IFormula::HandlingResult::NothingChanged;
-  for (auto* addr_node : addr_nodes_) {
-    auto pos = addr_node->GetPosition();
+  for (auto& pos : program_.GetCells()) {
     if (pos.row >= before) {
       pos.row += count;
       res = IFormula::HandlingResult::ReferencesRenamedOnly;
-      addr_node->SetPosition(pos);
     }
   }
+  res = Merge(res, HandleRanges(program_.GetRanges(), [before, count](Range& range) {
+    return InsertLines(range.first.row, range.last.row, before, count, Position::kMaxRows);
+  }));
   if (res != IFormula::HandlingResult::NothingChanged) {
     UpdateReferencedCells();
   }
@@ -451,14 +1225,15 @@ IFormula::HandlingResult
 IFormulaImpl::HandleInsertedCols(int before, int count)
 {
   auto res = IFormula::HandlingResult::NothingChanged;
-  for (auto* addr_node : addr_nodes_) {
-    auto pos = addr_node->GetPosition();
+  for (auto& pos : program_.GetCells()) {
     if (pos.col >= before) {
       pos.col += count;
       res = IFormula::HandlingResult::ReferencesRenamedOnly;
-      addr_node->SetPosition(pos);
     }
   }
+  res = Merge(res, HandleRanges(program_.GetRanges(), [before, count](Range& range) {
+    return InsertLines(range.first.col, range.last.col, before, count, Position::kMaxCols);
+  }));
   if (res != IFormula::HandlingResult::NothingChanged) {
     UpdateReferencedCells();
   }
@@ -469,23 +1244,23 @@ IFormula::HandlingResult
 IFormulaImpl::HandleDeletedRows(int first, int count)
 {
   auto res = IFormula::HandlingResult::NothingChanged;
-  for (auto* addr_node : addr_nodes_) {
-    auto pos = addr_node->GetPosition();
+  for (auto& pos : program_.GetCells()) {
     if (pos.row >= first) {
       if (pos.row < first + count) {
         res = IFormula::HandlingResult::ReferencesChanged;
         pos.row = -1;
         pos.col = -1;
-        addr_node->SetPosition(pos);
       } else {
         if (res == IFormula::HandlingResult::NothingChanged) {
           res = IFormula::HandlingResult::ReferencesRenamedOnly;
         }
         pos.row -= count;
-        addr_node->SetPosition(pos);
       }
     }
   }
+  res = Merge(res, HandleRanges(program_.GetRanges(), [first, count](Range& range) {
+    return DeleteLines(range.first.row, range.last.row, first, count);
+  }));
   if (res != IFormula::HandlingResult::NothingChanged) {
     UpdateReferencedCells();
   }
@@ -496,23 +1271,23 @@ IFormula::HandlingResult
 IFormulaImpl::HandleDeletedCols(int first, int count)
 {
   auto res = IFormula::HandlingResult::NothingChanged;
-  for (auto* addr_node : addr_nodes_) {
-    auto pos = addr_node->GetPosition();
+  for (auto& pos : program_.GetCells()) {
     if (pos.col >= first) {
       if (pos.col < first + count) {
         res = IFormula::HandlingResult::ReferencesChanged;
         pos.row = -1;
         pos.col = -1;
-        addr_node->SetPosition(pos);
       } else {
         if (res == IFormula::HandlingResult::NothingChanged) {
           res = IFormula::HandlingResult::ReferencesRenamedOnly;
         }
         pos.col -= count;
-        addr_node->SetPosition(pos);
       }
     }
   }
+  res = Merge(res, HandleRanges(program_.GetRanges(), [first, count](Range& range) {
+    return DeleteLines(range.first.col, range.last.col, first, count);
+  }));
   if (res != IFormula::HandlingResult::NothingChanged) {
     UpdateReferencedCells();
   }
@@ -523,15 +1298,23 @@ void
 IFormulaImpl::UpdateReferencedCells()
 {
   referenced_cells_.clear();
-  referenced_cells_.reserve(addr_nodes_.size());
-  for (const auto& addr_node : addr_nodes_) {
-    if (addr_node && addr_node->GetPosition().IsValid()) {
-      referenced_cells_.push_back(addr_node->GetPosition());
+  referenced_cells_.reserve(program_.GetCells().size());
+  for (const auto& pos : program_.GetCells()) {
+    if (pos.IsValid()) {
+      referenced_cells_.push_back(pos);
     }
   }
+  sort(begin(referenced_cells_), end(referenced_cells_));
   referenced_cells_.erase(unique(begin(referenced_cells_), end(referenced_cells_)), end(referenced_cells_));
 
-  ostringstream os;
-  ast_->Out(os);
-  expression_ = os.str();
+  referenced_ranges_.clear();
+  for (const auto& range : program_.GetRanges()) {
+    if (range.IsValid()) {
+      referenced_ranges_.push_back(range);
+    }
+  }
+  sort(begin(referenced_ranges_), end(referenced_ranges_));
+  referenced_ranges_.erase(unique(begin(referenced_ranges_), end(referenced_ranges_)), end(referenced_ranges_));
+
+  expression_.reset();
 }
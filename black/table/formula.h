@@ -5,9 +5,15 @@
 #include <memory>
 #include <vector>
 
+class BinaryReader;
+class BinaryWriter;
+
 // Formula which allows to evaluate and update arithmetic expressions.
 // * Binary operations and numbers, parantheses: 1+2*3, 2.5*(2+3.5/7)
 // * References to cells: A1+B2*C3
+// * Aggregate functions SUM, MIN, MAX, AVG and COUNT of expressions and
+//   ranges: SUM(A1:C3, D4*2). Empty cells of ranges are skipped, MIN and MAX
+//   of nothing are zero, AVG of nothing is a division by zero error
 // A cell referenced by a formula can be either a formula itself or a text.
 // If it is a text which can be interpreted as a number it will be interpreted
 // as that number. In case of an empty text or empty cell a reference will be
@@ -39,6 +45,11 @@ public:
   // ascending order and does not contain duplicates
   virtual std::vector<Position> GetReferencedCells() const = 0;
 
+  // Returns a list of ranges used by aggregate functions, cells of the ranges
+  // are not included into GetReferencedCells. The list is sorted in ascending
+  // order and does not contain duplicates
+  virtual std::vector<Range> GetReferencedRanges() const = 0;
+
   // Updates a formula for insertion of a given number of rows/columns before
   // a row/column with a given index.
   virtual HandlingResult HandleInsertedRows(int before, int count = 1) = 0;
@@ -51,9 +62,27 @@ public:
   // result in the same error.
   virtual HandlingResult HandleDeletedRows(int first, int count = 1) = 0;
   virtual HandlingResult HandleDeletedCols(int first, int count = 1) = 0;
+
+  // Writes the compiled formula to be restored by LoadFormula
+  virtual void Save(BinaryWriter& writer) const = 0;
+
+  // Copies the compiled formula without parsing it again
+  virtual std::unique_ptr<IFormula> Clone() const = 0;
 };
 
 // Parses an expression and returns a formula object.
 // FormulaException is thrown in case of invalid syntax.
 std::unique_ptr<IFormula>
 ParseFormula(std::string expression);
+
+// Restores a formula written by IFormula::Save without parsing it.
+// SnapshotException is thrown if the data is malformed
+std::unique_ptr<IFormula>
+LoadFormula(BinaryReader& reader);
+
+#ifdef FORMULA_ANTLR
+// Same as ParseFormula, but built by the ANTLR generated parser. Kept to
+// cross-check the hand-written one
+std::unique_ptr<IFormula>
+ParseFormulaANTLR(std::string expression);
+#endif
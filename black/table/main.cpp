@@ -1,6 +1,15 @@
 #include "common.h"
 #include "formula.h"
+#include "profile.h"
+#include "slot_pool.h"
+#include "small_vector.h"
 #include "test_runner.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <random>
+#include <sstream>
+#include <thread>
 
 std::ostream&
 operator<<(std::ostream& output, Position pos)
@@ -19,6 +28,12 @@ operator<<(std::ostream& output, Size size)
   return output << "(" << size.rows << ", " << size.cols << ")";
 }
 
+std::ostream&
+operator<<(std::ostream& output, const Range& range)
+{
+  return output << range.first << ":" << range.last;
+}
+
 std::ostream&
 operator<<(std::ostream& output, const ICell::Value& value)
 {
@@ -26,6 +41,13 @@ operator<<(std::ostream& output, const ICell::Value& value)
   return output;
 }
 
+std::ostream&
+operator<<(std::ostream& output, const IFormula::Value& value)
+{
+  std::visit([&](const auto& x) { output << x; }, value);
+  return output;
+}
+
 std::string_view
 ToString(IFormula::HandlingResult hr)
 {
@@ -185,6 +207,15 @@ TestFormulaArithmetic()
   ASSERT_EQUAL(evaluate("4/2 + 6/3"), 4.);
   ASSERT_EQUAL(evaluate("(2+3)*4 + (3-4)*5"), 15.);
   ASSERT_EQUAL(evaluate("(12+13) * (14+(13-24/(1+1))*55-46)"), 575.);
+  ASSERT_EQUAL(evaluate("-(2-3)*-(-4)"), 4.);
+
+  // operands nested deeper than the evaluation stack fast path
+  std::string nested;
+  for (int i = 0; i < 100; ++i) {
+    nested += "1+(";
+  }
+  nested += "1" + std::string(100, ')');
+  ASSERT_EQUAL(evaluate(nested), 101.);
 }
 
 void
@@ -418,7 +449,7 @@ TestEmptyCellTreatedAsZero()
 {
   auto sheet = CreateSheet();
   sheet->SetCell("A1"_pos, "=B2");
-  ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(0));
+  ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(0.));
 }
 
 void
@@ -585,6 +616,71 @@ TestFormulaIncorrect()
   ASSERT(isIncorrect("2+4-"));
 }
 
+#ifdef FORMULA_ANTLR
+void
+TestFormulaParserCrossCheck()
+{
+  auto parse = [](auto parser, const std::string& expression) -> std::string {
+    try {
+      auto formula = parser(expression);
+      std::ostringstream os;
+      os << formula->GetExpression() << ':';
+      for (const auto& pos : formula->GetReferencedCells()) {
+        os << pos.ToString() << ',';
+      }
+      return os.str();
+    } catch (const FormulaException&) {
+      return "FormulaException";
+    }
+  };
+
+  const std::vector<std::string> expressions = {
+    "1",       "-1",      "+-1",     "--A1",     "1+2*3",     "(1+2)*3",  "-2*3",      "2*-3",     "1-2-3",
+    "1-(2-3)", "1/2/3",   "1/(2*3)", "-(A1+B2)", "A1*(B2-C3)", "1.5e3",   ".5",        "1e-2+3E+2", " 1 + 2 ",
+    "",        "1+",      "()",      "(1",       "1)",       "A2B",      "3X",       "A0++",      "((1)",     "2+4-",
+    "1 2",     "1.",      "1e",      "1.5.5",    "a1",       "XFD16385", "ZZZZ1",    "A1+A1+B2",  "1*/2",     "+",
+  };
+
+  for (const auto& expression : expressions) {
+    ASSERT_EQUAL(parse(ParseFormula, expression), parse(ParseFormulaANTLR, expression));
+  }
+}
+#endif
+
+void
+TestPerformanceParsing()
+{
+  constexpr int formulas_count = 200'000;
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> pos_dist(0, 999);
+  std::vector<std::string> formulas;
+  formulas.reserve(formulas_count);
+  size_t total_size = 0;
+  for (int i = 0; i < formulas_count; ++i) {
+    const auto cell = [&] { return Position{ pos_dist(gen), pos_dist(gen) }.ToString(); };
+    formulas.push_back(cell() + "*(" + cell() + "+1.5)-" + cell() + "/2+" + std::to_string(i));
+    total_size += formulas.back().size();
+  }
+
+  auto bench = [&](const std::string& name, auto parser) {
+    const auto start = std::chrono::steady_clock::now();
+    size_t referenced = 0;
+    for (const auto& formula : formulas) {
+      referenced += parser(formula)->GetReferencedCells().size();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    ASSERT(referenced >= 2 * formulas.size());
+    std::cerr << name << ": " << formulas_count / elapsed.count() << " formulas/s, "
+              << total_size / elapsed.count() / (1 << 20) << " MB/s" << std::endl;
+  };
+
+  bench("Parsing", ParseFormula);
+#ifdef FORMULA_ANTLR
+  bench("Parsing (ANTLR)", ParseFormulaANTLR);
+#endif
+}
+
 void
 TestCellCircularReferences()
 {
@@ -597,8 +693,9 @@ TestCellCircularReferences()
   bool caught = false;
   try {
     sheet->SetCell("M6"_pos, "=E2");
-  } catch (const CircularDependencyException&) {
+  } catch (const CircularDependencyException& e) {
     caught = true;
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "M6"_pos, "E2"_pos, "E4"_pos, "X9"_pos, "M6"_pos }));
   }
 
   ASSERT(caught);
@@ -615,8 +712,162 @@ TestCellCircularReferences()
   try {
     sheet->SetCell("E6"_pos, "=E6");
     ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "E6"_pos, "E6"_pos }));
+  }
+
+  // references dropped by an edit do not count
+  sheet = CreateSheet();
+  sheet->SetCell("B1"_pos, "=A1");
+  sheet->SetCell("B1"_pos, "=C1");
+  sheet->SetCell("A1"_pos, "=B1");
+  sheet->SetCell("B1"_pos, "5");
+  sheet->SetCell("C1"_pos, "=A1");
+  ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), ICell::Value(5.));
+
+  // a cleared cell keeps its dependents
+  sheet->ClearCell("A1"_pos);
+  try {
+    sheet->SetCell("A1"_pos, "=C1");
+    ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "A1"_pos, "C1"_pos, "A1"_pos }));
+  }
+}
+
+void
+TestFormulaRanges()
+{
+  auto reformat = [](std::string expr) { return ParseFormula(std::move(expr))->GetExpression(); };
+  ASSERT_EQUAL(reformat("SUM( A1 : B2 )"), "SUM(A1:B2)");
+  ASSERT_EQUAL(reformat("SUM(B2:A1)"), "SUM(A1:B2)");
+  ASSERT_EQUAL(reformat("(MIN(1, 2+3, A1:A3))*2"), "MIN(1,2+3,A1:A3)*2");
+  ASSERT_EQUAL(reformat("-COUNT(A1)/AVG(SUM(A1:A2),3)"), "-COUNT(A1)/AVG(SUM(A1:A2),3)");
+
+  auto isIncorrect = [](std::string expr) {
+    try {
+      ParseFormula(std::move(expr));
+    } catch (const FormulaException&) {
+      return true;
+    }
+    return false;
+  };
+  ASSERT(isIncorrect("A1:B2"));
+  ASSERT(isIncorrect("SUM()"));
+  ASSERT(isIncorrect("SUM(A1:)"));
+  ASSERT(isIncorrect("SUM(A1:B2+1)"));
+  ASSERT(isIncorrect("SUM(1,)"));
+  ASSERT(isIncorrect("SUM 1"));
+  ASSERT(isIncorrect("MEDIAN(1)"));
+  ASSERT(isIncorrect("SUM(A1:ZZZZ1)"));
+
+  auto formula = ParseFormula("SUM(C3:D4, A1:B2, A1) + B2 + MAX(A1:B2)");
+  ASSERT_EQUAL(formula->GetReferencedCells(), (std::vector{ "A1"_pos, "B2"_pos }));
+  ASSERT_EQUAL(formula->GetReferencedRanges(),
+               (std::vector{ Range{ "A1"_pos, "B2"_pos }, Range{ "C3"_pos, "D4"_pos } }));
+
+  auto sheet = CreateSheet();
+  auto evaluate = [&](std::string expr) { return ParseFormula(std::move(expr))->Evaluate(*sheet); };
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("A2"_pos, "=A1*4");
+  sheet->SetCell("A4"_pos, "-3");
+  sheet->SetCell("B1"_pos, "");
+  ASSERT_EQUAL(evaluate("SUM(A1:B5)"), IFormula::Value(2.));
+  ASSERT_EQUAL(evaluate("MIN(A1:B5)"), IFormula::Value(-3.));
+  ASSERT_EQUAL(evaluate("MAX(A1:B5, 10)"), IFormula::Value(10.));
+  ASSERT_EQUAL(evaluate("AVG(A1:B5, 2*2)"), IFormula::Value(1.5));
+  ASSERT_EQUAL(evaluate("COUNT(A1:B5, 7)"), IFormula::Value(4.));
+
+  // empty cells are skipped
+  ASSERT_EQUAL(evaluate("MIN(C1:C9)"), IFormula::Value(0.));
+  ASSERT_EQUAL(evaluate("COUNT(C1:C9)"), IFormula::Value(0.));
+  ASSERT_EQUAL(evaluate("AVG(C1:C9)"), IFormula::Value(FormulaError::Category::Div0));
+
+  sheet->SetCell("A3"_pos, "text");
+  ASSERT_EQUAL(evaluate("SUM(A1:B5)"), IFormula::Value(FormulaError::Category::Value));
+  sheet->SetCell("A3"_pos, "=1/0");
+  ASSERT_EQUAL(evaluate("SUM(A1:B5)"), IFormula::Value(FormulaError::Category::Div0));
+
+  // more values than a reduction block
+  sheet = CreateSheet();
+  for (int i = 0; i < 1000; ++i) {
+    sheet->SetCell(Position{ i, 0 }, std::to_string(i + 1));
+  }
+  ASSERT_EQUAL(evaluate("SUM(A1:A1000)"), IFormula::Value(500500.));
+  ASSERT_EQUAL(evaluate("MAX(A1:A1000)"), IFormula::Value(1000.));
+  ASSERT_EQUAL(evaluate("AVG(A1:A1000)"), IFormula::Value(500.5));
+}
+
+void
+TestRangeDependencies()
+{
+  auto sheet = CreateSheet();
+  auto value = [&sheet](Position pos) { return sheet->GetCell(pos)->GetValue(); };
+
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("D1"_pos, "=SUM(A1:B3)");
+  sheet->SetCell("D2"_pos, "=D1*2");
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(2.));
+  ASSERT(!sheet->GetCell("B3"_pos));
+
+  // new, changed and cleared cells of a range
+  sheet->SetCell("B3"_pos, "5");
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(12.));
+  sheet->SetCell("A1"_pos, "=B3*2");
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(30.));
+  sheet->ClearCell("B3"_pos);
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(0.));
+
+  try {
+    sheet->SetCell("B2"_pos, "=D2");
+    ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "B2"_pos, "D2"_pos, "D1"_pos, "B2"_pos }));
+  }
+  try {
+    sheet->SetCell("B2"_pos, "=SUM(B1:B3)");
+    ASSERT(false);
+  } catch (const CircularDependencyException&) {
+  }
+  try {
+    sheet->SetCell("D1"_pos, "=SUM(A1:D3)");
+    ASSERT(false);
   } catch (const CircularDependencyException&) {
   }
+  ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "=SUM(A1:B3)");
+
+  // a formula cell created inside a referenced range goes before its
+  // dependents
+  sheet->SetCell("E1"_pos, "3");
+  sheet->SetCell("B1"_pos, "=E1");
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(6.));
+  sheet->SetCell("E1"_pos, "4");
+  sheet->Recalculate();
+  ASSERT_EQUAL(value("D2"_pos), ICell::Value(8.));
+
+  // ranges grow and shrink with the table
+  sheet->InsertRows(1, 2);
+  ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "=SUM(A1:B5)");
+  sheet->SetCell("A2"_pos, "10");
+  ASSERT_EQUAL(value("D4"_pos), ICell::Value(28.));
+  sheet->InsertCols(0);
+  ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetText(), "=SUM(B1:C5)");
+  sheet->DeleteCols(1, 2);
+  ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=SUM(#REF!)");
+  ASSERT_EQUAL(value("C4"_pos), ICell::Value(FormulaError::Category::Ref));
+
+  sheet = CreateSheet();
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("A2"_pos, "2");
+  sheet->SetCell("A3"_pos, "3");
+  sheet->SetCell("C1"_pos, "=SUM(A1:A3)");
+  sheet->SetCell("C5"_pos, "=C1");
+  ASSERT_EQUAL(value("C5"_pos), ICell::Value(6.));
+  sheet->DeleteRows(1);
+  ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=SUM(A1:A2)");
+  ASSERT_EQUAL(value("C4"_pos), ICell::Value(4.));
+  sheet->SetCell("A2"_pos, "7");
+  ASSERT_EQUAL(value("C4"_pos), ICell::Value(8.));
 }
 
 void
@@ -634,8 +885,742 @@ TestPerformanceCalculation()
   sheet->SetCell("C4"_pos, "=B3+C3");
   sheet->SetCell("D4"_pos, "=C3+D3");
   sheet->PrintValues(std::cout);
+
+  // deep chain: every cell references the previous one, going down the
+  // columns. Built from the end so that every edit only sees an empty
+  // referenced cell
+  constexpr int chain_length = 100'000;
+  auto chain_pos = [](int i) { return Position{ i % Position::kMaxRows, i / Position::kMaxRows }; };
+  sheet = CreateSheet();
+  {
+    LOG_DURATION("Calculation: build chain");
+    for (int i = chain_length - 1; i > 0; --i) {
+      sheet->SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+    }
+    sheet->SetCell("A1"_pos, "1");
+  }
+  const Position chain_end = chain_pos(chain_length - 1);
+  {
+    // every edit references a cell which already has a long chain behind it
+    LOG_DURATION("Calculation: build chain forwards");
+    auto forward_sheet = CreateSheet();
+    forward_sheet->SetCell("A1"_pos, "1");
+    for (int i = 1; i < chain_length; ++i) {
+      forward_sheet->SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+    }
+    ASSERT_EQUAL(forward_sheet->GetCell(chain_end)->GetValue(), ICell::Value(double(chain_length)));
+  }
+  {
+    LOG_DURATION("Calculation: evaluate chain");
+    ASSERT_EQUAL(sheet->GetCell(chain_end)->GetValue(), ICell::Value(double(chain_length)));
+  }
+  {
+    LOG_DURATION("Calculation: invalidate and evaluate chain");
+    sheet->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell(chain_end)->GetValue(), ICell::Value(double(chain_length + 1)));
+  }
+
+  // wide fan-out: 100000 cells of columns B:K reference A1
+  constexpr int fan_out_rows = 10'000;
+  constexpr int fan_out_cols = 10;
+  sheet = CreateSheet();
+  {
+    LOG_DURATION("Calculation: build fan-out");
+    sheet->SetCell("A1"_pos, "1");
+    for (int i = 0; i < fan_out_rows; ++i) {
+      for (int j = 1; j <= fan_out_cols; ++j) {
+        sheet->SetCell(Position{ i, j }, "=A1*2");
+      }
+    }
+  }
+  {
+    LOG_DURATION("Calculation: invalidate and evaluate fan-out");
+    for (int value = 2; value <= 10; ++value) {
+      sheet->SetCell("A1"_pos, std::to_string(value));
+      double sum = 0.;
+      for (int i = 0; i < fan_out_rows; ++i) {
+        for (int j = 1; j <= fan_out_cols; ++j) {
+          sum += std::get<double>(sheet->GetCell(Position{ i, j })->GetValue());
+        }
+      }
+      ASSERT_EQUAL(sum, 2. * value * fan_out_rows * fan_out_cols);
+    }
+  }
+
+  // lattice: every cell references two cells of the previous row, so the
+  // number of paths from A1 grows exponentially with the depth
+  constexpr int lattice_size = 200;
+  sheet = CreateSheet();
+  {
+    LOG_DURATION("Calculation: build lattice");
+    for (int i = lattice_size - 1; i > 0; --i) {
+      for (int j = 0; j < lattice_size; ++j) {
+        const Position left{ i - 1, j };
+        const Position right{ i - 1, (j + 1) % lattice_size };
+        sheet->SetCell(Position{ i, j }, "=(" + left.ToString() + "+" + right.ToString() + ")/2");
+      }
+    }
+    for (int j = 0; j < lattice_size; ++j) {
+      sheet->SetCell(Position{ 0, j }, "1");
+    }
+  }
+  {
+    LOG_DURATION("Calculation: invalidate and evaluate lattice");
+    const Position bottom{ lattice_size - 1, 0 };
+    ASSERT_EQUAL(sheet->GetCell(bottom)->GetValue(), ICell::Value(1.));
+    for (int j = 0; j < lattice_size; ++j) {
+      sheet->SetCell(Position{ 0, j }, "3");
+    }
+    ASSERT_EQUAL(sheet->GetCell(bottom)->GetValue(), ICell::Value(3.));
+  }
+}
+
+
+void
+TestPerformanceRanges()
+{
+  constexpr int rows = 10'000;
+  constexpr int cols = 10;
+  auto range = [](Position first, Position last) { return first.ToString() + ":" + last.ToString(); };
+
+  // rows of numbers with their totals and a total of the totals
+  auto sheet = CreateSheet();
+  const Position total{ 0, cols + 1 };
+  const Position average{ 1, cols + 1 };
+  {
+    LOG_DURATION("Ranges: build");
+    for (int i = 0; i < rows; ++i) {
+      for (int j = 0; j < cols; ++j) {
+        sheet->SetCell(Position{ i, j }, std::to_string(j));
+      }
+      sheet->SetCell(Position{ i, cols }, "=SUM(" + range({ i, 0 }, { i, cols - 1 }) + ")");
+    }
+    sheet->SetCell(total, "=SUM(" + range({ 0, cols }, { rows - 1, cols }) + ")");
+    sheet->SetCell(average, "=AVG(" + range({ 0, 0 }, { rows - 1, cols - 1 }) + ")");
+  }
+  {
+    LOG_DURATION("Ranges: evaluate");
+    ASSERT_EQUAL(sheet->GetCell(total)->GetValue(), ICell::Value(45. * rows));
+    ASSERT_EQUAL(sheet->GetCell(average)->GetValue(), ICell::Value(4.5));
+  }
+  {
+    LOG_DURATION("Ranges: update and evaluate");
+    for (int i = 0; i < 100; ++i) {
+      sheet->SetCell(Position{ i * 100, 0 }, "1");
+      ASSERT_EQUAL(sheet->GetCell(total)->GetValue(), ICell::Value(45. * rows + i + 1));
+    }
+  }
+}
+
+void
+TestThreadPool()
+{
+  ThreadPool pool(4);
+
+  std::vector<int> visits(10'000);
+  pool.ParallelFor(visits.size(), [&visits](size_t i) { ++visits[i]; });
+  ASSERT(std::all_of(visits.begin(), visits.end(), [](int count) { return count == 1; }));
+
+  try {
+    pool.ParallelFor(100, [](size_t i) {
+      if (i == 42) {
+        throw std::runtime_error("42");
+      }
+    });
+    ASSERT(false);
+  } catch (const std::runtime_error& e) {
+    ASSERT_EQUAL(std::string(e.what()), "42");
+  }
+}
+
+void
+TestSlotPool()
+{
+  SlotPool<std::string> pool;
+  auto first = pool.Emplace("first");
+  auto second = pool.Emplace("second");
+  ASSERT_EQUAL(*pool.Get(first), "first");
+  ASSERT_EQUAL(pool.GetSize(), 2u);
+  ASSERT(!pool.Get(PoolHandle{}));
+
+  // a reused slot does not serve stale handles
+  pool.Erase(first);
+  ASSERT(!pool.Get(first));
+  auto third = pool.Emplace("third");
+  ASSERT_EQUAL(third.index, first.index);
+  ASSERT(!pool.Get(first));
+  ASSERT_EQUAL(*pool.Get(third), "third");
+  ASSERT_EQUAL(*pool.Get(second), "second");
+  ASSERT_EQUAL(pool.GetCapacity(), 2u);
+
+  SmallVector<int, 2> values;
+  for (int i = 0; i < 5; ++i) {
+    values.push_back(i);
+  }
+  auto copy = values;
+  values.erase_unordered(values.begin());
+  ASSERT_EQUAL(std::vector<int>(values.begin(), values.end()), (std::vector<int>{ 4, 1, 2, 3 }));
+  copy.erase(copy.begin() + 1, copy.begin() + 3);
+  ASSERT_EQUAL(std::vector<int>(copy.begin(), copy.end()), (std::vector<int>{ 0, 3, 4 }));
+}
+
+void
+TestRecalculate()
+{
+  auto sheet = CreateSheet();
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("A2"_pos, "=A1+1");
+  sheet->SetCell("B2"_pos, "=A1*10");
+  sheet->SetCell("A3"_pos, "=A2+B2");
+  sheet->SetCell("C3"_pos, "=1/0");
+  sheet->Recalculate();
+  ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), ICell::Value(12.));
+  ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetValue(), ICell::Value(FormulaError::Category::Div0));
+
+  sheet->SetCell("A1"_pos, "2");
+  sheet->Recalculate();
+  ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(3.));
+  ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), ICell::Value(23.));
+}
+
+void
+TestPerformanceRecalculation()
+{
+  // wide independent columns: every cell references the cell above it, the
+  // first row references A1
+  constexpr int rows = 100;
+  constexpr int cols = 2'000;
+  auto sheet = CreateSheet();
+  sheet->SetCell(Position{ 0, 0 }, "1");
+  for (int j = 1; j < cols; ++j) {
+    sheet->SetCell(Position{ 0, j }, "=A1+" + std::to_string(j));
+  }
+  for (int i = 1; i < rows; ++i) {
+    for (int j = 1; j < cols; ++j) {
+      sheet->SetCell(Position{ i, j }, "=" + Position{ i - 1, j }.ToString() + "*2-" + std::to_string(j));
+    }
+  }
+
+  auto sum_values = [&] {
+    double sum = 0.;
+    for (int j = 1; j < cols; ++j) {
+      sum += std::get<double>(sheet->GetCell(Position{ rows - 1, j })->GetValue());
+    }
+    return sum;
+  };
+
+  sheet->SetCell("A1"_pos, "2");
+  double lazy_sum = 0.;
+  {
+    LOG_DURATION("Recalculation: lazy");
+    lazy_sum = sum_values();
+  }
+
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("A1"_pos, "2");
+  {
+    LOG_DURATION("Recalculation: parallel");
+    sheet->Recalculate();
+  }
+  ASSERT_EQUAL(sum_values(), lazy_sum);
+}
+
+void
+TestLoadCells()
+{
+  auto sheet = CreateSheet();
+  sheet->LoadCells({ { "A2"_pos, "=A1+B1" },
+                     { "A1"_pos, "1" },
+                     { "B1"_pos, "=SUM(A1:A1)*2" },
+                     { "C1"_pos, "=D1" },
+                     { "A1"_pos, "3" } });
+  ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(9.));
+  ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "");
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 3 }));
+
+  // loaded cells keep track of their dependents as set ones do
+  sheet->SetCell("A1"_pos, "4");
+  ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(12.));
+  try {
+    sheet->SetCell("A1"_pos, "=A2");
+    ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "A1"_pos, "A2"_pos, "A1"_pos }));
+  }
+
+  // cycles are checked for the resulting table, with the cells already there
+  try {
+    sheet->LoadCells({ { "D1"_pos, "=E1" }, { "E1"_pos, "=SUM(B1:C1)" }, { "A1"_pos, "5" } });
+    ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "C1"_pos, "D1"_pos, "E1"_pos, "C1"_pos }));
+  }
+  try {
+    sheet->LoadCells({ { "A1"_pos, "5" }, { "B2"_pos, "=1+" } });
+    ASSERT(false);
+  } catch (const FormulaException&) {
+  }
+  try {
+    sheet->LoadCells({ { "A1"_pos, "5" }, { Position{ -1, 0 }, "1" } });
+    ASSERT(false);
+  } catch (const InvalidPositionException&) {
+  }
+  ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "4");
+  ASSERT(!sheet->GetCell("E1"_pos));
+
+  // an intermediate cycle does not matter
+  sheet->LoadCells({ { "A1"_pos, "=A2" }, { "A2"_pos, "7" } });
+  ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(7.));
+  ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(14.));
+  sheet->SetCell("A2"_pos, "=C1");
+  ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(0.));
+  try {
+    sheet->SetCell("D1"_pos, "=B1");
+    ASSERT(false);
+  } catch (const CircularDependencyException& e) {
+    ASSERT_EQUAL(e.GetPath(), (std::vector{ "D1"_pos, "B1"_pos, "A1"_pos, "A2"_pos, "C1"_pos, "D1"_pos }));
+  }
+}
+
+void
+TestLoadDelimited()
+{
+  auto sheet = CreateSheet();
+  std::istringstream csv("1,\"a,\"\"b\"\"\",=A1*2\r\n"
+                         "\r\n"
+                         ",\"two\nlines\",=SUM(A1:C1)\r\n");
+  LoadDelimited(*sheet, csv, ',');
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 3, 3 }));
+  ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "a,\"b\"");
+  ASSERT_EQUAL(sheet->GetCell("B3"_pos)->GetText(), "two\nlines");
+  ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetValue(), ICell::Value(FormulaError::Category::Value));
+  ASSERT(!sheet->GetCell("A2"_pos));
+
+  // printed texts are loaded back as they are
+  sheet = CreateSheet();
+  sheet->SetCell("A1"_pos, "=B2/2");
+  sheet->SetCell("B2"_pos, "'=text");
+  sheet->SetCell("C3"_pos, "10");
+  sheet->SetCell("B2"_pos, "=C3");
+  std::ostringstream texts;
+  sheet->PrintTexts(texts);
+
+  auto loaded = CreateSheet();
+  std::istringstream tsv(texts.str());
+  LoadDelimited(*loaded, tsv, '\t');
+  std::ostringstream loaded_texts;
+  loaded->PrintTexts(loaded_texts);
+  ASSERT_EQUAL(loaded_texts.str(), texts.str());
+  ASSERT_EQUAL(loaded->GetCell("A1"_pos)->GetValue(), ICell::Value(5.));
+}
+
+void
+TestPerformanceLoad()
+{
+  // every row is a chain of formulas starting with a number
+  constexpr int rows = 1'000;
+  constexpr int cols = 1'000;
+  std::vector<std::pair<Position, std::string>> cells;
+  cells.reserve(rows * cols);
+  for (int i = 0; i < rows; ++i) {
+    cells.emplace_back(Position{ i, 0 }, std::to_string(i));
+    for (int j = 1; j < cols; ++j) {
+      cells.emplace_back(Position{ i, j }, "=" + Position{ i, j - 1 }.ToString() + "+1");
+    }
+  }
+
+  auto sheet = CreateSheet();
+  {
+    LOG_DURATION("Load: 1000000 cells");
+    sheet->LoadCells(std::move(cells));
+  }
+  {
+    LOG_DURATION("Load: evaluate");
+    sheet->Recalculate();
+  }
+  ASSERT_EQUAL(sheet->GetCell(Position{ rows - 1, cols - 1 })->GetValue(), ICell::Value(double(rows - 1 + cols - 1)));
 }
 
+void
+TestSnapshot()
+{
+  auto sheet = CreateSheet();
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("A2"_pos, "=A1*2");
+  sheet->SetCell("B1"_pos, "'=text");
+  sheet->SetCell("B2"_pos, "=SUM(A1:A3, 10)/C5");
+  sheet->SetCell("C1"_pos, "=B1");
+  sheet->SetCell("D1"_pos, "=E1");
+  sheet->SetCell("E1"_pos, "1");
+  sheet->SetCell("F1"_pos, "last");
+  sheet->DeleteCols(4);
+  ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError::Category::Div0));
+
+  for (bool with_values : { true, false }) {
+    std::stringstream snapshot;
+    sheet->SaveSnapshot(snapshot, with_values);
+    auto loaded = LoadSnapshot(snapshot);
+
+    std::ostringstream texts;
+    std::ostringstream loaded_texts;
+    sheet->PrintTexts(texts);
+    loaded->PrintTexts(loaded_texts);
+    ASSERT_EQUAL(loaded_texts.str(), texts.str());
+
+    std::ostringstream values;
+    std::ostringstream loaded_values;
+    sheet->PrintValues(values);
+    loaded->PrintValues(loaded_values);
+    ASSERT_EQUAL(loaded_values.str(), values.str());
+    ASSERT_EQUAL(loaded->GetPrintableSize(), sheet->GetPrintableSize());
+    ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetText(), "=#REF!");
+
+    // references, ranges and the order of cells are restored
+    loaded->SetCell("C5"_pos, "2");
+    loaded->SetCell("A3"_pos, "=A2+1");
+    ASSERT_EQUAL(loaded->GetCell("B2"_pos)->GetValue(), ICell::Value(8.));
+    loaded->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(loaded->GetCell("B2"_pos)->GetValue(), ICell::Value(10.5));
+    try {
+      loaded->SetCell("C5"_pos, "=B2");
+      ASSERT(false);
+    } catch (const CircularDependencyException& e) {
+      ASSERT_EQUAL(e.GetPath(), (std::vector{ "C5"_pos, "B2"_pos, "C5"_pos }));
+    }
+  }
+
+  std::stringstream snapshot;
+  sheet->SaveSnapshot(snapshot);
+  const auto data = snapshot.str();
+  auto assert_malformed = [](const std::string& data) {
+    try {
+      std::istringstream input(data);
+      LoadSnapshot(input);
+      ASSERT(false);
+    } catch (const SnapshotException&) {
+    }
+  };
+  assert_malformed(data.substr(0, data.size() - 1));
+  assert_malformed(data + '\0');
+  assert_malformed("not a snapshot");
+  assert_malformed(std::string());
+
+  // references out of the sheet, written over those of the formula, which
+  // follows the positions of the cells
+  auto references = CreateSheet();
+  references->SetCell("A1"_pos, "=C7+SUM(E10:F12)");
+  std::stringstream references_snapshot;
+  references->SaveSnapshot(references_snapshot);
+  auto replace_position = [data = references_snapshot.str()](const Position& from, const Position& to) {
+    auto result = data;
+    const auto offset = result.rfind(std::string_view(reinterpret_cast<const char*>(&from), sizeof(from)));
+    ASSERT(offset != std::string::npos);
+    result.replace(offset, sizeof(to), reinterpret_cast<const char*>(&to), sizeof(to));
+    return result;
+  };
+  assert_malformed(replace_position("C7"_pos, Position{ Position::kMaxRows, 2 }));
+  assert_malformed(replace_position("C7"_pos, Position{ -1, 2 }));
+  assert_malformed(replace_position("F12"_pos, Position{ 11, Position::kMaxCols + 1 }));
+  // the references stored for the formula no longer match it
+  assert_malformed(replace_position("C7"_pos, Position{ -1, -1 }));
+  // a range deleted by a structural edit is not malformed
+  std::istringstream references_input(replace_position("F12"_pos, Position{ 11, 3 }));
+  const auto loaded = LoadSnapshot(references_input);
+  ASSERT_EQUAL(loaded->GetCell("A1"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+
+  // a cycle written over the references of a formula and the ones stored for
+  // it, values computed on demand would follow it forever
+  auto chain = CreateSheet();
+  chain->SetCell("A1"_pos, "=B1");
+  chain->SetCell("B1"_pos, "=C1");
+  std::stringstream chain_snapshot;
+  chain->SaveSnapshot(chain_snapshot);
+  auto cycle = chain_snapshot.str();
+  const auto a1 = "A1"_pos;
+  const auto c1 = "C1"_pos;
+  const auto formula_offset = cycle.rfind(std::string_view(reinterpret_cast<const char*>(&c1), sizeof(c1)));
+  ASSERT(formula_offset != std::string::npos);
+  cycle.replace(formula_offset, sizeof(a1), reinterpret_cast<const char*>(&a1), sizeof(a1));
+  assert_malformed(cycle);
+  // B1 references one cell, the third one in row-major order, and then A1
+  const uint32_t c1_deps[] = { 1, 2 };
+  const uint32_t a1_deps[] = { 1, 0 };
+  const auto deps_offset =
+    cycle.find(std::string_view(reinterpret_cast<const char*>(c1_deps), sizeof(c1_deps)), formula_offset);
+  ASSERT(deps_offset != std::string::npos);
+  cycle.replace(deps_offset, sizeof(a1_deps), reinterpret_cast<const char*>(a1_deps), sizeof(a1_deps));
+  try {
+    std::istringstream input(cycle);
+    LoadSnapshot(input);
+    ASSERT(false);
+  } catch (const SnapshotException& e) {
+    ASSERT_EQUAL(std::string(e.what()), "Circular reference in snapshot");
+  }
+}
+
+void
+TestPerformanceSnapshot()
+{
+  constexpr int rows = 1'000;
+  constexpr int cols = 1'000;
+  std::vector<std::pair<Position, std::string>> cells;
+  cells.reserve(rows * cols);
+  for (int i = 0; i < rows; ++i) {
+    cells.emplace_back(Position{ i, 0 }, std::to_string(i));
+    for (int j = 1; j < cols; ++j) {
+      cells.emplace_back(Position{ i, j }, "=" + Position{ i, j - 1 }.ToString() + "+1");
+    }
+  }
+  auto sheet = CreateSheet();
+  sheet->LoadCells(std::move(cells));
+  sheet->Recalculate();
+
+  std::stringstream snapshot;
+  {
+    LOG_DURATION("Snapshot: save 1000000 cells");
+    sheet->SaveSnapshot(snapshot);
+  }
+  std::unique_ptr<ISheet> loaded;
+  {
+    LOG_DURATION("Snapshot: load 1000000 cells");
+    loaded = LoadSnapshot(snapshot);
+  }
+  const Position last{ rows - 1, cols - 1 };
+  ASSERT_EQUAL(loaded->GetCell(last)->GetValue(), sheet->GetCell(last)->GetValue());
+}
+
+void
+TestPrintableSizeTracking()
+{
+  auto sheet = CreateSheet();
+  sheet->SetCell("C3"_pos, "=E5");
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 3, 3 }));
+
+  sheet->SetCell("B7"_pos, "text");
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 7, 3 }));
+
+  sheet->SetCell("B7"_pos, "");
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 3, 3 }));
+
+  sheet->InsertRows(0, 2);
+  sheet->InsertCols(1);
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5, 4 }));
+  ASSERT_EQUAL(sheet->GetCell("D5"_pos)->GetText(), "=F7");
+
+  sheet->SetCell("A1"_pos, "1");
+  sheet->DeleteCols(3);
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 1, 1 }));
+
+  sheet->ClearCell("A1"_pos);
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 0, 0 }));
+
+  sheet->SetCell("B2"_pos, "x");
+  sheet->SetCell("D1"_pos, "y");
+  std::ostringstream texts;
+  sheet->PrintTexts(texts);
+  ASSERT_EQUAL(texts.str(), "\t\t\ty\n\tx\t\t\n");
+}
+
+void
+TestPerformanceStructuralEdits()
+{
+  // a block of formulas at the top and a single cell far below
+  constexpr int rows = 1'000;
+  constexpr int cols = 100;
+  std::vector<std::pair<Position, std::string>> cells;
+  for (int i = 0; i < rows; ++i) {
+    cells.emplace_back(Position{ i, 0 }, "1");
+    for (int j = 1; j < cols; ++j) {
+      cells.emplace_back(Position{ i, j }, "=" + Position{ i, j - 1 }.ToString() + "*2");
+    }
+  }
+  cells.emplace_back(Position{ 10 * rows, 0 }, "end");
+  auto sheet = CreateSheet();
+  sheet->LoadCells(std::move(cells));
+
+  {
+    LOG_DURATION("Structural edits: 100 insertions and deletions below formulas");
+    for (int i = 0; i < 100; ++i) {
+      sheet->InsertRows(2 * rows);
+      sheet->DeleteRows(2 * rows);
+    }
+  }
+  {
+    LOG_DURATION("Structural edits: 10 insertions above formulas");
+    sheet->InsertRows(0, 10);
+  }
+  ASSERT_EQUAL(sheet->GetCell(Position{ rows + 9, cols - 1 })->GetText(), "=CU1010*2");
+  ASSERT_EQUAL(sheet->GetCell(Position{ 10 * rows + 10, 0 })->GetText(), "end");
+}
+
+void
+TestVersions()
+{
+  auto sheet = CreateSheet();
+  sheet->ReadVersion([](const ISheetVersion& version) {
+    ASSERT_EQUAL(version.GetPrintableSize(), (Size{ 0, 0 }));
+    ASSERT_EQUAL(version.GetValue("A1"_pos), ICell::Value(""));
+  });
+
+  sheet->SetCell("A1"_pos, "1");
+  sheet->SetCell("B1"_pos, "=A1");
+  sheet->SetCell("C1"_pos, "=B1*2");
+  sheet->SetCell("A2"_pos, "'=text");
+  sheet->SetCell("D2"_pos, "=SUM(A1:C1)");
+  sheet->PublishVersion();
+  sheet->ReadVersion([](const ISheetVersion& version) {
+    ASSERT_EQUAL(version.GetPrintableSize(), (Size{ 2, 4 }));
+    ASSERT_EQUAL(version.GetValue("C1"_pos), ICell::Value(2.));
+    ASSERT_EQUAL(version.GetValue("D2"_pos), ICell::Value(4.));
+    ASSERT_EQUAL(version.GetValue("A2"_pos), ICell::Value("=text"));
+    ASSERT_EQUAL(version.GetText("A2"_pos), "'=text");
+    ASSERT_EQUAL(version.GetText("D2"_pos), "=SUM(A1:C1)");
+  });
+
+  // dependents of cells which the table has not evaluated yet change as well
+  sheet->SetCell("A1"_pos, "2");
+  sheet->ReadVersion([](const ISheetVersion& version) { ASSERT_EQUAL(version.GetValue("C1"_pos), ICell::Value(2.)); });
+  sheet->PublishVersion();
+  sheet->ReadVersion([](const ISheetVersion& version) {
+    ASSERT_EQUAL(version.GetValue("C1"_pos), ICell::Value(4.));
+    ASSERT_EQUAL(version.GetValue("D2"_pos), ICell::Value(8.));
+  });
+
+  // a version read stays the same while others are published
+  sheet->ReadVersion([&sheet](const ISheetVersion& version) {
+    sheet->SetCell("A1"_pos, "3");
+    sheet->ClearCell("A2"_pos);
+    sheet->PublishVersion();
+    sheet->SetCell("A1"_pos, "4");
+    sheet->PublishVersion();
+    ASSERT_EQUAL(version.GetValue("D2"_pos), ICell::Value(8.));
+    ASSERT_EQUAL(version.GetText("A2"_pos), "'=text");
+    sheet->ReadVersion([](const ISheetVersion& version) {
+      ASSERT_EQUAL(version.GetValue("D2"_pos), ICell::Value(16.));
+      ASSERT_EQUAL(version.GetText("A2"_pos), "");
+    });
+  });
+
+  sheet->InsertRows(0);
+  sheet->DeleteCols(1);
+  sheet->PublishVersion();
+  sheet->ReadVersion([](const ISheetVersion& version) {
+    ASSERT_EQUAL(version.GetPrintableSize(), (Size{ 3, 3 }));
+    ASSERT_EQUAL(version.GetText("B2"_pos), "=#REF!*2");
+    ASSERT_EQUAL(version.GetText("C3"_pos), "=SUM(A2:B2)");
+    ASSERT_EQUAL(version.GetValue("C3"_pos), ICell::Value(FormulaError::Category::Ref));
+  });
+
+  sheet->SetCell("B2"_pos, "=A2*3");
+  sheet->PublishVersion();
+  sheet->ReadVersion([](const ISheetVersion& version) { ASSERT_EQUAL(version.GetValue("C3"_pos), ICell::Value(16.)); });
+}
+
+void
+TestPerformanceVersions()
+{
+  // every version holds B = A * 2 in all rows and C1 = SUM(B)
+  constexpr int rows = 10'000;
+  constexpr int edits = 2'000;
+  constexpr int readers_count = 4;
+  std::vector<std::pair<Position, std::string>> cells;
+  for (int i = 0; i < rows; ++i) {
+    cells.emplace_back(Position{ i, 0 }, "1");
+    cells.emplace_back(Position{ i, 1 }, "=" + Position{ i, 0 }.ToString() + "*2");
+  }
+  cells.emplace_back("C1"_pos, "=SUM(B1:B" + std::to_string(rows) + ")");
+  auto sheet = CreateSheet();
+  sheet->LoadCells(std::move(cells));
+  sheet->PublishVersion();
+
+  std::atomic<bool> is_writing = true;
+  std::atomic<int> reads = 0;
+  std::atomic<int> inconsistent_reads = 0;
+  {
+    LOG_DURATION("Versions: 4 readers during 2000 edits and publications");
+    std::vector<std::thread> readers;
+    for (int r = 0; r < readers_count; ++r) {
+      readers.emplace_back([&, r] {
+        std::mt19937 generator(r);
+        while (is_writing) {
+          sheet->ReadVersion([&](const ISheetVersion& version) {
+            const Position pos{ static_cast<int>(generator() % rows), 0 };
+            const double a = std::get<double>(version.GetValue(pos));
+            const double b = std::get<double>(version.GetValue({ pos.row, 1 }));
+            double sum = 0.;
+            for (int i = 0; i < rows; i += rows / 10) {
+              sum += std::get<double>(version.GetValue({ i, 1 }));
+            }
+            const double total = std::get<double>(version.GetValue("C1"_pos));
+            if (b != a * 2 || total < sum) {
+              ++inconsistent_reads;
+            }
+          });
+          ++reads;
+        }
+      });
+    }
+
+    std::mt19937 generator(readers_count);
+    for (int i = 0; i < edits; ++i) {
+      sheet->SetCell(Position{ static_cast<int>(generator() % rows), 0 }, std::to_string(i));
+      sheet->PublishVersion();
+    }
+    is_writing = false;
+    for (auto& reader : readers) {
+      reader.join();
+    }
+  }
+  ASSERT_EQUAL(inconsistent_reads.load(), 0);
+  ASSERT(reads > 0);
+  std::cerr << "Versions: " << reads << " reads of consistent versions" << std::endl;
+
+  double sum = 0.;
+  for (int i = 0; i < rows; ++i) {
+    sum += std::get<double>(sheet->GetCell(Position{ i, 1 })->GetValue());
+  }
+  sheet->ReadVersion([sum](const ISheetVersion& version) {
+    ASSERT_EQUAL(version.GetValue("C1"_pos), ICell::Value(sum));
+  });
+}
+
+void
+TestPerformanceSparse()
+{
+  constexpr int cells_count = 1'000'000;
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> row_dist(0, Position::kMaxRows - 101);
+  std::uniform_int_distribution<int> col_dist(0, Position::kMaxCols - 101);
+
+  auto sheet = CreateSheet();
+  {
+    LOG_DURATION("Sparse: set " + std::to_string(cells_count) + " cells");
+    for (int i = 0; i < cells_count; ++i) {
+      sheet->SetCell(Position{ row_dist(gen), col_dist(gen) }, std::to_string(i));
+    }
+  }
+
+  const Position probe{ Position::kMaxRows - 101, Position::kMaxCols - 101 };
+  sheet->SetCell(probe, "=A1+1");
+  {
+    LOG_DURATION("Sparse: printable size");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ Position::kMaxRows - 100, Position::kMaxCols - 100 }));
+  }
+  {
+    LOG_DURATION("Sparse: insert rows and cols");
+    sheet->InsertRows(0, 100);
+    sheet->InsertCols(0, 100);
+  }
+  ASSERT_EQUAL(sheet->GetCell(Position{ probe.row + 100, probe.col + 100 })->GetText(), "=CW101+1");
+  {
+    LOG_DURATION("Sparse: delete rows and cols");
+    sheet->DeleteRows(0, 100);
+    sheet->DeleteCols(0, 100);
+  }
+  ASSERT_EQUAL(sheet->GetCell(probe)->GetText(), "=A1+1");
+  ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ Position::kMaxRows - 100, Position::kMaxCols - 100 }));
+}
 }
 
 int
@@ -667,7 +1652,28 @@ main()
   RUN_TEST(tr, TestPrint);
   RUN_TEST(tr, TestCellReferences);
   RUN_TEST(tr, TestFormulaIncorrect);
+#ifdef FORMULA_ANTLR
+  RUN_TEST(tr, TestFormulaParserCrossCheck);
+#endif
   RUN_TEST(tr, TestCellCircularReferences);
+  RUN_TEST(tr, TestFormulaRanges);
+  RUN_TEST(tr, TestRangeDependencies);
   RUN_TEST(tr, TestPerformanceCalculation);
+  RUN_TEST(tr, TestPerformanceRanges);
+  RUN_TEST(tr, TestThreadPool);
+  RUN_TEST(tr, TestSlotPool);
+  RUN_TEST(tr, TestRecalculate);
+  RUN_TEST(tr, TestPrintableSizeTracking);
+  RUN_TEST(tr, TestPerformanceRecalculation);
+  RUN_TEST(tr, TestLoadCells);
+  RUN_TEST(tr, TestLoadDelimited);
+  RUN_TEST(tr, TestPerformanceLoad);
+  RUN_TEST(tr, TestSnapshot);
+  RUN_TEST(tr, TestPerformanceSnapshot);
+  RUN_TEST(tr, TestPerformanceStructuralEdits);
+  RUN_TEST(tr, TestVersions);
+  RUN_TEST(tr, TestPerformanceVersions);
+  RUN_TEST(tr, TestPerformanceSparse);
+  RUN_TEST(tr, TestPerformanceParsing);
   return 0;
 }
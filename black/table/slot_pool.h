@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Reference to a pool slot. A slot gets a new generation every time its value
+// is erased, so handles to erased values are told apart from live ones
+struct PoolHandle
+{
+  uint32_t index = 0;
+  uint32_t generation = 0; // never used by live slots
+
+  explicit operator bool() const { return generation != 0; }
+  bool operator==(const PoolHandle& other) const { return index == other.index && generation == other.generation; }
+  bool operator!=(const PoolHandle& other) const { return !(*this == other); }
+  bool operator<(const PoolHandle& other) const
+  {
+    return index < other.index || (index == other.index && generation < other.generation);
+  }
+};
+
+// Stores values in fixed-size blocks, so they never move, and reuses slots of
+// erased values
+template<typename T>
+class SlotPool
+{
+public:
+  static constexpr size_t kBlockSize = 1024;
+
+  template<typename... Args>
+  PoolHandle Emplace(Args&&... args)
+  {
+    uint32_t index;
+    if (!free_.empty()) {
+      index = free_.back();
+      free_.pop_back();
+    } else {
+      index = static_cast<uint32_t>(slots_count_++);
+      if (index % kBlockSize == 0) {
+        blocks_.push_back(std::make_unique<Slot[]>(kBlockSize));
+      }
+    }
+
+    auto& slot = GetSlot(index);
+    slot.value.emplace(std::forward<Args>(args)...);
+    ++size_;
+    return PoolHandle{ index, slot.generation };
+  }
+
+  void Erase(PoolHandle handle)
+  {
+    if (Get(handle)) {
+      auto& slot = GetSlot(handle.index);
+      slot.value.reset();
+      slot.generation = slot.generation == UINT32_MAX ? 1 : slot.generation + 1;
+      free_.push_back(handle.index);
+      --size_;
+    }
+  }
+
+  // Returns nullptr for null handles and handles to erased values
+  T* Get(PoolHandle handle)
+  {
+    return const_cast<T*>(static_cast<const SlotPool&>(*this).Get(handle));
+  }
+  const T* Get(PoolHandle handle) const
+  {
+    if (handle.index >= slots_count_) {
+      return nullptr;
+    }
+    const auto& slot = GetSlot(handle.index);
+    return slot.generation == handle.generation && slot.value ? &*slot.value : nullptr;
+  }
+
+  // Number of live values
+  size_t GetSize() const { return size_; }
+
+  // Upper bound of the slot indices ever used
+  size_t GetCapacity() const { return slots_count_; }
+
+private:
+  struct Slot
+  {
+    uint32_t generation = 1;
+    std::optional<T> value;
+  };
+
+  Slot& GetSlot(uint32_t index) { return blocks_[index / kBlockSize][index % kBlockSize]; }
+  const Slot& GetSlot(uint32_t index) const { return blocks_[index / kBlockSize][index % kBlockSize]; }
+
+  std::vector<std::unique_ptr<Slot[]>> blocks_;
+  std::vector<uint32_t> free_;
+  size_t slots_count_ = 0;
+  size_t size_ = 0;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Vector of trivially copyable values which keeps up to N of them inline and
+// only allocates when it grows beyond that
+template<typename T, size_t N>
+class SmallVector
+{
+  static_assert(std::is_trivially_copyable_v<T>, "SmallVector only holds trivially copyable values");
+
+public:
+  SmallVector() = default;
+  SmallVector(const SmallVector& other) { Assign(other); }
+  SmallVector(SmallVector&& other) noexcept { Steal(other); }
+  ~SmallVector() { delete[] heap_; }
+
+  SmallVector& operator=(const SmallVector& other)
+  {
+    if (this != &other) {
+      clear();
+      Assign(other);
+    }
+    return *this;
+  }
+  SmallVector& operator=(SmallVector&& other) noexcept
+  {
+    if (this != &other) {
+      delete[] heap_;
+      heap_ = nullptr;
+      capacity_ = N;
+      Steal(other);
+    }
+    return *this;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T* data() { return IsInline() ? inline_ : heap_; }
+  const T* data() const { return IsInline() ? inline_ : heap_; }
+
+  T* begin() { return data(); }
+  T* end() { return data() + size_; }
+  const T* begin() const { return data(); }
+  const T* end() const { return data() + size_; }
+
+  T& operator[](size_t i) { return data()[i]; }
+  const T& operator[](size_t i) const { return data()[i]; }
+
+  void push_back(const T& value)
+  {
+    if (size_ == capacity_) {
+      Reserve(capacity_ * 2);
+    }
+    data()[size_++] = value;
+  }
+
+  T* erase(T* first, T* last)
+  {
+    std::memmove(first, last, (end() - last) * sizeof(T));
+    size_ -= static_cast<uint32_t>(last - first);
+    return first;
+  }
+
+  // Order of the remaining values is not kept
+  void erase_unordered(T* it)
+  {
+    *it = data()[size_ - 1];
+    --size_;
+  }
+
+  void clear() { size_ = 0; }
+
+private:
+  bool IsInline() const { return capacity_ == N; }
+
+  void Reserve(size_t capacity)
+  {
+    T* heap = new T[capacity];
+    std::memcpy(heap, data(), size_ * sizeof(T));
+    delete[] heap_;
+    heap_ = heap;
+    capacity_ = static_cast<uint32_t>(capacity);
+  }
+
+  void Assign(const SmallVector& other)
+  {
+    if (other.size_ > capacity_) {
+      Reserve(other.size_);
+    }
+    std::memcpy(data(), other.data(), other.size_ * sizeof(T));
+    size_ = other.size_;
+  }
+
+  void Steal(SmallVector& other)
+  {
+    if (other.IsInline()) {
+      std::memcpy(inline_, other.inline_, other.size_ * sizeof(T));
+    } else {
+      heap_ = other.heap_;
+      capacity_ = other.capacity_;
+      other.heap_ = nullptr;
+      other.capacity_ = N;
+    }
+    size_ = other.size_;
+    other.size_ = 0;
+  }
+
+  uint32_t size_ = 0;
+  uint32_t capacity_ = N;
+  T* heap_ = nullptr;
+  T inline_[N];
+};
@@ -2,8 +2,12 @@
 
 #include "common.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <map>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
 template<typename T>
 class Table
@@ -119,14 +123,53 @@ private:
   Size size_;
 };
 
-struct PositionHasher
+// Ordered count of occupied cells per row (or per column). Keeps the extent of
+// the occupied area up to date without scanning it
+class OccupancyIndex
 {
 public:
-  size_t operator()(const Position& pos) const { return (pos.row << 14) + pos.col; }
+  int GetExtent() const { return counts_.empty() ? 0 : counts_.rbegin()->first + 1; }
+
+  void Add(int idx) { ++counts_[idx]; }
+  void Remove(int idx)
+  {
+    auto it = counts_.find(idx);
+    if (it != counts_.end() && --it->second == 0) {
+      counts_.erase(it);
+    }
+  }
+
+  void Insert(int before, int count = 1)
+  {
+    ShiftFrom(counts_.lower_bound(before), count);
+  }
+  void Erase(int first, int count = 1)
+  {
+    auto last = counts_.erase(counts_.lower_bound(first), counts_.lower_bound(first + count));
+    ShiftFrom(last, -count);
+  }
+
+private:
+  void ShiftFrom(std::map<int, int>::iterator it, int delta)
+  {
+    std::vector<std::map<int, int>::node_type> shifted;
+    while (it != counts_.end()) {
+      shifted.push_back(counts_.extract(it++));
+    }
+    for (auto& node : shifted) {
+      node.key() += delta;
+      counts_.insert(counts_.end(), std::move(node));
+    }
+  }
+
+  std::map<int, int> counts_;
 };
 
+// Sparse table: an ordered map of rows, each row is a vector of occupied cells
+// sorted by column. Iteration visits occupied cells only and row/column
+// insertion and deletion shift indices of the cells that follow in place
 template<typename T>
-class Table2
+class SparseTable
 {
 public:
   Size GetSize() const { return size_; }
@@ -139,16 +182,18 @@ public:
     size_.cols = std::max(new_size.cols, size_.cols);
   }
 
-  const T* GetAt(int row, int col) const { return GetAt(Position{ row, col }); }
-  const T* GetAt(const Position& pos) const
+  const T* GetAt(int row, int col) const
   {
-    if (!IsInside(pos)) {
+    auto row_it = rows_.find(row);
+    if (row_it == rows_.end()) {
       return nullptr;
     }
 
-    auto it = table_.find(pos);
-    return it != table_.end() ? &it->second : nullptr;
+    const auto& row_data = row_it->second;
+    auto it = LowerBound(row_data, col);
+    return it != row_data.end() && it->first == col ? &it->second : nullptr;
   }
+  const T* GetAt(const Position& pos) const { return GetAt(pos.row, pos.col); }
 
   T& operator()(int row, int col) { return operator()(Position{ row, col }); }
   T& operator()(const Position& pos)
@@ -156,31 +201,39 @@ public:
     if (!IsInside(pos)) {
       Grow(Size{ pos.row + 1, pos.col + 1 });
     }
-    return table_[pos];
+
+    auto& row_data = rows_[pos.row];
+    auto it = LowerBound(row_data, pos.col);
+    if (it == row_data.end() || it->first != pos.col) {
+      it = row_data.emplace(it, pos.col, T());
+    }
+    return it->second;
   }
 
-  void InsertRows(int before, int count = 1)
+  void Erase(const Position& pos)
   {
-    if (size_.rows <= before || size_.rows + count > Position::kMaxRows) {
-      throw TableTooBigException("Rows limit exceeded");
+    auto row_it = rows_.find(pos.row);
+    if (row_it == rows_.end()) {
+      return;
     }
 
-    std::vector<std::pair<Position, T>> shelter;
-    for (int row = before; row < size_.rows; ++row) {
-      for (int col = 0; col < size_.cols; ++col) {
-        const Position pos{row, col};
-        auto it = table_.find(pos);
-        if (it != table_.end()) {
-          shelter.emplace_back(pos, std::move(it->second));
-          table_.erase(it);
-        }
+    auto& row_data = row_it->second;
+    auto it = LowerBound(row_data, pos.col);
+    if (it != row_data.end() && it->first == pos.col) {
+      row_data.erase(it);
+      if (row_data.empty()) {
+        rows_.erase(row_it);
       }
     }
+  }
 
-    for (auto& [pos, val] : shelter) {
-      table_.emplace(Position{pos.row + count, pos.col}, std::move(val));
+  void InsertRows(int before, int count = 1)
+  {
+    if (size_.rows <= before || size_.rows + count > Position::kMaxRows) {
+      throw TableTooBigException("Rows limit exceeded");
     }
 
+    ShiftRowsFrom(rows_.lower_bound(before), count);
     size_.rows += count;
   }
 
@@ -190,22 +243,11 @@ public:
       throw TableTooBigException("Columns limit exceeded");
     }
 
-    std::vector<std::pair<Position, T>> shelter;
-    for (int row = 0; row < size_.rows; ++row) {
-      for (int col = before; col < size_.cols; ++col) {
-        const Position pos{row, col};
-        auto it = table_.find(pos);
-        if (it != table_.end()) {
-          shelter.emplace_back(pos, std::move(it->second));
-          table_.erase(it);
-        }
+    for (auto& [row, row_data] : rows_) {
+      for (auto it = LowerBound(row_data, before); it != row_data.end(); ++it) {
+        it->first += count;
       }
     }
-
-    for (auto& [pos, val] : shelter) {
-      table_.emplace(Position{pos.row, pos.col + count}, std::move(val));
-    }
-
     size_.cols += count;
   }
 
@@ -215,21 +257,8 @@ public:
       throw std::out_of_range("Cannot delete rows outside of printable area");
     }
 
-    for (int col = 0; col < size_.cols; ++col) {
-      for (int row = first; row < first + count; ++row) {
-        auto it = table_.find(Position{row, col});
-        if (it != table_.end()) {
-          table_.erase(it);
-        }
-      }
-      for (auto row = first + count; row < size_.rows; ++row) {
-        auto it = table_.find(Position{row, col});
-        if (it != table_.end()) {
-          table_.emplace(Position{row - count, col}, std::move(it->second));
-          table_.erase(it);
-        }
-      }
-    }
+    auto last = rows_.erase(rows_.lower_bound(first), rows_.lower_bound(first + count));
+    ShiftRowsFrom(last, -count);
 
     size_.rows -= count;
     size_.cols *= size_.rows != 0;
@@ -241,32 +270,26 @@ public:
       throw std::out_of_range("Cannot delete columns outside of printable area");
     }
 
-    for (int row = 0; row < size_.rows; ++row) {
-      for (int col = first; col < first + count; ++col) {
-        auto it = table_.find(Position{row, col});
-        if (it != table_.end()) {
-          table_.erase(it);
-        }
-      }
-      for (int col = first + count; col < size_.cols; ++col) {
-        auto it = table_.find(Position{row, col});
-        if (it != table_.end()) {
-          table_.emplace(Position{row, col - count}, std::move(it->second));
-          table_.erase(it);
-        }
+    for (auto row_it = rows_.begin(); row_it != rows_.end();) {
+      auto& row_data = row_it->second;
+      auto it = row_data.erase(LowerBound(row_data, first), LowerBound(row_data, first + count));
+      for (; it != row_data.end(); ++it) {
+        it->first -= count;
       }
+      row_it = row_data.empty() ? rows_.erase(row_it) : std::next(row_it);
     }
 
     size_.cols -= count;
     size_.rows *= size_.cols != 0;
   }
 
+  // Calls func(row, col, value) for occupied cells in row-major order
   template<typename F>
   void ForEach(F func) const
   {
-    for (int i = 0; i < size_.rows; ++i) {
-      for (int j = 0; j < size_.cols; ++j) {
-        func(i, j, GetAt(i, j));
+    for (const auto& [row, row_data] : rows_) {
+      for (const auto& [col, value] : row_data) {
+        func(row, col, value);
       }
     }
   }
@@ -274,14 +297,196 @@ public:
   template<typename F>
   void ForEach(F func)
   {
-    for (int i = 0; i < size_.rows; ++i) {
-      for (int j = 0; j < size_.cols; ++j) {
-        func(i, j, GetAt(i, j));
+    for (auto& [row, row_data] : rows_) {
+      for (auto& [col, value] : row_data) {
+        func(row, col, value);
+      }
+    }
+  }
+
+  // Same as ForEach, limited to [first_row, last_row) x [first_col, last_col)
+  template<typename F>
+  void ForEachIn(int first_row, int last_row, int first_col, int last_col, F func) const
+  {
+    for (auto row_it = rows_.lower_bound(first_row); row_it != rows_.end() && row_it->first < last_row; ++row_it) {
+      const auto& row_data = row_it->second;
+      for (auto it = LowerBound(row_data, first_col); it != row_data.end() && it->first < last_col; ++it) {
+        func(row_it->first, it->first, it->second);
       }
     }
   }
 
 private:
+  using RowData = std::vector<std::pair<int, T>>;
+  using Rows = std::map<int, RowData>;
+
+  template<typename Row>
+  static auto LowerBound(Row& row_data, int col)
+  {
+    return std::lower_bound(
+      row_data.begin(), row_data.end(), col, [](const auto& cell, int col) { return cell.first < col; });
+  }
+
+  void ShiftRowsFrom(typename Rows::iterator it, int delta)
+  {
+    std::vector<typename Rows::node_type> shifted;
+    while (it != rows_.end()) {
+      shifted.push_back(rows_.extract(it++));
+    }
+    for (auto& node : shifted) {
+      node.key() += delta;
+      rows_.insert(rows_.end(), std::move(node));
+    }
+  }
+
   Size size_;
-  std::unordered_map<Position, T, PositionHasher> table_;
+  Rows rows_;
+};
+
+// Spatial index of values attached to ranges. The table is split into square
+// blocks and a range is listed in every block it overlaps, so a lookup only
+// checks ranges of one block. Ranges overlapping too many blocks are kept in
+// a separate list which every lookup scans
+template<typename T>
+class RangeIndex
+{
+public:
+  void Add(const Range& range, const T& value)
+  {
+    if (IsLarge(range)) {
+      large_.push_back({ range, value });
+      return;
+    }
+    ForEachBlock(range, [this, &range, &value](uint32_t block) { blocks_[block].push_back({ range, value }); });
+  }
+
+  void Remove(const Range& range, const T& value)
+  {
+    if (IsLarge(range)) {
+      RemoveFrom(large_, { range, value });
+      return;
+    }
+    ForEachBlock(range, [this, &range, &value](uint32_t block) {
+      auto it = blocks_.find(block);
+      if (it != blocks_.end() && RemoveFrom(it->second, { range, value }) && it->second.empty()) {
+        blocks_.erase(it);
+      }
+    });
+  }
+
+  void Clear()
+  {
+    blocks_.clear();
+    large_.clear();
+  }
+
+  // Calls func for the values of all ranges containing the position
+  template<typename F>
+  void ForEachContaining(const Position& pos, F func) const
+  {
+    auto visit = [&pos, &func](const std::vector<Entry>& entries) {
+      for (const auto& entry : entries) {
+        if (entry.range.Contains(pos)) {
+          func(entry.value);
+        }
+      }
+    };
+
+    auto it = blocks_.find(GetBlock(pos.row / kBlockSize, pos.col / kBlockSize));
+    if (it != blocks_.end()) {
+      visit(it->second);
+    }
+    visit(large_);
+  }
+
+private:
+  static constexpr int kBlockSize = 64;
+  static constexpr int kMaxBlocksPerRange = 64;
+
+  struct Entry
+  {
+    Range range;
+    T value;
+
+    bool operator==(const Entry& other) const { return range == other.range && value == other.value; }
+  };
+
+  static uint32_t GetBlock(int block_row, int block_col)
+  {
+    return static_cast<uint32_t>(block_row) * (Position::kMaxCols / kBlockSize + 1) + block_col;
+  }
+
+  static bool IsLarge(const Range& range)
+  {
+    const int block_rows = range.last.row / kBlockSize - range.first.row / kBlockSize + 1;
+    const int block_cols = range.last.col / kBlockSize - range.first.col / kBlockSize + 1;
+    return block_rows * block_cols > kMaxBlocksPerRange;
+  }
+
+  template<typename F>
+  static void ForEachBlock(const Range& range, F func)
+  {
+    for (int i = range.first.row / kBlockSize; i <= range.last.row / kBlockSize; ++i) {
+      for (int j = range.first.col / kBlockSize; j <= range.last.col / kBlockSize; ++j) {
+        func(GetBlock(i, j));
+      }
+    }
+  }
+
+  static bool RemoveFrom(std::vector<Entry>& entries, const Entry& entry)
+  {
+    auto it = std::find(entries.begin(), entries.end(), entry);
+    if (it == entries.end()) {
+      return false;
+    }
+    *it = std::move(entries.back());
+    entries.pop_back();
+    return true;
+  }
+
+  std::unordered_map<uint32_t, std::vector<Entry>> blocks_;
+  std::vector<Entry> large_;
+};
+
+// Values grouped by lines, either rows or columns. A value is removed by its
+// slot in the line, which the last value of the line takes over
+template<typename T>
+class LineIndex
+{
+public:
+  // Returns the slot of the value
+  size_t Add(int line, const T& value)
+  {
+    if (static_cast<size_t>(line) >= lines_.size()) {
+      lines_.resize(line + 1);
+    }
+    lines_[line].push_back(value);
+    return lines_[line].size() - 1;
+  }
+
+  // Returns the value which has taken the slot, if any
+  std::optional<T> Remove(int line, size_t slot)
+  {
+    auto& values = lines_[line];
+    std::optional<T> moved;
+    if (slot + 1 != values.size()) {
+      moved = values[slot] = std::move(values.back());
+    }
+    values.pop_back();
+    return moved;
+  }
+
+  // Calls func for the values of all lines from the given one on
+  template<typename F>
+  void ForEachFrom(int first_line, F func) const
+  {
+    for (size_t line = std::max(first_line, 0); line < lines_.size(); ++line) {
+      for (const auto& value : lines_[line]) {
+        func(value);
+      }
+    }
+  }
+
+private:
+  std::vector<std::vector<T>> lines_;
 };
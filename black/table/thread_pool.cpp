@@ -0,0 +1,94 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threads_count)
+{
+  // the calling thread of ParallelFor works as one more worker
+  const size_t workers_count = max<size_t>(threads_count, 1) - 1;
+  for (size_t i = 0; i <= workers_count; ++i) {
+    queues_.push_back(make_unique<Queue>());
+  }
+  for (size_t i = 0; i < workers_count; ++i) {
+    workers_.emplace_back([this, i] { WorkerLoop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard lock(wake_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+ThreadPool&
+ThreadPool::GetDefault()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+void
+ThreadPool::Push(size_t queue_index, Task task)
+{
+  {
+    lock_guard lock(queues_[queue_index]->mutex);
+    queues_[queue_index]->tasks.push_back(move(task));
+  }
+  {
+    lock_guard lock(wake_mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+}
+
+bool
+ThreadPool::TryRunTask(size_t queue_index)
+{
+  Task task;
+  for (size_t i = 0; i < queues_.size() && !task; ++i) {
+    auto& queue = *queues_[(queue_index + i) % queues_.size()];
+    lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+
+  --queued_;
+  task();
+  return true;
+}
+
+void
+ThreadPool::WorkerLoop(size_t queue_index)
+{
+  for (;;) {
+    if (TryRunTask(queue_index)) {
+      continue;
+    }
+
+    unique_lock lock(wake_mutex_);
+    wake_.wait(lock, [this] { return stop_ || queued_ != 0; });
+    if (stop_) {
+      return;
+    }
+  }
+}
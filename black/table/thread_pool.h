@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a queue: it takes tasks from the
+// back of its own queue and steals from the front of the others when idle
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t threads_count = std::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Pool shared by all sheets, created on first use
+  static ThreadPool& GetDefault();
+
+  size_t GetThreadsCount() const { return workers_.size(); }
+
+  // Calls func(i) for every i in [0, count) and returns when all calls are
+  // done. The calling thread takes part in the work. The first exception
+  // thrown by func is rethrown here
+  template<typename F>
+  void ParallelFor(size_t count, F func);
+
+private:
+  using Task = std::function<void()>;
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void Push(size_t queue_index, Task task);
+  bool TryRunTask(size_t queue_index);
+  void WorkerLoop(size_t queue_index);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_ = 0;
+  bool stop_ = false;
+};
+
+template<typename F>
+void
+ThreadPool::ParallelFor(size_t count, F func)
+{
+  // a few chunks per queue leave room for stealing on uneven load
+  const size_t queues_count = queues_.size();
+  const size_t chunks_count = std::min(count, queues_count * 4);
+  if (chunks_count <= 1 || workers_.empty()) {
+    for (size_t i = 0; i < count; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> remaining = chunks_count;
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+    const size_t first = count * chunk / chunks_count;
+    const size_t last = count * (chunk + 1) / chunks_count;
+    Push(chunk % queues_count, [&, first, last] {
+      try {
+        for (size_t i = first; i < last; ++i) {
+          func(i);
+        }
+      } catch (...) {
+        std::lock_guard lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      --remaining;
+    });
+  }
+
+  // the last queue belongs to the calling thread
+  while (remaining != 0) {
+    if (!TryRunTask(queues_count - 1)) {
+      std::this_thread::yield();
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
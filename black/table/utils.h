@@ -3,12 +3,12 @@
 #include <iterator>
 
 template<typename It>
-class Range
+class IteratorRange
 {
 public:
   using ValueType = typename std::iterator_traits<It>::value_type;
 
-  Range(It begin, It end)
+  IteratorRange(It begin, It end)
     : begin_(begin)
     , end_(end)
   {}
@@ -86,14 +86,14 @@ private:
 };
 
 template<typename Map>
-Range<MapKeyIterator<Map>>
+IteratorRange<MapKeyIterator<Map>>
 GetValuesRange(Map& map)
 {
   return { MapKeyIterator(map.begin()), MapKeyIterator(map.end()) };
 }
 
 template<typename Map>
-Range<ConstMapKeyIterator<Map>>
+IteratorRange<ConstMapKeyIterator<Map>>
 GetValues(const Map& map)
 {
   return { ConstMapKeyIterator(map.begin()), ConstMapKeyIterator(map.end()) };
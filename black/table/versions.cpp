@@ -0,0 +1,334 @@
+#include "versions.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+using namespace std;
+
+CellVersion::CellVersion(string text, unique_ptr<IFormula> formula)
+  : text_(move(text))
+  , formula_(move(formula))
+{}
+
+CellVersion::~CellVersion()
+{
+  delete value_.load(memory_order_relaxed);
+}
+
+ICell::Value
+CellVersion::GetValue() const
+{
+  return *value_.load(memory_order_acquire);
+}
+
+string
+CellVersion::GetText() const
+{
+  return text_;
+}
+
+vector<Position>
+CellVersion::GetReferencedCells() const
+{
+  return formula_ ? formula_->GetReferencedCells() : vector<Position>();
+}
+
+void
+CellVersion::SetValue(Value value) const
+{
+  auto evaluated = make_unique<const Value>(move(value));
+  const Value* expected = nullptr;
+  if (value_.compare_exchange_strong(expected, evaluated.get(), memory_order_acq_rel)) {
+    evaluated.release();
+  }
+}
+
+namespace {
+
+// A coordinate takes kAxisLevels digits of kBits, rows go first
+constexpr int kBits = 5;
+constexpr int kAxisLevels = 3;
+constexpr int kLevels = 2 * kAxisLevels;
+constexpr size_t kFanout = size_t(1) << kBits;
+
+static_assert(Position::kMaxRows <= 1 << (kBits * kAxisLevels) && Position::kMaxCols <= 1 << (kBits * kAxisLevels),
+              "Positions must fit the radix tree");
+
+} // namespace
+
+struct VersionNode
+{
+  // nodes of the next level, or cells at the last one
+  array<void*, kFanout> children{};
+
+  // publication which has created the node, until it is done the node is
+  // changed in place
+  uint64_t generation = 0;
+};
+
+namespace {
+
+bool
+IsRowLevel(int level)
+{
+  return level < kAxisLevels;
+}
+
+int
+GetShift(int level)
+{
+  return kBits * (kAxisLevels - 1 - level % kAxisLevels);
+}
+
+size_t
+GetDigit(const Position& pos, int level)
+{
+  return ((IsRowLevel(level) ? pos.row : pos.col) >> GetShift(level)) & (kFanout - 1);
+}
+
+const CellVersion*
+FindCell(const VersionNode* node, const Position& pos)
+{
+  for (int level = 0; node && level + 1 < kLevels; ++level) {
+    node = static_cast<const VersionNode*>(node->children[GetDigit(pos, level)]);
+  }
+  return node ? static_cast<const CellVersion*>(node->children[GetDigit(pos, kLevels - 1)]) : nullptr;
+}
+
+// Calls func for every cell of a valid range in row-major order. Only the
+// children whose spans intersect the range are visited, row and col are the
+// starts of the node span
+template<typename F>
+void
+VisitCells(const VersionNode* node, int level, int row, int col, const Range& range, F& func)
+{
+  const bool is_row_level = IsRowLevel(level);
+  const int shift = GetShift(level);
+  const int start = is_row_level ? row : col;
+  const int first = is_row_level ? range.first.row : range.first.col;
+  const int last = is_row_level ? range.last.row : range.last.col;
+
+  const size_t first_digit = max(first - start, 0) >> shift;
+  const size_t last_digit = min<size_t>((last - start) >> shift, kFanout - 1);
+  for (size_t digit = first_digit; digit <= last_digit; ++digit) {
+    const void* child = node->children[digit];
+    if (!child) {
+      continue;
+    }
+    const int child_start = start + static_cast<int>(digit << shift);
+    const int child_row = is_row_level ? child_start : row;
+    const int child_col = is_row_level ? col : child_start;
+    if (level + 1 == kLevels) {
+      func(static_cast<const CellVersion*>(child));
+    } else {
+      VisitCells(static_cast<const VersionNode*>(child), level + 1, child_row, child_col, range, func);
+    }
+  }
+}
+
+template<typename F>
+void
+ForEachNode(VersionNode* node, int level, F func)
+{
+  if (!node) {
+    return;
+  }
+  for (void* child : node->children) {
+    if (!child) {
+      continue;
+    }
+    if (level + 1 == kLevels) {
+      func(static_cast<CellVersion*>(child));
+    } else {
+      ForEachNode(static_cast<VersionNode*>(child), level + 1, func);
+    }
+  }
+  func(node);
+}
+
+} // namespace
+
+// Published state of a table. Formulas of its cells are evaluated against it
+// through a read-only ISheet
+class SheetVersion
+  : public ISheetVersion
+  , private ISheet
+{
+public:
+  SheetVersion(VersionNode* root, const Size& printable_size)
+    : root_(root)
+    , printable_size_(printable_size)
+  {}
+
+  ICell::Value GetValue(Position pos) const override
+  {
+    AssertValidPosition(pos);
+    const auto cell = FindCell(root_, pos);
+    if (!cell) {
+      return string();
+    }
+    Evaluate(cell);
+    return cell->GetValue();
+  }
+
+  std::string GetText(Position pos) const override
+  {
+    AssertValidPosition(pos);
+    const auto cell = FindCell(root_, pos);
+    return cell ? cell->GetText() : string();
+  }
+
+  Size GetPrintableSize() const override { return printable_size_; }
+
+  VersionNode* GetRoot() const { return root_; }
+
+private:
+  static void AssertValidPosition(const Position& pos)
+  {
+    if (!pos.IsValid()) {
+      throw InvalidPositionException("Invalid position");
+    }
+  }
+
+  template<typename F>
+  void ForEachCellIn(const Range& range, F func) const
+  {
+    if (range.IsValid()) {
+      VisitCells(root_, 0, 0, 0, range, func);
+    }
+  }
+
+  // Same as ICellImpl::GetValue, but any number of readers may evaluate the
+  // cells at once
+  void Evaluate(const CellVersion* cell) const
+  {
+    vector<const CellVersion*> stack = { cell };
+    while (!stack.empty()) {
+      const CellVersion* top = stack.back();
+      if (top->IsEvaluated()) {
+        stack.pop_back();
+        continue;
+      }
+
+      bool ready = true;
+      auto push_referenced = [&](const CellVersion* referenced_cell) {
+        if (!referenced_cell->IsEvaluated()) {
+          stack.push_back(referenced_cell);
+          ready = false;
+        }
+      };
+      const auto formula = top->GetFormula();
+      for (const auto& pos : formula->GetReferencedCells()) {
+        if (const auto referenced_cell = pos.IsValid() ? FindCell(root_, pos) : nullptr) {
+          push_referenced(referenced_cell);
+        }
+      }
+      for (const auto& range : formula->GetReferencedRanges()) {
+        ForEachCellIn(range, push_referenced);
+      }
+
+      if (ready) {
+        top->SetValue(visit([](const auto& val) { return ICell::Value(val); }, formula->Evaluate(*this)));
+        stack.pop_back();
+      }
+    }
+  }
+
+  // ISheet for formulas, which only read evaluated cells
+  const ICell* GetCell(Position pos) const override { return FindCell(root_, pos); }
+
+  void ForEachCell(const Range& range, const std::function<void(const ICell&)>& visitor) const override
+  {
+    ForEachCellIn(range, [&visitor](const CellVersion* cell) { visitor(*cell); });
+  }
+
+  [[noreturn]] static void ThrowReadOnly() { throw logic_error("Published versions of a table are read-only"); }
+
+  void SetCell(Position, std::string) override { ThrowReadOnly(); }
+  void LoadCells(std::vector<std::pair<Position, std::string>>) override { ThrowReadOnly(); }
+  ICell* GetCell(Position) override { ThrowReadOnly(); }
+  void ClearCell(Position) override { ThrowReadOnly(); }
+  void InsertRows(int, int) override { ThrowReadOnly(); }
+  void InsertCols(int, int) override { ThrowReadOnly(); }
+  void DeleteRows(int, int) override { ThrowReadOnly(); }
+  void DeleteCols(int, int) override { ThrowReadOnly(); }
+  void PrintValues(std::ostream&) const override { ThrowReadOnly(); }
+  void PrintTexts(std::ostream&) const override { ThrowReadOnly(); }
+  void SaveSnapshot(std::ostream&, bool) const override { ThrowReadOnly(); }
+  void Recalculate() const override { ThrowReadOnly(); }
+  void PublishVersion() override { ThrowReadOnly(); }
+  void ReadVersion(const std::function<void(const ISheetVersion&)>&) const override { ThrowReadOnly(); }
+
+  VersionNode* root_;
+  Size printable_size_;
+};
+
+SheetVersions::SheetVersions()
+  : current_(new SheetVersion(nullptr, Size{}))
+{}
+
+SheetVersions::~SheetVersions()
+{
+  const auto current = current_.load();
+  ForEachNode(current->GetRoot(), 0, [](auto object) { delete object; });
+  delete current;
+}
+
+void
+SheetVersions::Publish(vector<pair<Position, unique_ptr<CellVersion>>> cells,
+                       const Size& printable_size,
+                       bool from_scratch)
+{
+  // Nodes and cells which are replaced are reachable from the last version
+  // until the new one is stored, readers which pin an epoch from then on
+  // cannot reach them
+  const auto last = current_.load();
+  VersionNode* root = last->GetRoot();
+  if (from_scratch) {
+    ForEachNode(root, 0, [this](auto object) { epochs_.Retire(object); });
+    root = nullptr;
+  }
+
+  ++generation_;
+  auto make_mutable = [this](void*& child) {
+    auto node = static_cast<VersionNode*>(child);
+    if (!node || node->generation != generation_) {
+      auto copy = node ? new VersionNode(*node) : new VersionNode();
+      copy->generation = generation_;
+      if (node) {
+        epochs_.Retire(node);
+      }
+      child = copy;
+      node = copy;
+    }
+    return node;
+  };
+
+  void* root_child = root;
+  for (auto& [pos, cell] : cells) {
+    if (!cell && !FindCell(static_cast<VersionNode*>(root_child), pos)) {
+      continue;
+    }
+    VersionNode* node = make_mutable(root_child);
+    for (int level = 0; level + 1 < kLevels; ++level) {
+      node = make_mutable(node->children[GetDigit(pos, level)]);
+    }
+    auto& child = node->children[GetDigit(pos, kLevels - 1)];
+    if (child) {
+      epochs_.Retire(static_cast<CellVersion*>(child));
+    }
+    child = cell.release();
+  }
+
+  current_.store(new SheetVersion(static_cast<VersionNode*>(root_child), printable_size));
+  epochs_.Retire(last);
+  epochs_.Reclaim();
+}
+
+void
+SheetVersions::Read(const function<void(const ISheetVersion&)>& reader) const
+{
+  EpochManager::Guard guard(epochs_);
+  reader(*current_.load());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+#include "epoch.h"
+#include "formula.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Cell of published versions of a table. Its content never changes, and so
+// does its value, which is evaluated and cached by the first reader in need.
+// Versions share a cell until it or some cell it depends on changes
+class CellVersion : public ICell
+{
+public:
+  CellVersion(std::string text, std::unique_ptr<IFormula> formula);
+  ~CellVersion() override;
+
+  CellVersion(const CellVersion&) = delete;
+  CellVersion& operator=(const CellVersion&) = delete;
+
+  // The value must have been evaluated
+  Value GetValue() const override;
+  std::string GetText() const override;
+  std::vector<Position> GetReferencedCells() const override;
+
+  const IFormula* GetFormula() const noexcept { return formula_.get(); }
+  bool IsEvaluated() const noexcept { return value_.load(std::memory_order_acquire) != nullptr; }
+
+  // Readers evaluating the cell at once get the same value, the first one to
+  // finish caches it
+  void SetValue(Value value) const;
+
+private:
+  std::string text_;
+  std::unique_ptr<const IFormula> formula_;
+  mutable std::atomic<const Value*> value_ = nullptr;
+};
+
+class SheetVersion;
+
+// Versions of a table published by its writer for concurrent readers. Cells
+// of a version are kept in a persistent radix tree by their positions, so it
+// shares all the nodes but the paths to the changed cells with the previous
+// one. Replaced nodes and cells are reclaimed once no reader can access them
+class SheetVersions
+{
+public:
+  SheetVersions();
+  // No reader may be active
+  ~SheetVersions();
+
+  SheetVersions(const SheetVersions&) = delete;
+  SheetVersions& operator=(const SheetVersions&) = delete;
+
+  // Publishes the last version with the given cells replaced, or only the
+  // given cells if from_scratch. Positions are unique, null cells are erased.
+  // Values of cells without formulas must be set
+  void Publish(std::vector<std::pair<Position, std::unique_ptr<CellVersion>>> cells,
+               const Size& printable_size,
+               bool from_scratch);
+
+  // May be called from any threads concurrently with Publish
+  void Read(const std::function<void(const ISheetVersion&)>& reader) const;
+
+private:
+  EpochManager epochs_;
+  std::atomic<const SheetVersion*> current_;
+
+  // nodes of the version being published are changed in place
+  uint64_t generation_ = 0;
+};
@@ -97,7 +97,23 @@ Map::Process(const TransportCatalog& db) const
   return dict;
 }
 
-variant<Stop, Bus, Map, Route>
+Json::Dict
+NearestStops::Process(const TransportCatalog& db) const
+{
+  vector<Json::Node> stop_nodes;
+  for (const auto& nearby_stop : db.FindNearestStops(position, count, radius)) {
+    stop_nodes.push_back(Json::Dict{
+      { "name", Json::Node(string(nearby_stop.name)) },
+      { "distance", Json::Node(nearby_stop.distance) },
+    });
+  }
+
+  Json::Dict dict;
+  dict["stops"] = Json::Node(move(stop_nodes));
+  return dict;
+}
+
+variant<Stop, Bus, Map, Route, NearestStops>
 Read(const Json::Dict& attrs)
 {
   const string& type = attrs.at("type").AsString();
@@ -107,6 +123,18 @@ Read(const Json::Dict& attrs)
     return Stop{ attrs.at("name").AsString() };
   } else if (type == "Map") {
     return Map{};
+  } else if (type == "NearestStops") {
+    NearestStops request{ { attrs.at("latitude").AsDouble(), attrs.at("longitude").AsDouble() }, nullopt, nullopt };
+    if (auto it = attrs.find("count"); it != end(attrs)) {
+      request.count = size_t(max(it->second.AsInt(), 0));
+    }
+    if (auto it = attrs.find("radius"); it != end(attrs)) {
+      request.radius = it->second.AsDouble();
+    }
+    if (!request.count && !request.radius) {
+      request.count = DEFAULT_NEAREST_STOPS_COUNT;
+    }
+    return request;
   } else {
     return Route{ attrs.at("from").AsString(), attrs.at("to").AsString() };
   }
@@ -3,10 +3,15 @@
 #include "json.h"
 #include "transport_catalog.h"
 
+#include <optional>
 #include <string>
 #include <variant>
 
 namespace Requests {
+// count of a NearestStops request which has neither count nor radius, so that
+// it does not return every stop of the base
+constexpr size_t DEFAULT_NEAREST_STOPS_COUNT = 10;
+
 struct Stop
 {
   std::string name;
@@ -34,7 +39,17 @@ struct Map {
   Json::Dict Process(const TransportCatalog& db) const;
 };
 
-std::variant<Stop, Bus, Map, Route>
+struct NearestStops
+{
+  Sphere::Point position;
+  // DEFAULT_NEAREST_STOPS_COUNT if neither is given
+  std::optional<size_t> count;
+  std::optional<double> radius; // meters
+
+  Json::Dict Process(const TransportCatalog& db) const;
+};
+
+std::variant<Stop, Bus, Map, Route, NearestStops>
 Read(const Json::Dict& attrs);
 
 std::vector<Json::Node>
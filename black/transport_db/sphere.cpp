@@ -17,8 +17,6 @@ Point::FromDegrees(double latitude, double longitude)
   return { ConvertDegreesToRadians(latitude), ConvertDegreesToRadians(longitude) };
 }
 
-const double EARTH_RADIUS = 6'371'000;
-
 double
 Distance(Point lhs, Point rhs)
 {
@@ -3,6 +3,8 @@
 #include <cmath>
 
 namespace Sphere {
+constexpr double EARTH_RADIUS = 6'371'000;
+
 double
 ConvertDegreesToRadians(double degrees);
 
@@ -0,0 +1,193 @@
+#include "stops_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+using namespace std;
+
+struct StopsIndex::SearchState
+{
+  Vector3 point;
+  optional<size_t> count;
+  double max_chord2 = numeric_limits<double>::infinity();
+
+  // max-heap of (squared chord, node index), the farthest found stop on top
+  priority_queue<pair<double, size_t>> found;
+
+  double Bound() const
+  {
+    if (count && found.size() == *count) {
+      return min(max_chord2, found.top().first);
+    }
+    return max_chord2;
+  }
+
+  void Offer(double chord2, size_t node_idx)
+  {
+    if (chord2 > max_chord2) {
+      return;
+    }
+    if (!count || found.size() < *count) {
+      found.emplace(chord2, node_idx);
+    } else if (chord2 < found.top().first) {
+      found.pop();
+      found.emplace(chord2, node_idx);
+    }
+  }
+};
+
+namespace {
+
+double
+SquaredDistance(const array<double, 3>& lhs, const array<double, 3>& rhs)
+{
+  double res = 0.;
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    res += (lhs[i] - rhs[i]) * (lhs[i] - rhs[i]);
+  }
+  return res;
+}
+
+double
+ChordToDistance(double chord)
+{
+  return 2. * asin(min(chord / 2., 1.)) * Sphere::EARTH_RADIUS;
+}
+
+} // namespace
+
+StopsIndex::StopsIndex(vector<StopPosition> stops)
+{
+  nodes_.reserve(stops.size());
+  for (auto& stop : stops) {
+    nodes_.push_back(Node{ ToUnitVector(stop.position), 0, move(stop.name), stop.position });
+  }
+  Build(0, nodes_.size());
+}
+
+vector<StopsIndex::NearbyStop>
+StopsIndex::FindNearest(Sphere::Point position, optional<size_t> count, optional<double> radius) const
+{
+  if (count && *count == 0) {
+    return {};
+  }
+
+  SearchState state;
+  state.point = ToUnitVector(position);
+  state.count = count;
+  if (radius) {
+    const double angle = *radius / Sphere::EARTH_RADIUS;
+    if (angle < 0.) {
+      return {};
+    }
+    if (angle < M_PI) {
+      const double chord = 2. * sin(angle / 2.);
+      state.max_chord2 = chord * chord;
+    }
+  }
+
+  Search(0, nodes_.size(), state);
+
+  vector<NearbyStop> res(state.found.size());
+  for (auto it = rbegin(res); it != rend(res); ++it) {
+    const auto [chord2, node_idx] = state.found.top();
+    state.found.pop();
+    *it = NearbyStop{ nodes_[node_idx].name, ChordToDistance(sqrt(chord2)) };
+  }
+  return res;
+}
+
+void
+StopsIndex::Serialize(transport_db::StopsIndex& db_stops_index) const
+{
+  auto& db_nodes = *db_stops_index.mutable_nodes();
+  db_nodes.Reserve(int(nodes_.size()));
+  for (const auto& node : nodes_) {
+    auto& db_node = *db_nodes.Add();
+    db_node.set_name(node.name);
+    db_node.set_latitude(node.position.latitude);
+    db_node.set_longitude(node.position.longitude);
+    db_node.set_axis(node.axis);
+  }
+}
+
+void
+StopsIndex::Deserialize(const transport_db::StopsIndex& db_stops_index)
+{
+  // nodes are stored in the tree order, so there is nothing to rebuild
+  nodes_.clear();
+  nodes_.reserve(db_stops_index.nodes_size());
+  for (const auto& db_node : db_stops_index.nodes()) {
+    const Sphere::Point position{ db_node.latitude(), db_node.longitude() };
+    nodes_.push_back(Node{ ToUnitVector(position), db_node.axis(), db_node.name(), position });
+  }
+}
+
+void
+StopsIndex::Build(size_t first, size_t last)
+{
+  if (last - first <= 1) {
+    return;
+  }
+
+  // split along the axis of the largest spread
+  Vector3 min_point = nodes_[first].point;
+  Vector3 max_point = nodes_[first].point;
+  for (size_t i = first + 1; i < last; ++i) {
+    for (size_t axis = 0; axis < 3; ++axis) {
+      min_point[axis] = min(min_point[axis], nodes_[i].point[axis]);
+      max_point[axis] = max(max_point[axis], nodes_[i].point[axis]);
+    }
+  }
+  unsigned split_axis = 0;
+  for (unsigned axis = 1; axis < 3; ++axis) {
+    if (max_point[axis] - min_point[axis] > max_point[split_axis] - min_point[split_axis]) {
+      split_axis = axis;
+    }
+  }
+
+  const size_t middle = first + (last - first) / 2;
+  nth_element(begin(nodes_) + first,
+              begin(nodes_) + middle,
+              begin(nodes_) + last,
+              [split_axis](const Node& lhs, const Node& rhs) { return lhs.point[split_axis] < rhs.point[split_axis]; });
+  nodes_[middle].axis = split_axis;
+
+  Build(first, middle);
+  Build(middle + 1, last);
+}
+
+void
+StopsIndex::Search(size_t first, size_t last, SearchState& state) const
+{
+  if (first >= last) {
+    return;
+  }
+
+  const size_t middle = first + (last - first) / 2;
+  const auto& node = nodes_[middle];
+  state.Offer(SquaredDistance(state.point, node.point), middle);
+
+  const double diff = state.point[node.axis] - node.point[node.axis];
+  if (diff < 0.) {
+    Search(first, middle, state);
+    if (diff * diff <= state.Bound()) {
+      Search(middle + 1, last, state);
+    }
+  } else {
+    Search(middle + 1, last, state);
+    if (diff * diff <= state.Bound()) {
+      Search(first, middle, state);
+    }
+  }
+}
+
+StopsIndex::Vector3
+StopsIndex::ToUnitVector(Sphere::Point position)
+{
+  const double latitude = Sphere::ConvertDegreesToRadians(position.latitude);
+  const double longitude = Sphere::ConvertDegreesToRadians(position.longitude);
+  return { cos(latitude) * cos(longitude), cos(latitude) * sin(longitude), sin(latitude) };
+}
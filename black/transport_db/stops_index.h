@@ -0,0 +1,64 @@
+#pragma once
+
+#include "sphere.h"
+
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transport_catalog.pb.h"
+
+// Static k-d tree over stop positions mapped onto the unit sphere. Chord length
+// between unit vectors grows monotonically with the great-circle distance, so
+// nearest stops in 3D are nearest stops on the Earth surface.
+class StopsIndex
+{
+public:
+  struct StopPosition
+  {
+    std::string name;
+    Sphere::Point position;
+  };
+
+  struct NearbyStop
+  {
+    std::string_view name;
+    double distance; // meters
+  };
+
+  StopsIndex() = default;
+  explicit StopsIndex(std::vector<StopPosition> stops);
+
+  // Stops sorted by distance; at most count of them (if set) and not farther
+  // than radius meters (if set)
+  std::vector<NearbyStop> FindNearest(Sphere::Point position,
+                                      std::optional<size_t> count,
+                                      std::optional<double> radius) const;
+
+  void Serialize(transport_db::StopsIndex& db_stops_index) const;
+  void Deserialize(const transport_db::StopsIndex& db_stops_index);
+
+private:
+  using Vector3 = std::array<double, 3>;
+
+  struct Node
+  {
+    Vector3 point;
+    unsigned axis = 0;
+    std::string name;
+    Sphere::Point position;
+  };
+
+  struct SearchState;
+
+  void Build(size_t first, size_t last);
+  void Search(size_t first, size_t last, SearchState& state) const;
+
+  static Vector3 ToUnitVector(Sphere::Point position);
+
+  // nodes_ is an implicit tree: a node at the middle of [first, last) splits the
+  // range into its left and right subtrees
+  std::vector<Node> nodes_;
+};
@@ -4,12 +4,15 @@
 
 #include "json.h"
 #include "requests.h"
+#include "stops_index.h"
 #include "svg_renderer.h"
 #include "test_utils.h"
 #include "transport_catalog.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iterator>
@@ -129,6 +132,93 @@ test_svg_2()
   test_svg("in_svg_2.json", "out_svg_2");
 }
 
+void
+test_nearest_stops()
+{
+  vector<StopsIndex::StopPosition> stops;
+  for (int i = 0; i < 50; ++i) {
+    for (int j = 0; j < 50; ++j) {
+      stops.push_back({ "stop_" + to_string(i) + "_" + to_string(j), { 55. + 0.01 * i, 37. + 0.013 * j } });
+    }
+  }
+  stops.push_back({ "antipode", { -55.3, -142.7 } });
+
+  const StopsIndex index(stops);
+
+  const vector<Sphere::Point> queries = { { 55.2, 37.3 }, { 54., 36. }, { 55.493, 37.641 }, { -55., -143. } };
+  for (const auto& query : queries) {
+    vector<pair<double, string>> expected;
+    for (const auto& stop : stops) {
+      expected.emplace_back(Sphere::Distance(query, stop.position), stop.name);
+    }
+    sort(begin(expected), end(expected));
+
+    const auto nearest = index.FindNearest(query, 10, nullopt);
+    ASSERT_EQUAL(nearest.size(), 10u);
+    for (size_t i = 0; i < nearest.size(); ++i) {
+      ASSERT(fabs(nearest[i].distance - expected[i].first) < 1e-2);
+    }
+
+    const double radius = 3'000.;
+    const auto in_radius = index.FindNearest(query, nullopt, radius);
+    const auto expected_count =
+      count_if(begin(expected), end(expected), [radius](const auto& item) { return item.first <= radius; });
+    ASSERT_EQUAL(in_radius.size(), size_t(expected_count));
+  }
+
+  // a request bounded by neither count nor radius is bounded by the default count
+  const auto request = get<Requests::NearestStops>(Requests::Read(Json::Dict{
+    { "type", Json::Node("NearestStops"s) },
+    { "latitude", Json::Node(55.2) },
+    { "longitude", Json::Node(37.3) },
+  }));
+  ASSERT_EQUAL(request.count.value_or(0), Requests::DEFAULT_NEAREST_STOPS_COUNT);
+  ASSERT(!request.radius);
+}
+
+void
+bench_serialization()
+{
+  TestDataHandler test_data(TEST_DIR, "in_routes_4.json", "out_routes_4.json");
+
+  const auto input_doc = Json::Load(test_data.InputData());
+  const auto& input_map = input_doc.GetRoot().AsMap();
+
+  const TransportCatalog db(Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
+                            input_map.at("routing_settings").AsMap());
+
+  const auto file = (filesystem::temp_directory_path() / "transport_db_bench.pb").string();
+  const Json::Dict serialization_settings = { { "file", Json::Node(file) } };
+
+  constexpr int iterations = 5;
+
+  const auto serialize_start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    db.Serialize(serialization_settings);
+  }
+  const auto serialize_finish = chrono::steady_clock::now();
+
+  // sections are loaded lazily, so touch each of them
+  for (int i = 0; i < iterations; ++i) {
+    const auto deserialized_db = TransportCatalog::Deserialize(serialization_settings);
+    ASSERT(deserialized_db.GetBus("11") != nullptr);
+    ASSERT(deserialized_db.GetStop("Kremlin") != nullptr);
+    ASSERT(deserialized_db.FindRoute("Kremlin", "Kremlin").has_value());
+    ASSERT(deserialized_db.FindNearestStops({ 55.75, 37.62 }, 1, nullopt).size() == 1u);
+  }
+  const auto deserialize_finish = chrono::steady_clock::now();
+
+  const double megabytes = iterations * filesystem::file_size(file) / (1024. * 1024.);
+  const auto report = [megabytes](const char* name, auto start, auto finish) {
+    const double seconds = chrono::duration<double>(finish - start).count();
+    cerr << name << ": " << megabytes / seconds << " MB/s" << endl;
+  };
+  report("serialize", serialize_start, serialize_finish);
+  report("deserialize", serialize_finish, deserialize_finish);
+
+  filesystem::remove(file);
+}
+
 void
 run_tests()
 {
@@ -141,6 +231,8 @@ run_tests()
   RUN_TEST(tr, test_json_routes_4);
   RUN_TEST(tr, test_svg_1);
   RUN_TEST(tr, test_svg_2);
+  RUN_TEST(tr, test_nearest_stops);
+  RUN_TEST(tr, bench_serialization);
 }
 
 #endif
@@ -8,31 +8,30 @@
 #include <fstream>
 #include <sstream>
 
+#include <google/protobuf/arena.h>
+
 using namespace std;
 
 namespace {
 
-transport_db::Stop
-StopToPB(const string& name, const Responses::Stop& stop)
+void
+StopToPB(const string& name, const Responses::Stop& stop, transport_db::Stop& res)
 {
-  transport_db::Stop res;
   res.set_name(name);
+  res.mutable_buses()->Reserve(int(stop.bus_names.size()));
   for (const auto& bus : stop.bus_names) {
     res.add_buses(bus);
   }
-  return res;
 }
 
-transport_db::Bus
-BusToPB(const string& name, const Responses::Bus& bus)
+void
+BusToPB(const string& name, const Responses::Bus& bus, transport_db::Bus& res)
 {
-  transport_db::Bus res;
   res.set_name(name);
   res.set_stop_count(unsigned(bus.stop_count));
   res.set_unique_stop_count(unsigned(bus.unique_stop_count));
   res.set_road_route_length(bus.road_route_length);
   res.set_geo_route_length(bus.geo_route_length);
-  return res;
 }
 
 pair<string, Responses::Stop>
@@ -56,12 +55,78 @@ BusFromPB(const transport_db::Bus& bus)
   return { bus.name(), res };
 }
 
+// Nested messages of the catalog are many and small (router entries mostly),
+// so they are allocated from an arena in large blocks
+google::protobuf::ArenaOptions
+MakeArenaOptions(size_t expected_size)
+{
+  google::protobuf::ArenaOptions options;
+  options.start_block_size = max<size_t>(options.start_block_size, expected_size);
+  options.max_block_size = max<size_t>(options.max_block_size, 1 << 20);
+  return options;
+}
+
+// Reads sections of a base file on demand, see CatalogHeader
+class BaseReader
+{
+public:
+  explicit BaseReader(string file)
+    : file_(move(file))
+  {
+    ifstream input(file_, ios::in | ios::binary);
+    google::protobuf::io::IstreamInputStream raw_input(&input);
+    google::protobuf::io::CodedInputStream coded_input(&raw_input);
+
+    transport_db::CatalogHeader header;
+    uint32_t header_size = 0;
+    bool read_res = coded_input.ReadVarint32(&header_size);
+    const auto limit = coded_input.PushLimit(int(header_size));
+    read_res = read_res && header.MergeFromCodedStream(&coded_input) && coded_input.ConsumedEntireMessage();
+    assert(read_res);
+    coded_input.PopLimit(limit);
+
+    sections_offset_ = size_t(coded_input.CurrentPosition());
+    for (const auto& db_section : header.sections()) {
+      sections_[db_section.type()] = { size_t(db_section.offset()), size_t(db_section.size()) };
+    }
+  }
+
+  template<typename Message, typename Loader>
+  auto Load(transport_db::CatalogSection::Type type, Loader loader) const
+  {
+    string data;
+    if (auto it = sections_.find(type); it != end(sections_)) {
+      ifstream input(file_, ios::in | ios::binary);
+      input.seekg(sections_offset_ + it->second.offset);
+      data.resize(it->second.size);
+      input.read(data.data(), data.size());
+      assert(input);
+    }
+
+    google::protobuf::Arena arena(MakeArenaOptions(data.size()));
+    auto& db_section = *google::protobuf::Arena::CreateMessage<Message>(&arena);
+    const bool read_res = db_section.ParseFromArray(data.data(), int(data.size()));
+    assert(read_res);
+    return loader(db_section);
+  }
+
+private:
+  struct Section
+  {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  string file_;
+  size_t sections_offset_ = 0;
+  unordered_map<int, Section> sections_;
+};
+
 } // namespace
 
 TransportCatalog::TransportCatalog(vector<Descriptions::InputQuery> data,
                                    const Json::Dict& routing_settings_json,
                                    unique_ptr<MapRenderer> renderer)
-  : renderer_(move(renderer))
 {
   auto stops_end =
     partition(begin(data), end(data), [](const auto& item) { return holds_alternative<Descriptions::Stop>(item); });
@@ -69,98 +134,138 @@ TransportCatalog::TransportCatalog(vector<Descriptions::InputQuery> data,
   map<string, Descriptions::Stop> stops_map;
   map<string, Descriptions::Bus> buses_map;
 
+  unordered_map<string, Stop> stops;
+  unordered_map<string, Bus> buses;
+
   Descriptions::StopsDict stops_dict;
+  vector<StopsIndex::StopPosition> stop_positions;
   for (const auto& item : Range{ begin(data), stops_end }) {
     const auto& stop = get<Descriptions::Stop>(item);
     stops_dict[stop.name] = &stop;
-    stops_.insert({ stop.name, {} });
+    stops.insert({ stop.name, {} });
     stops_map.emplace(stop.name, stop);
+    stop_positions.push_back({ stop.name, stop.position });
   }
+  stops_index_ = LazyValue(StopsIndex(move(stop_positions)));
 
   Descriptions::BusesDict buses_dict;
   for (const auto& item : Range{ stops_end, end(data) }) {
     const auto& bus = get<Descriptions::Bus>(item);
 
     buses_dict[bus.name] = &bus;
-    buses_[bus.name] = Bus{ bus.stops.size(),
-                            ComputeUniqueItemsCount(AsRange(bus.stops)),
-                            ComputeRoadRouteLength(bus.stops, stops_dict),
-                            ComputeGeoRouteDistance(bus.stops, stops_dict) };
+    buses[bus.name] = Bus{ bus.stops.size(),
+                           ComputeUniqueItemsCount(AsRange(bus.stops)),
+                           ComputeRoadRouteLength(bus.stops, stops_dict),
+                           ComputeGeoRouteDistance(bus.stops, stops_dict) };
 
     for (const string& stop_name : bus.stops) {
-      stops_.at(stop_name).bus_names.insert(bus.name);
+      stops.at(stop_name).bus_names.insert(bus.name);
     }
 
     buses_map.emplace(bus.name, bus);
   }
 
-  if (renderer_) {
-    renderer_->Init(std::move(stops_map), std::move(buses_map));
+  if (renderer) {
+    renderer->Init(std::move(stops_map), std::move(buses_map));
   }
-  router_ = make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json);
+  renderer_ = LazyValue(move(renderer));
+  router_ = LazyValue(make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json));
+  stops_ = LazyValue(move(stops));
+  buses_ = LazyValue(move(buses));
 }
 
 const TransportCatalog::Stop*
 TransportCatalog::GetStop(const string& name) const
 {
-  return GetValuePointer(stops_, name);
+  return GetValuePointer(stops_.Get(), name);
 }
 
 const TransportCatalog::Bus*
 TransportCatalog::GetBus(const string& name) const
 {
-  return GetValuePointer(buses_, name);
+  return GetValuePointer(buses_.Get(), name);
 }
 
 optional<TransportCatalog::Route>
 TransportCatalog::FindRoute(const string& stop_from, const string& stop_to) const
 {
-  auto route = router_->FindRoute(stop_from, stop_to);
+  auto route = router_.Get()->FindRoute(stop_from, stop_to);
   if (!route) {
     return nullopt;
   }
   string route_map;
-  if (renderer_) {
-    route_map = renderer_->RenderRoute(*route);
+  if (const auto& renderer = renderer_.Get()) {
+    route_map = renderer->RenderRoute(*route);
   }
   return TransportCatalog::Route{ std::move(*route), std::move(route_map) };
 }
 
+vector<Responses::NearbyStop>
+TransportCatalog::FindNearestStops(Sphere::Point position, optional<size_t> count, optional<double> radius) const
+{
+  return stops_index_.Get().FindNearest(position, count, radius);
+}
+
 string
 TransportCatalog::RenderMap() const
 {
-  if (!renderer_) {
+  const auto& renderer = renderer_.Get();
+  if (!renderer) {
     return {};
   }
 
-  return renderer_->Render();
+  return renderer->Render();
 }
 
 TransportCatalog
 TransportCatalog::Deserialize(const Json::Dict& serialization_settings)
 {
-  const auto& file = serialization_settings.at("file").AsString();
-  ifstream input(file, ios::in | ios::binary);
+  using Section = transport_db::CatalogSection;
 
-  transport_db::TransportCatalog db_catalog;
-  const bool read_res = db_catalog.ParseFromIstream(&input);
-  assert(read_res);
+  auto reader = make_shared<const BaseReader>(serialization_settings.at("file").AsString());
 
   TransportCatalog res{};
-  for (const auto& db_stop : db_catalog.stops()) {
-    auto name2stop = StopFromPB(db_stop);
-    res.stops_[move(name2stop.first)] = move(name2stop.second);
-  }
-  for (const auto& db_bus : db_catalog.buses()) {
-    auto name2bus = BusFromPB(db_bus);
-    res.buses_[move(name2bus.first)] = move(name2bus.second);
-  }
-
-  res.router_ = make_unique<TransportRouter>();
-  res.router_->Deserialize(db_catalog.transport_router());
-
-  res.renderer_ = make_unique<Svg::MapRenderer>();
-  res.renderer_->Deserialize(db_catalog.transport_renderer());
+  res.stops_ = LazyValue<unordered_map<string, Stop>>([reader] {
+    return reader->Load<transport_db::Stops>(Section::STOPS, [](const auto& db_stops) {
+      unordered_map<string, Stop> stops;
+      stops.reserve(db_stops.stops_size());
+      for (const auto& db_stop : db_stops.stops()) {
+        stops.insert(StopFromPB(db_stop));
+      }
+      return stops;
+    });
+  });
+  res.buses_ = LazyValue<unordered_map<string, Bus>>([reader] {
+    return reader->Load<transport_db::Buses>(Section::BUSES, [](const auto& db_buses) {
+      unordered_map<string, Bus> buses;
+      buses.reserve(db_buses.buses_size());
+      for (const auto& db_bus : db_buses.buses()) {
+        buses.insert(BusFromPB(db_bus));
+      }
+      return buses;
+    });
+  });
+  res.router_ = LazyValue<unique_ptr<TransportRouter>>([reader] {
+    return reader->Load<transport_db::TransportRouter>(Section::ROUTER, [](const auto& db_router) {
+      auto router = make_unique<TransportRouter>();
+      router->Deserialize(db_router);
+      return router;
+    });
+  });
+  res.renderer_ = LazyValue<unique_ptr<MapRenderer>>([reader] {
+    return reader->Load<transport_db::TransportRenderer>(Section::RENDERER, [](const auto& db_renderer) {
+      unique_ptr<MapRenderer> renderer = make_unique<Svg::MapRenderer>();
+      renderer->Deserialize(db_renderer);
+      return renderer;
+    });
+  });
+  res.stops_index_ = LazyValue<StopsIndex>([reader] {
+    return reader->Load<transport_db::StopsIndex>(Section::STOPS_INDEX, [](const auto& db_stops_index) {
+      StopsIndex stops_index;
+      stops_index.Deserialize(db_stops_index);
+      return stops_index;
+    });
+  });
 
   return res;
 }
@@ -168,31 +273,66 @@ TransportCatalog::Deserialize(const Json::Dict& serialization_settings)
 void
 TransportCatalog::Serialize(const Json::Dict& serialization_settings) const
 {
-  transport_db::TransportCatalog db_catalog;
-
-  auto& db_stops = *db_catalog.mutable_stops();
-  db_stops.Reserve(int(stops_.size()));
-  for (const auto& [stop_name, stop] : stops_) {
-    *db_stops.Add() = StopToPB(stop_name, stop);
+  using Section = transport_db::CatalogSection;
+
+  google::protobuf::Arena arena(MakeArenaOptions(0));
+
+  transport_db::CatalogHeader header;
+  string sections_data;
+  auto add_section = [&header, &sections_data](Section::Type type, const google::protobuf::MessageLite& db_section) {
+    auto& db_section_info = *header.add_sections();
+    db_section_info.set_type(type);
+    db_section_info.set_offset(sections_data.size());
+    const bool serialize_res = db_section.AppendToString(&sections_data);
+    assert(serialize_res);
+    db_section_info.set_size(sections_data.size() - db_section_info.offset());
+  };
+
+  {
+    auto& db_stops = *google::protobuf::Arena::CreateMessage<transport_db::Stops>(&arena);
+    const auto& stops = stops_.Get();
+    db_stops.mutable_stops()->Reserve(int(stops.size()));
+    for (const auto& [stop_name, stop] : stops) {
+      StopToPB(stop_name, stop, *db_stops.add_stops());
+    }
+    add_section(Section::STOPS, db_stops);
   }
-  auto& db_buses = *db_catalog.mutable_buses();
-  db_buses.Reserve(int(buses_.size()));
-  for (const auto& [bus_name, bus] : buses_) {
-    *db_buses.Add() = BusToPB(bus_name, bus);
+  {
+    auto& db_buses = *google::protobuf::Arena::CreateMessage<transport_db::Buses>(&arena);
+    const auto& buses = buses_.Get();
+    db_buses.mutable_buses()->Reserve(int(buses.size()));
+    for (const auto& [bus_name, bus] : buses) {
+      BusToPB(bus_name, bus, *db_buses.add_buses());
+    }
+    add_section(Section::BUSES, db_buses);
   }
 
   // here (not only though) the dragons will be
-  if (router_) {
-    router_->Serialize(*db_catalog.mutable_transport_router());
+  if (const auto& router = router_.Get()) {
+    auto& db_router = *google::protobuf::Arena::CreateMessage<transport_db::TransportRouter>(&arena);
+    router->Serialize(db_router);
+    add_section(Section::ROUTER, db_router);
   }
-  if (renderer_) {
-    renderer_->Serialize(*db_catalog.mutable_transport_renderer());
+  if (const auto& renderer = renderer_.Get()) {
+    auto& db_renderer = *google::protobuf::Arena::CreateMessage<transport_db::TransportRenderer>(&arena);
+    renderer->Serialize(db_renderer);
+    add_section(Section::RENDERER, db_renderer);
+  }
+  {
+    auto& db_stops_index = *google::protobuf::Arena::CreateMessage<transport_db::StopsIndex>(&arena);
+    stops_index_.Get().Serialize(db_stops_index);
+    add_section(Section::STOPS_INDEX, db_stops_index);
   }
 
   const auto& file = serialization_settings.at("file").AsString();
   ofstream output(file, ios::out | ios::trunc | ios::binary);
-  const bool write_res = db_catalog.SerializeToOstream(&output);
-  assert(write_res);
+  {
+    google::protobuf::io::OstreamOutputStream raw_output(&output);
+    const bool write_res = WriteDelimitedTo(header, &raw_output);
+    assert(write_res);
+  }
+  output.write(sections_data.data(), sections_data.size());
+  assert(output);
 }
 
 int
@@ -2,6 +2,7 @@
 
 #include "descriptions.h"
 #include "json.h"
+#include "stops_index.h"
 #include "transport_router.h"
 #include "utils.h"
 
@@ -32,6 +33,8 @@ struct Route
   std::string route_map;
 };
 
+using NearbyStop = StopsIndex::NearbyStop;
+
 }
 
 class MapRenderer
@@ -68,6 +71,10 @@ public:
 
   std::optional<Route> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
 
+  std::vector<Responses::NearbyStop> FindNearestStops(Sphere::Point position,
+                                                      std::optional<size_t> count,
+                                                      std::optional<double> radius) const;
+
   std::string RenderMap() const;
 
   void Serialize(const Json::Dict& serialization_settings) const;
@@ -79,8 +86,10 @@ private:
   static double ComputeGeoRouteDistance(const std::vector<std::string>& stops,
                                         const Descriptions::StopsDict& stops_dict);
 
-  std::unordered_map<std::string, Stop> stops_;
-  std::unordered_map<std::string, Bus> buses_;
-  std::unique_ptr<TransportRouter> router_;
-  std::unique_ptr<MapRenderer> renderer_;
+  // A deserialized catalog reads each section of the base file on its first use
+  LazyValue<std::unordered_map<std::string, Stop>> stops_;
+  LazyValue<std::unordered_map<std::string, Bus>> buses_;
+  LazyValue<std::unique_ptr<TransportRouter>> router_;
+  LazyValue<std::unique_ptr<MapRenderer>> renderer_;
+  LazyValue<StopsIndex> stops_index_;
 };
@@ -2,7 +2,9 @@
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
 #include <iterator>
+#include <memory>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
@@ -130,3 +132,31 @@ IsZero(double val)
   return std::abs(val) < 1e-10;
 }
 
+template<typename T>
+class LazyValue
+{
+public:
+  using Builder = std::function<T()>;
+
+  LazyValue() = default;
+
+  explicit LazyValue(Builder init)
+    : builder_{ std::move(init) }
+  {}
+
+  explicit LazyValue(T value)
+    : obj_{ std::make_unique<T>(std::move(value)) }
+  {}
+
+  const T& Get() const
+  {
+    if (!obj_) {
+      obj_ = std::make_unique<T>(builder_ ? builder_() : T{});
+    }
+    return *obj_;
+  }
+
+private:
+  Builder builder_;
+  mutable std::unique_ptr<T> obj_;
+};
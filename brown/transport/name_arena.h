@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Interns names into large char blocks. Views returned by Intern stay valid
+// for the arena lifetime (moving the arena keeps them valid as well).
+class NameArena
+{
+public:
+  NameArena() = default;
+  NameArena(NameArena&&) = default;
+  NameArena& operator=(NameArena&&) = default;
+
+  std::string_view Intern(std::string_view name)
+  {
+    if (auto it = names_.find(name); it != end(names_)) {
+      return *it;
+    }
+
+    if (name.size() > block_free_) {
+      const auto block_size = std::max(BLOCK_SIZE, name.size());
+      blocks_.push_back(std::make_unique<char[]>(block_size));
+      block_pos_ = blocks_.back().get();
+      block_free_ = block_size;
+    }
+
+    std::memcpy(block_pos_, name.data(), name.size());
+    const std::string_view interned(block_pos_, name.size());
+    block_pos_ += name.size();
+    block_free_ -= name.size();
+
+    names_.insert(interned);
+    return interned;
+  }
+
+  std::size_t Size() const { return names_.size(); }
+
+private:
+  static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* block_pos_ = nullptr;
+  std::size_t block_free_ = 0;
+
+  std::unordered_set<std::string_view> names_;
+};
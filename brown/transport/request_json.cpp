@@ -196,7 +196,7 @@ AddBusRequest::Parse(const Node& node)
 void
 AddBusRequest::Process(TransportManager& tm) const
 {
-  auto stops = stops_;
+  vector<string_view> stops(begin(stops_), end(stops_));
   tm.AddBusRoute(bus_, stops, is_roundtrip_);
 }
 
@@ -221,7 +221,8 @@ AddStopRequest::Parse(const Node& node)
 void
 AddStopRequest::Process(TransportManager& tm) const
 {
-  tm.AddStop(stop_name_, latitude_, longitude_, record_);
+  TransportManager::DistanceTableRecord record(begin(record_), end(record_));
+  tm.AddStop(stop_name_, latitude_, longitude_, record);
 }
 
 void
@@ -331,13 +332,13 @@ GetRouteRequest::Process(const TransportManager& tm) const
       if (activity.index() == stop_activity_idx) {
         const auto& stop_activity = get<StopActivity>(activity);
         activity_node["type"] = Node(string("Wait"));
-        activity_node["stop_name"] = stop_activity.stop_;
+        activity_node["stop_name"] = string(stop_activity.stop_);
         activity_node["time"] = stop_activity.time_;
 
       } else if (activity.index() == bus_activity_idx) {
         const auto& bus_activity = get<BusActivity>(activity);
         activity_node["type"] = Node(string("Bus"));
-        activity_node["bus"] = bus_activity.bus_;
+        activity_node["bus"] = string(bus_activity.bus_);
         activity_node["span_count"] = int(bus_activity.span_);
         activity_node["time"] = bus_activity.time_;
       }
@@ -122,14 +122,13 @@ public:
   double Latitude() const { return latitude_; }
   double Longitude() const { return longitude_; }
   const TransportManager::StopId& Stop() const { return stop_name_; }
-  const TransportManager::DistanceTableRecord& Record() const
-  {
-    return record_;
-  }
+  using DistanceTableRecord =
+    std::vector<std::pair<TransportManager::StopId, double>>;
+  const DistanceTableRecord& Record() const { return record_; }
 
 private:
   TransportManager::StopId stop_name_;
-  TransportManager::DistanceTableRecord record_;
+  DistanceTableRecord record_;
   double latitude_ = 0.;
   double longitude_ = 0.;
 };
@@ -3,6 +3,8 @@
 #include "transport_manager.h"
 #include "utils.h"
 
+#include <charconv>
+#include <iterator>
 #include <map>
 #include <sstream>
 #include <string>
@@ -33,22 +35,18 @@ AddBusRequest::is_one_way(string_view route_desc) const
 void
 AddBusRequest::read(string_view operation, string_view operand)
 {
-  stops_data_ = operand;
-
   bus_ = operation;
 
-  is_roundtrip_ = is_one_way(stops_data_);
+  is_roundtrip_ = is_one_way(operand);
   string_view separator = is_roundtrip_ ? " > " : " - ";
 
-  const auto stops_raw = Split(stops_data_, separator);
-  stops_.insert(begin(stops_), begin(stops_raw), end(stops_raw));
+  stops_ = Split(operand, separator);
 }
 
 void
 AddBusRequest::process(TransportManager& tm) const
 {
-  vector<string> stops(begin(stops_), end(stops_));
-  tm.AddBusRoute(bus_, stops, is_roundtrip_);
+  tm.AddBusRoute(bus_, stops_, is_roundtrip_);
 }
 
 AddBusStopRequest::AddBusStopRequest()
@@ -182,40 +180,63 @@ get_request_type(string_view operation, string_view operand)
   }
 }
 
-vector<RequestPtr>
-read_requests_impl(istream& is = cin)
+vector<char>
+read_all(istream& is)
 {
-  string number_requests_str;
-  getline(is, number_requests_str);
-  const auto number_requests = stoi(number_requests_str);
+  vector<char> data;
+
+  const auto start = is.tellg();
+  if (start != istream::pos_type(-1) && is.seekg(0, ios::end)) {
+    const auto size = is.tellg() - start;
+    is.seekg(start);
+    data.resize(size);
+    is.read(data.data(), size);
+    data.resize(is.gcount());
+  } else {
+    is.clear();
+    data.assign(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+  }
+
+  return data;
+}
 
-  vector<RequestPtr> requests;
-  requests.reserve(number_requests);
+string_view
+read_line(string_view& data)
+{
+  auto line = ReadToken(data, "\n");
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  return line;
+}
 
-  for (auto i = decltype(number_requests){ 0 }; i < number_requests; ++i) {
-    string request_str;
-    getline(is, request_str);
-    if (auto request = read_request(request_str)) {
+void
+read_requests_impl(string_view& data, vector<RequestPtr>& requests)
+{
+  const auto number_requests_str = read_line(data);
+  size_t number_requests = 0;
+  from_chars(number_requests_str.data(),
+             number_requests_str.data() + number_requests_str.size(),
+             number_requests);
+
+  requests.reserve(requests.size() + number_requests);
+  for (size_t i = 0; i < number_requests && !data.empty(); ++i) {
+    if (auto request = read_request(read_line(data))) {
       requests.push_back(move(request));
     }
   }
-  return requests;
 }
 
-vector<RequestPtr>
+RequestBatch
 read_requests(istream& is)
 {
-  auto write_requests = read_requests_impl(is);
-  auto read_requests = read_requests_impl(is);
-
-  vector<RequestPtr> requests;
-  requests.insert(end(requests),
-                  make_move_iterator(begin(write_requests)),
-                  make_move_iterator(end(write_requests)));
-  requests.insert(end(requests),
-                  make_move_iterator(begin(read_requests)),
-                  make_move_iterator(end(read_requests)));
-  return requests;
+  RequestBatch batch;
+  batch.data_ = read_all(is);
+
+  string_view data(batch.data_.data(), batch.data_.size());
+  read_requests_impl(data, batch.requests_); // write requests
+  read_requests_impl(data, batch.requests_); // read requests
+  return batch;
 }
 
 RequestPtr
@@ -256,6 +277,12 @@ process_requests(const vector<RequestPtr>& requests)
   return res;
 }
 
+vector<string>
+process_requests(const RequestBatch& batch)
+{
+  return process_requests(batch.requests_);
+}
+
 void
 print_responses(const vector<string>& responses, ostream& os)
 {
@@ -8,6 +8,8 @@
 #include <string_view>
 #include <vector>
 
+// Plain requests keep views into the text they were read from, see
+// RequestBatch
 struct Request
 {
   enum class Type
@@ -50,9 +52,8 @@ struct AddBusRequest : public WriteRequest
   void read(std::string_view operation, std::string_view operand) override;
   void process(TransportManager& tm) const override;
 
-  TransportManager::BusId bus_;
+  std::string_view bus_;
   std::vector<std::string_view> stops_;
-  std::string stops_data_;
   bool is_roundtrip_ = false;
 };
 
@@ -63,7 +64,7 @@ struct AddBusStopRequest : public WriteRequest
   void read(std::string_view operation, std::string_view operand) override;
   void process(TransportManager& tm) const override;
 
-  std::string stop_name_;
+  std::string_view stop_name_;
   double latitude_ = 0.;
   double longitude_ = 0.;
   TransportManager::DistanceTableRecord record_;
@@ -76,7 +77,7 @@ struct GetBusRequest : public ReadRequest<std::string>
   void read(std::string_view data) override;
   std::string process(const TransportManager& tm) const override;
 
-  TransportManager::BusId bus_;
+  std::string_view bus_;
 };
 
 struct GetStopRequest : public ReadRequest<std::string>
@@ -86,20 +87,30 @@ struct GetStopRequest : public ReadRequest<std::string>
   void read(std::string_view data) override;
   std::string process(const TransportManager& tm) const override;
 
-  TransportManager::StopId stop_;
+  std::string_view stop_;
 };
 
 using RequestPtr = std::unique_ptr<Request>;
 
+// The whole input is read in one block, requests refer to it by views
+struct RequestBatch
+{
+  std::vector<char> data_;
+  std::vector<RequestPtr> requests_;
+};
+
 RequestPtr
 read_request(std::string_view request_str);
 
-std::vector<RequestPtr>
+RequestBatch
 read_requests(std::istream& is = std::cin);
 
 std::vector<std::string>
 process_requests(const std::vector<RequestPtr>& requests);
 
+std::vector<std::string>
+process_requests(const RequestBatch& batch);
+
 void
 print_responses(const std::vector<std::string>& responses,
                 std::ostream& os = std::cout);
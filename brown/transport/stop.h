@@ -2,22 +2,23 @@
 
 #include "geography.h"
 
-#include <string>
+#include <string_view>
 #include <utility>
 
+// The name is not owned, see TransportManager
 class Stop
 {
 public:
-  Stop(std::string name, double latitude, double longitude)
-    : name_{ std::move(name) }
+  Stop(std::string_view name, double latitude, double longitude)
+    : name_{ name }
     , coords_{ latitude, longitude }
   {}
 
-  const std::string& GetName() const { return name_; }
+  std::string_view GetName() const { return name_; }
   const EarthCoords& GetCoords() const { return coords_; }
 
 private:
-  std::string name_;
+  std::string_view name_;
   EarthCoords coords_;
 };
 
@@ -29,11 +30,11 @@ struct StopComparator
   {
     return lhs.GetName() < rhs.GetName();
   }
-  bool operator()(const std::string& lhs, const Stop& rhs) const
+  bool operator()(std::string_view lhs, const Stop& rhs) const
   {
     return lhs < rhs.GetName();
   }
-  bool operator()(const Stop& lhs, const std::string& rhs) const
+  bool operator()(const Stop& lhs, std::string_view rhs) const
   {
     return lhs.GetName() < rhs;
   }
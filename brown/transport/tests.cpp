@@ -4,6 +4,7 @@
 #include "request_plain.h"
 #include "transport_manager.h"
 
+#include <chrono>
 #include <fstream>
 
 bool
@@ -375,6 +376,56 @@ Stop Biryulyovo Zapadnoye: buses 256 828
   test_pipeline(input, output);
 }
 
+void
+bench_plain_throughput()
+{
+  constexpr size_t stop_count = 20'000;
+  constexpr size_t bus_count = 2'000;
+  constexpr size_t bus_stop_count = 25;
+
+  auto stop_name = [](size_t idx) { return "Stop name " + to_string(idx); };
+
+  ostringstream input;
+  input << stop_count + bus_count << "\n";
+  for (size_t i = 0; i < stop_count; ++i) {
+    input << "Stop " << stop_name(i) << ": " << 55. + i * 1e-5 << ", "
+          << 37. + i * 1e-5;
+    for (size_t j = 1; j <= 3; ++j) {
+      input << ", " << 100 * j << "m to " << stop_name((i + j) % stop_count);
+    }
+    input << "\n";
+  }
+  for (size_t i = 0; i < bus_count; ++i) {
+    input << "Bus " << i << ": ";
+    for (size_t j = 0; j < bus_stop_count; ++j) {
+      input << (j ? " > " : "") << stop_name((i * 7 + j) % stop_count);
+    }
+    input << " > " << stop_name(i * 7 % stop_count) << "\n";
+  }
+  input << stop_count + bus_count << "\n";
+  for (size_t i = 0; i < bus_count; ++i) {
+    input << "Bus " << i << "\n";
+  }
+  for (size_t i = 0; i < stop_count; ++i) {
+    input << "Stop " << stop_name(i) << "\n";
+  }
+
+  const auto input_str = input.str();
+  istringstream is(input_str);
+
+  const auto start = chrono::steady_clock::now();
+  const auto requests = read_requests(is);
+  const auto responses = process_requests(requests);
+  const auto finish = chrono::steady_clock::now();
+
+  ASSERT_EQUAL(responses.size(), stop_count + bus_count);
+
+  const auto seconds = chrono::duration<double>(finish - start).count();
+  const auto megabytes = input_str.size() / (1024. * 1024.);
+  cerr << "plain mode: " << megabytes << " MB in " << seconds << " s, "
+       << megabytes / seconds << " MB/s" << endl;
+}
+
 void
 test_json_add_bus()
 {
@@ -583,6 +634,7 @@ run_tests()
   RUN_TEST(tr, test_readget_bus);
   RUN_TEST(tr, test_readget_stop);
   RUN_TEST(tr, test_pipeline_v3);
+  RUN_TEST(tr, bench_plain_throughput);
 
   RUN_TEST(tr, test_json_add_bus);
   RUN_TEST(tr, test_json_add_stop);
@@ -3,51 +3,61 @@
 #include "profile.h"
 
 #include <algorithm>
+#include <cassert>
 #include <iterator>
 
 using namespace std;
 
 void
-TransportManager::AddStop(StopId stop_id,
-                           double latitude,
-                           double longitude,
-                           const DistanceTableRecord& dist_table_rec)
+TransportManager::AddStop(string_view stop_id,
+                          double latitude,
+                          double longitude,
+                          const DistanceTableRecord& dist_table_rec)
 {
+  stop_id = names_.Intern(stop_id);
+
   auto& dist_from_here = dist_table_[stop_id];
   for (const auto& [stop_id_to, dist] : dist_table_rec) {
-    dist_from_here[stop_id_to] = dist;
-    dist_table_[stop_id_to].emplace(stop_id, dist);
+    const auto stop_id_to_interned = names_.Intern(stop_id_to);
+    dist_from_here[stop_id_to_interned] = dist;
+    dist_table_[stop_id_to_interned].emplace(stop_id, dist);
   }
 
   stop_schedules_.emplace(stop_id, BusList{});
-  stops_.emplace(Stop{ move(stop_id), latitude, longitude });
+  stops_.emplace(Stop{ stop_id, latitude, longitude });
 }
 
 void
-TransportManager::AddBusRoute(BusId bus_id,
-                                vector<StopId> route,
-                                bool is_roundtrip)
+TransportManager::AddBusRoute(string_view bus_id,
+                              const vector<string_view>& route,
+                              bool is_roundtrip)
 {
-  for (const auto& stop : route) {
-    stop_schedules_[stop].insert(bus_id);
+  bus_id = names_.Intern(bus_id);
+
+  Route::Data stops;
+  stops.reserve(route.size());
+  for (const auto stop : route) {
+    const auto stop_id = names_.Intern(stop);
+    stop_schedules_[stop_id].insert(bus_id);
+    stops.push_back(stop_id);
   }
-  bus_routes_[move(bus_id)] = Route(move(route), is_roundtrip);
+  bus_routes_[bus_id] = Route(move(stops), is_roundtrip);
 }
 
 bool
-TransportManager::IsBusDefined(const BusId& bus_id) const
+TransportManager::IsBusDefined(string_view bus_id) const
 {
   return bus_routes_.find(bus_id) != end(bus_routes_);
 }
 
 bool
-TransportManager::IsStopDefined(const StopId& stop_id) const
+TransportManager::IsStopDefined(string_view stop_id) const
 {
   return stops_.find(stop_id) != end(stops_);
 }
 
 optional<size_t>
-TransportManager::GetTotalStopNum(const BusId& bus_id) const
+TransportManager::GetTotalStopNum(string_view bus_id) const
 {
   auto it = bus_routes_.find(bus_id);
   if (it == end(bus_routes_)) {
@@ -64,7 +74,7 @@ TransportManager::GetTotalStopNum(const BusId& bus_id) const
 }
 
 optional<size_t>
-TransportManager::GetUniqueStopNum(const BusId& bus_id) const
+TransportManager::GetUniqueStopNum(string_view bus_id) const
 {
   auto it = bus_routes_.find(bus_id);
   if (it == end(bus_routes_)) {
@@ -79,7 +89,7 @@ TransportManager::GetUniqueStopNum(const BusId& bus_id) const
 }
 
 optional<double>
-TransportManager::GetRouteLength(const BusId& bus_id, DistanceType dt) const
+TransportManager::GetRouteLength(string_view bus_id, DistanceType dt) const
 {
   auto it = bus_routes_.find(bus_id);
   if (it == end(bus_routes_)) {
@@ -130,8 +140,8 @@ TransportManager::GetRouteLength(const BusId& bus_id, DistanceType dt) const
   return res;
 }
 
-optional<vector<TransportManager::StopId>>
-TransportManager::GetStopSchedule(const StopId& stop_id) const
+optional<vector<TransportManager::BusId>>
+TransportManager::GetStopSchedule(string_view stop_id) const
 {
   auto it = stop_schedules_.find(stop_id);
   if (it == end(stop_schedules_)) {
@@ -139,11 +149,11 @@ TransportManager::GetStopSchedule(const StopId& stop_id) const
   }
 
   const auto& bus_list = it->second;
-  return vector<StopId>{ begin(bus_list), end(bus_list) };
+  return vector<BusId>{ begin(bus_list), end(bus_list) };
 }
 
 std::optional<RouteStats>
-TransportManager::GetRouteStats(const StopId& from, const StopId& to) const
+TransportManager::GetRouteStats(string_view from, string_view to) const
 {
   if (graph_) {
     return graph_->GetRouteStats(from, to);
@@ -175,50 +185,64 @@ TransportGraph::Create(const BusRoutes& routes,
                         double bus_speed,
                         double stop_wait_time)
 {
-  std::set<StopId> unique_stops;
+  vector<string_view> unique_stops;
+  size_t route_edge_count = 0;
   for (const auto& [bus, route] : routes) {
-    for (const auto& stop : route) {
-      unique_stops.emplace(stop).second;
-    }
+    unique_stops.insert(end(unique_stops), begin(route), end(route));
+    const auto route_size = route.size();
+    const auto one_way_edge_count =
+      route_size > 0 ? route_size * (route_size - 1) / 2 : 0;
+    route_edge_count += one_way_edge_count * (route.IsRoundtrip() ? 1 : 2);
   }
+  sort(begin(unique_stops), end(unique_stops));
+  unique_stops.erase(unique(begin(unique_stops), end(unique_stops)),
+                     end(unique_stops));
 
   size_t graph_size = unique_stops.size() * 2;
   MathGraph graph(graph_size);
 
+  vector<StopId> stop_names;
+  stop_names.reserve(unique_stops.size());
+  vector<BusId> bus_names;
+  bus_names.reserve(routes.size());
+
   StopNodesInvIndex stops_inv_index;
+  stops_inv_index.reserve(unique_stops.size());
   EdgesIndex edges_index;
+  edges_index.reserve(unique_stops.size() + route_edge_count);
   NodesIndex nodes_index;
+  nodes_index.reserve(graph_size);
 
   size_t cur_node_id = 0;
-  for (auto& stop : unique_stops) {
-    GraphNode departure_node;
-    departure_node.type_ = GraphNode::Type::DEPARTURE;
-    departure_node.stop_ = stop;
+  for (const auto stop : unique_stops) {
+    const auto stop_name_id = NameId(stop_names.size());
+    const auto stop_name = stop_names.emplace_back(stop);
+
     const auto departure_node_id = cur_node_id++;
+    nodes_index.push_back({ GraphNode::Type::DEPARTURE, stop_name_id });
 
-    GraphNode arrival_node;
-    arrival_node.type_ = GraphNode::Type::ARRIVAL;
-    arrival_node.stop_ = stop;
     const auto arrival_node_id = cur_node_id++;
+    nodes_index.push_back({ GraphNode::Type::ARRIVAL, stop_name_id });
 
-    nodes_index[departure_node_id] = move(departure_node);
-    nodes_index[arrival_node_id] = move(arrival_node);
-    stops_inv_index[stop] = StopNodes{ arrival_node_id, departure_node_id };
+    stops_inv_index[stop_name] =
+      StopNodes{ arrival_node_id, departure_node_id };
 
     Graph::Edge<double> waiting_edge;
     waiting_edge.from = arrival_node_id;
     waiting_edge.to = departure_node_id;
     waiting_edge.weight = stop_wait_time;
 
-    const auto waiting_edge_id = graph.AddEdge(waiting_edge);
-    edges_index[waiting_edge_id] = StopActivity{ stop, stop_wait_time };
+    [[maybe_unused]] const auto waiting_edge_id = graph.AddEdge(waiting_edge);
+    assert(waiting_edge_id == edges_index.size());
+    edges_index.push_back(
+      { Activity::STOP, stop_name_id, 0, stop_wait_time });
   }
   unique_stops.clear();
   assert(cur_node_id == graph_size);
 
-  auto add_route_edges = [&](const auto& bus, auto first, auto last) {
+  auto add_route_edges = [&](NameId bus_name_id, auto first, auto last) {
     for (auto from_it = first; from_it != last; ++from_it) {
-      size_t span = 0;
+      uint32_t span = 0;
       double distance = 0.;
       for (auto to_it = next(from_it); to_it != last; ++to_it) {
         span += 1;
@@ -230,20 +254,26 @@ TransportGraph::Create(const BusRoutes& routes,
         route_edge.to = stops_inv_index.at(*to_it).arrival_;
         route_edge.weight = distance;
 
-        const auto route_edge_id = graph.AddEdge(route_edge);
-        edges_index[route_edge_id] = BusActivity{ bus, span, distance };
+        [[maybe_unused]] const auto route_edge_id = graph.AddEdge(route_edge);
+        assert(route_edge_id == edges_index.size());
+        edges_index.push_back({ Activity::BUS, bus_name_id, span, distance });
       }
     }
   };
 
   for (const auto& [bus, route] : routes) {
-    add_route_edges(bus, begin(route), end(route));
+    const auto bus_name_id = NameId(bus_names.size());
+    bus_names.push_back(bus);
+
+    add_route_edges(bus_name_id, begin(route), end(route));
     if (!route.IsRoundtrip()) {
-      add_route_edges(bus, rbegin(route), rend(route));
+      add_route_edges(bus_name_id, rbegin(route), rend(route));
     }
   }
 
   unique_ptr<TransportGraph> res(new TransportGraph(move(graph)));
+  res->stop_names_ = move(stop_names);
+  res->bus_names_ = move(bus_names);
   res->nodes_index_ = move(nodes_index);
   res->edges_index_ = move(edges_index);
   res->inv_stop_index_ = move(stops_inv_index);
@@ -251,7 +281,7 @@ TransportGraph::Create(const BusRoutes& routes,
 }
 
 std::optional<RouteStats>
-TransportGraph::GetRouteStats(const StopId& from, const StopId& to) const
+TransportGraph::GetRouteStats(StopId from, StopId to) const
 {
   auto from_stop_nodes_it = inv_stop_index_.find(from);
   auto to_stop_nodes_it = inv_stop_index_.find(to);
@@ -269,12 +299,21 @@ TransportGraph::GetRouteStats(const StopId& from, const StopId& to) const
 
   RouteStats res;
   res.time_ = route_info->weight;
+  res.activities_.reserve(route_info->edge_count);
   for (auto edge_idx = decltype(route_info->edge_count){ 0 };
        edge_idx < route_info->edge_count;
        ++edge_idx) {
-    auto edge_id = router_.GetRouteEdge(route_info->id, edge_idx);
-    res.activities_.push_back(edges_index_.at(edge_id));
+    const auto edge_id = router_.GetRouteEdge(route_info->id, edge_idx);
+    const auto& edge_info = edges_index_[edge_id];
+    if (edge_info.type_ == Activity::STOP) {
+      res.activities_.push_back(
+        StopActivity{ stop_names_[edge_info.name_], edge_info.time_ });
+    } else {
+      res.activities_.push_back(BusActivity{
+        bus_names_[edge_info.name_], edge_info.span_, edge_info.time_ });
+    }
   }
+  router_.ReleaseRoute(route_info->id);
   return res;
 }
 
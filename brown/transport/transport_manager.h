@@ -1,14 +1,17 @@
 #pragma once
 
 #include "graph.h"
+#include "name_arena.h"
 #include "router.h"
 #include "stop.h"
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
@@ -20,14 +23,12 @@ struct Distance
   double roads_ = -1.;
 };
 
-using DistanceTableRecord = std::unordered_map<std::string, double>;
-using DistanceTable = std::unordered_map<std::string, DistanceTableRecord>;
+// Bus and stop names are views into the NameArena of TransportManager
+using BusId = std::string_view;
+using StopId = std::string_view;
 
-using RouteTableRecord = std::vector<std::string>;
-using RouteTable = std::unordered_map<std::string, RouteTableRecord>;
-
-using BusId = std::string;
-using StopId = std::string;
+using DistanceTableRecord = std::unordered_map<StopId, double>;
+using DistanceTable = std::unordered_map<StopId, DistanceTableRecord>;
 
 class Route
 {
@@ -119,18 +120,19 @@ public:
   using MathGraph = Graph::DirectedWeightedGraph<double>;
   using MathRouter = Graph::Router<double>;
 
-  TransportGraph(const TransportGraph&) = default;
-  TransportGraph& operator=(const TransportGraph&) = default;
+  TransportGraph(const TransportGraph&) = delete;
+  TransportGraph& operator=(const TransportGraph&) = delete;
 
   static std::unique_ptr<TransportGraph> Create(const BusRoutes& routes,
                                                 const DistanceTable& distances,
                                                 double bus_speed,
                                                 double stop_wait_time);
 
-  std::optional<RouteStats> GetRouteStats(const StopId& from,
-                                          const StopId& to) const;
+  std::optional<RouteStats> GetRouteStats(StopId from, StopId to) const;
 
 private:
+  using NameId = std::uint32_t;
+
   struct GraphNode
   {
     enum class Type
@@ -138,7 +140,7 @@ private:
       ARRIVAL = 0,
       DEPARTURE = 1
     } type_;
-    StopId stop_;
+    NameId stop_;
   };
 
   struct StopNodes
@@ -147,8 +149,17 @@ private:
     Graph::VertexId departure_;
   };
 
-  using NodesIndex = std::unordered_map<Graph::VertexId, GraphNode>;
-  using EdgesIndex = std::unordered_map<Graph::EdgeId, Activity>;
+  struct EdgeInfo
+  {
+    Activity::Type type_;
+    NameId name_;
+    std::uint32_t span_;
+    double time_;
+  };
+
+  // vertex and edge ids are dense, so both indices are addressed by id
+  using NodesIndex = std::vector<GraphNode>;
+  using EdgesIndex = std::vector<EdgeInfo>;
   using StopNodesInvIndex = std::unordered_map<StopId, StopNodes>;
 
 private:
@@ -156,7 +167,12 @@ private:
 
 private:
   const MathGraph graph_;
-  MathRouter router_;
+  // expanded routes are cached by the router until released
+  mutable MathRouter router_;
+
+  // NameId is an index here
+  std::vector<StopId> stop_names_;
+  std::vector<BusId> bus_names_;
 
   NodesIndex nodes_index_;
   EdgesIndex edges_index_;
@@ -166,6 +182,8 @@ private:
 class TransportManager
 {
 public:
+  // owning names, as kept by requests; the manager itself stores views into
+  // its own NameArena
   using BusId = std::string;
   using StopId = std::string;
 
@@ -181,48 +199,48 @@ public:
     GEO
   };
 
-  using DistanceTableRecord = std::vector<std::pair<std::string, double>>;
+  using DistanceTableRecord = std::vector<std::pair<std::string_view, double>>;
 
   TransportManager();
   TransportManager(const Settings& settings);
 
-  void AddStop(StopId stop_id,
-                double latitude,
-                double longitude,
-                const DistanceTableRecord& record = {});
+  void AddStop(std::string_view stop_id,
+               double latitude,
+               double longitude,
+               const DistanceTableRecord& record = {});
 
-  void AddBusRoute(BusId bus_id,
-                     std::vector<StopId> route,
-                     bool is_roundtrip);
+  void AddBusRoute(std::string_view bus_id,
+                   const std::vector<std::string_view>& route,
+                   bool is_roundtrip);
 
-  bool IsBusDefined(const BusId& bus_id) const;
-  bool IsStopDefined(const StopId& stop_id) const;
+  bool IsBusDefined(std::string_view bus_id) const;
+  bool IsStopDefined(std::string_view stop_id) const;
 
-  std::optional<std::size_t> GetTotalStopNum(const BusId& bus_id) const;
-  std::optional<std::size_t> GetUniqueStopNum(const BusId& bus_id) const;
-  std::optional<double> GetRouteLength(const BusId& bus_id,
-                                         DistanceType dt) const;
+  std::optional<std::size_t> GetTotalStopNum(std::string_view bus_id) const;
+  std::optional<std::size_t> GetUniqueStopNum(std::string_view bus_id) const;
+  std::optional<double> GetRouteLength(std::string_view bus_id,
+                                       DistanceType dt) const;
 
-  std::optional<std::vector<StopId>> GetStopSchedule(
-    const StopId& stop_id) const;
+  std::optional<std::vector<BusId>> GetStopSchedule(
+    std::string_view stop_id) const;
 
-  std::optional<RouteStats> GetRouteStats(const StopId& from,
-                                            const StopId& to) const;
+  std::optional<RouteStats> GetRouteStats(std::string_view from,
+                                          std::string_view to) const;
 
   void InitGraph();
 
 private:
+  NameArena names_;
+
   BusRoutes bus_routes_;
 
-  using BusList = std::set<BusId>;
-  using StopSchedule = std::unordered_map<StopId, BusList>;
+  using BusList = std::set<::BusId>;
+  using StopSchedule = std::unordered_map<::StopId, BusList>;
   StopSchedule stop_schedules_;
 
   using StopSet = std::set<Stop, StopComparator>;
   StopSet stops_;
 
-  using DistanceTable =
-    std::unordered_map<std::string, std::unordered_map<std::string, double>>;
   DistanceTable dist_table_;
 
   std::unique_ptr<TransportGraph> graph_;
@@ -1,7 +1,7 @@
 #pragma once
 
+#include <charconv>
 #include <optional>
-#include <sstream>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -86,10 +86,11 @@ template<typename T>
 inline T
 ConvertFromView(std::string_view str)
 {
-  // copying...
+  while (!str.empty() && str.front() == ' ') {
+    str.remove_prefix(1);
+  }
 
   T result{};
-  std::istringstream is(str.data());
-  is >> result;
+  std::from_chars(str.data(), str.data() + str.size(), result);
   return result;
-}
\ No newline at end of file
+}